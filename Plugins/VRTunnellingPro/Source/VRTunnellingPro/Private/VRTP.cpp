@@ -2,7 +2,6 @@
 #include "VRTP.h"
 #include "GameFramework/Pawn.h"
 #include "PrimitiveSceneProxy.h"
-#include "Misc/ScopeLock.h"
 #include "EngineGlobals.h"
 #include "Engine/Engine.h"
 #include "Features/IModularFeatures.h"
@@ -30,15 +29,16 @@
 #include "Engine/LocalPlayer.h"
 #include "Kismet/KismetMathLibrary.h"
 #include "Kismet/GameplayStatics.h"
-#include "VRTPMask.h"
+#include "VRTPMaskSubsystem.h"
+#include "VRTPMotionSubsystem.h"
+#include "VRTPCaptureSubsystem.h"
+#include "VRTPScalability.h"
+#include "RenderingThread.h"
+#include "TextureResource.h"
 
 DEFINE_LOG_CATEGORY_STATIC(LogMotionControllerComponent, Log, All);
 
 namespace {
-	/** This is to prevent destruction of motion controller components while they are
-	in the middle of being accessed by the render thread */
-	FCriticalSection CritSect;
-
 	/** Console variable for specifying whether motion controller late update is used */
 	TAutoConsoleVariable<int32> CVarEnableMotionControllerLateUpdate(
 		TEXT("vr.EnableMotionControllerLateUpdate"),
@@ -47,6 +47,45 @@ namespace {
 		TEXT(" 0: don't use late update\n")
 		TEXT(" 1: use late update (default)"),
 		ECVF_Cheat);
+
+	/** Polls the motion controllers, then the HMD if it is the source. Safe on the game and render threads.
+	OutController is the motion controller that supplied the pose, or nullptr for the HMD. */
+	bool PollTrackedPose(int32 PlayerIndex, FName MotionSource, float WorldToMetersScale, FVector& Position, FRotator& Orientation, ETrackingStatus& OutTrackingStatus, IMotionController*& OutController)
+	{
+		OutController = nullptr;
+		OutTrackingStatus = ETrackingStatus::NotTracked;
+
+		TArray<IMotionController*> MotionControllers = IModularFeatures::Get().GetModularFeatureImplementations<IMotionController>(IMotionController::GetModularFeatureName());
+		for (auto MotionController : MotionControllers)
+		{
+			if (MotionController == nullptr)
+			{
+				continue;
+			}
+
+			OutTrackingStatus = MotionController->GetControllerTrackingStatus(PlayerIndex, MotionSource);
+			if (MotionController->GetControllerOrientationAndPosition(PlayerIndex, MotionSource, Orientation, Position, WorldToMetersScale))
+			{
+				OutController = MotionController;
+				return true;
+			}
+		}
+
+		if (MotionSource == FXRMotionControllerBase::HMDSourceId)
+		{
+			IXRTrackingSystem* TrackingSys = GEngine->XRSystem.Get();
+			if (TrackingSys)
+			{
+				FQuat OrientationQuat;
+				if (TrackingSys->GetCurrentPose(IXRTrackingSystem::HMDDeviceId, OrientationQuat, Position))
+				{
+					Orientation = OrientationQuat.Rotator();
+					return true;
+				}
+			}
+		}
+		return false;
+	}
 } // anonymous namespace
 
 
@@ -70,7 +109,6 @@ namespace LegacyMotionSources
 //=============================================================================
 UVRTunnellingPro::UVRTunnellingPro(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
-	, RenderThreadComponentScale(1.0f, 1.0f, 1.0f)
 {
 	PrimaryComponentTick.bCanEverTick = true;
 	PrimaryComponentTick.bStartWithTickEnabled = true;
@@ -78,6 +116,7 @@ UVRTunnellingPro::UVRTunnellingPro(const FObjectInitializer& ObjectInitializer)
 	PrimaryComponentTick.bTickEvenWhenPaused = true;
 
 	PlayerIndex = 0;
+	MaskLayers = 0xFF;
 	MotionSource = FXRMotionControllerBase::HMDSourceId;
 	bDisableLowLatencyUpdate = false;
 	bHasAuthority = false;
@@ -93,10 +132,9 @@ void UVRTunnellingPro::BeginDestroy()
 	Super::BeginDestroy();
 	if (ViewExtension.IsValid())
 	{
-		{
-			FScopeLock ScopeLock(&CritSect);
-			ViewExtension->MotionControllerComponent = NULL;
-		}
+		// The render thread may still hold the extension; it only ever sees the published state, never the component
+		SendLateUpdateState(false);
+		ViewExtension->MotionControllerComponent = NULL;
 
 		ViewExtension.Reset();
 	}
@@ -106,7 +144,12 @@ void UVRTunnellingPro::CacheSettings()
 {
 	SkyboxBlueprintSwap = SkyboxBlueprint;
 	CubeMapOverrideSwap = CubeMapOverride;
+	CaptureSettingsSwap = CaptureSettings;
+	BakedSkyboxSwap = BakedSkybox;
 	PostProcessMaterialSwap = PostProcessMaterial;
+	MaterialPermutationsSwap = MaterialPermutations;
+	ParameterCollectionSwap = ParameterCollection;
+	RenderModeSwap = RenderMode;
 	EffectColorSwap = EffectColor;
 	EffectCoverageSwap = EffectCoverage;
 	EffectFeatherSwap = EffectFeather;
@@ -133,6 +176,8 @@ void UVRTunnellingPro::CacheSettings()
 	AccelerationMinSwap = AccelerationMin;
 	AccelerationMaxSwap = AccelerationMax;
 	AccelerationSmoothingSwap = AccelerationSmoothing;
+	SmoothingModeSwap = SmoothingMode;
+	SmoothingBetaSwap = SmoothingBeta;
 }
 
 void UVRTunnellingPro::InitFromPreset()
@@ -147,7 +192,12 @@ void UVRTunnellingPro::InitFromPreset()
 	{
 		SkyboxBlueprint			= SkyboxBlueprintSwap;
 		CubeMapOverride			= CubeMapOverrideSwap;
+		CaptureSettings			= CaptureSettingsSwap;
+		BakedSkybox				= BakedSkyboxSwap;
 		PostProcessMaterial		= PostProcessMaterialSwap;
+		MaterialPermutations	= MaterialPermutationsSwap;
+		ParameterCollection		= ParameterCollectionSwap;
+		RenderMode				= RenderModeSwap;
 		EffectColor				= EffectColorSwap;
 		EffectCoverage			= EffectCoverageSwap;
 		EffectFeather			= EffectFeatherSwap;
@@ -174,6 +224,8 @@ void UVRTunnellingPro::InitFromPreset()
 		AccelerationMin			= AccelerationMinSwap;
 		AccelerationMax			= AccelerationMaxSwap;
 		AccelerationSmoothing	= AccelerationSmoothingSwap;
+		SmoothingMode			= SmoothingModeSwap;
+		SmoothingBeta			= SmoothingBetaSwap;
 	}
 }
 
@@ -184,7 +236,12 @@ void UVRTunnellingPro::SetPresetData(UVRTPPresetData* NewPreset)
 		Preset = NewPreset;
 		SkyboxBlueprint			= Preset->Data.SkyboxBlueprint;
 		CubeMapOverride			= Preset->Data.CubeMapOverride;
+		CaptureSettings			= Preset->Data.CaptureSettings;
+		BakedSkybox				= Preset->Data.BakedSkybox;
 		PostProcessMaterial		= Preset->Data.PostProcessMaterial;
+		MaterialPermutations	= Preset->Data.MaterialPermutations;
+		ParameterCollection		= Preset->Data.ParameterCollection;
+		RenderMode				= Preset->Data.RenderMode;
 		EffectColor				= Preset->Data.EffectColor;
 		EffectCoverage			= Preset->Data.EffectCoverage;
 		EffectFeather			= Preset->Data.EffectFeather;
@@ -211,6 +268,8 @@ void UVRTunnellingPro::SetPresetData(UVRTPPresetData* NewPreset)
 		AccelerationMin			= Preset->Data.AccelerationMin;
 		AccelerationMax			= Preset->Data.AccelerationMax;
 		AccelerationSmoothing	= Preset->Data.AccelerationSmoothing;
+		SmoothingMode			= Preset->Data.SmoothingMode;
+		SmoothingBeta			= Preset->Data.SmoothingBeta;
 	}	
 }
 
@@ -219,8 +278,11 @@ void UVRTunnellingPro::UpdatePostProcessSettings()
 {
 	if (PostProcessMID)
 	{
+		SelectPermutation();
+		ParameterBlock.SetCollection(ParameterCollection ? GetWorld()->GetParameterCollectionInstance(ParameterCollection) : nullptr, PlayerIndex);
 		ApplyBackgroundMode();
 		ApplyMaskMode();
+		ApplyRenderMode();
 		ApplyColor(ApplyEffectColor);
 		SetFeather(EffectFeather);
 		SetStencilMask(StencilIndex, true);
@@ -231,31 +293,57 @@ void UVRTunnellingPro::ApplyPreset(UVRTPPresetData* NewPreset)
 {
 	if (NewPreset)
 	{
-		SetPresetData(NewPreset);
-		if (CaptureInit) {
-			UpdatePostProcessSettings();
+		// Before the assets are first requested, the stages pick the preset up as they run
+		if (InitStage == EVRTPInitStage::LoadAssets)
+		{
+			SetPresetData(NewPreset);
+			return;
 		}
+
+		// Otherwise the current assets stay in use until the new preset's have streamed in, and it is applied then
+		PendingPreset = NewPreset;
+		RequestAssets();
+		bSettingsPending = true;
 	}
 }
 
 
-void UVRTunnellingPro::SendRenderTransform_Concurrent()
-{
-	RenderThreadRelativeTransform = GetRelativeTransform();
-	RenderThreadComponentScale = GetComponentScale();
-	Super::SendRenderTransform_Concurrent();
-}
-
 //=============================================================================
 void UVRTunnellingPro::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction *ThisTickFunction)
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 	
-	if (!CaptureInit)
+	// Nothing that uses the soft asset references runs while they are streaming in
+	AssetLoader.Update();
+	if (AssetLoader.IsLoaded())
 	{
-		CaptureInit = true;
-		InitCapture();
-		InitSkybox();
+		if (PendingPreset != NULL)
+		{
+			SetPresetData(PendingPreset);
+			PendingPreset = NULL;
+		}
+
+		if (InitStage != EVRTPInitStage::Ready)
+		{
+			do
+			{
+				AdvanceInit();
+			} while (InitStage != EVRTPInitStage::Ready && !FVRTPAssetLoader::IsAsync());
+		}
+		else
+		{
+			if (ScalabilityGeneration != FVRTPScalability::GetGeneration())
+			{
+				ScalabilityGeneration = FVRTPScalability::GetGeneration();
+				ApplyScalability();
+			}
+			if (bSettingsPending)
+			{
+				bSettingsPending = false;
+				UpdatePostProcessSettings();
+			}
+			UpdateCaptureResources(DeltaTime);
+		}
 	}
 
 	if (IsActive())
@@ -267,6 +355,7 @@ void UVRTunnellingPro::TickComponent(float DeltaTime, enum ELevelTick TickType,
 		if (bNewTrackedState)
 		{
 			SetRelativeLocationAndRotation(Position, Orientation);
+			TrackedPoseHistory.Push({ FPlatformTime::Seconds(), Position, Orientation.Quaternion() });
 		}
 
 		// if controller tracking just kicked in 
@@ -275,15 +364,30 @@ void UVRTunnellingPro::TickComponent(float DeltaTime, enum ELevelTick TickType,
 		if (!ViewExtension.IsValid() && GEngine)
 		{
 			ViewExtension = FSceneViewExtensions::NewExtension<FViewExtension>(this);
+			bRenderStateEnabled = false;
 		}
+		SendLateUpdateState(!bDisableLowLatencyUpdate);
+		UpdateMaskCapture();
 
 		// Send Actor directional vectors for skybox (cubemap) lookup
 		if (PostProcessMID)
 		{
-			CalculateMotion(DeltaTime);
-			PostProcessMID->SetVectorParameterValue(FName("Up"), GetOwner()->GetActorUpVector());
-			PostProcessMID->SetVectorParameterValue(FName("Right"), GetOwner()->GetActorRightVector());
-			PostProcessMID->SetVectorParameterValue(FName("Forward"), GetOwner()->GetActorForwardVector());
+			const FVRTPMotionSample Sample = GatherMotionSample();
+			CalculateMotion(Sample, DeltaTime);
+			ParameterBlock.SetVector(EVRTPVectorParameter::Up, Sample.Up);
+			ParameterBlock.SetVector(EVRTPVectorParameter::Right, Sample.Right);
+			ParameterBlock.SetVector(EVRTPVectorParameter::Forward, Sample.Forward);
+			if (!bMotionPending)
+			{
+				ParameterBlock.Flush();
+				SendRenderState();
+			}
+		}
+
+		// Keep a live capture current while the skybox is on screen
+		if (LiveCapture.IsActive() && BackgroundMode == EVRTPBackgroundMode::MM_SKYBOX && !IdleGate.bIdle)
+		{
+			LiveCapture.Tick(GetOwner()->GetActorQuat(), SceneCaptureCube->GetForwardVector());
 		}
 	}
 }
@@ -371,7 +475,41 @@ void UVRTunnellingPro::PostEditChangeProperty(FPropertyChangedEvent& PropertyCha
 void UVRTunnellingPro::BeginPlay()
 {
 	Super::BeginPlay();
-	CaptureInit = false;
+	InitStage = EVRTPInitStage::LoadAssets;
+	bSettingsPending = false;
+	PendingPreset = NULL;
+	ScalabilityGeneration = FVRTPScalability::GetGeneration();
+}
+
+//=============================================================================
+void UVRTunnellingPro::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	ReleaseMotionInstance();
+
+	// Masks shared with other tunnelling components keep only their stencil bits
+	if (UVRTPMaskSubsystem* MaskSubsystem = GetWorld()->GetSubsystem<UVRTPMaskSubsystem>())
+	{
+		MaskSubsystem->OnMasksChanged.Remove(MasksChangedHandle);
+		MasksChangedHandle.Reset();
+		MaskSubsystem->RemoveApplier(this);
+	}
+
+	ReleaseCapture();
+	MaskCapture.Release();
+	AssetLoader.Release();
+
+	// Stop the native pass for good
+	if (ViewExtension.IsValid())
+	{
+		ENQUEUE_RENDER_COMMAND(VRTPClearRenderState)(
+			[Extension = ViewExtension](FRHICommandListImmediate& RHICmdList)
+			{
+				Extension->RenderState = FVRTPRenderState();
+			});
+		bRenderStateEnabled = false;
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 
@@ -385,54 +523,46 @@ void UVRTunnellingPro::OnComponentDestroyed(bool bDestroyingHierarchy)
 //=============================================================================
 bool UVRTunnellingPro::PollControllerState(FVector& Position, FRotator& Orientation, float WorldToMetersScale)
 {
-	if (IsInGameThread())
-	{
-		// Cache state from the game thread for use on the render thread
-		const AActor* MyOwner = GetOwner();
-		const APawn* MyPawn = Cast<APawn>(MyOwner);
-		bHasAuthority = MyPawn ? MyPawn->IsLocallyControlled() : (MyOwner->GetLocalRole() == ENetRole::ROLE_Authority);
-	}
+	check(IsInGameThread());
+
+	const AActor* MyOwner = GetOwner();
+	const APawn* MyPawn = Cast<APawn>(MyOwner);
+	bHasAuthority = MyPawn ? MyPawn->IsLocallyControlled() : (MyOwner->GetLocalRole() == ENetRole::ROLE_Authority);
 
 	if (bHasAuthority)
 	{
-		TArray<IMotionController*> MotionControllers = IModularFeatures::Get().GetModularFeatureImplementations<IMotionController>(IMotionController::GetModularFeatureName());
-		for (auto MotionController : MotionControllers)
-		{
-			if (MotionController == nullptr)
-			{
-				continue;
-			}
-
-			CurrentTrackingStatus = MotionController->GetControllerTrackingStatus(PlayerIndex, MotionSource);
-			if (MotionController->GetControllerOrientationAndPosition(PlayerIndex, MotionSource, Orientation, Position, WorldToMetersScale))
-			{
-				if (IsInGameThread())
-				{
-					InUseMotionController = MotionController;
-					OnMotionControllerUpdated();
-					InUseMotionController = nullptr;
-				}
-				return true;
-			}
-		}
-
-		if (MotionSource == FXRMotionControllerBase::HMDSourceId)
+		IMotionController* MotionController = nullptr;
+		if (PollTrackedPose(PlayerIndex, MotionSource, WorldToMetersScale, Position, Orientation, CurrentTrackingStatus, MotionController))
 		{
-			IXRTrackingSystem* TrackingSys = GEngine->XRSystem.Get();
-			if (TrackingSys)
+			if (MotionController)
 			{
-				FQuat OrientationQuat;
-				if (TrackingSys->GetCurrentPose(IXRTrackingSystem::HMDDeviceId, OrientationQuat, Position))
-				{
-					Orientation = OrientationQuat.Rotator();
-					return true;
-				}
+				InUseMotionController = MotionController;
+				OnMotionControllerUpdated();
+				InUseMotionController = nullptr;
 			}
+			return true;
 		}
 	}
 	return false;
 }
 
+//=============================================================================
+void UVRTunnellingPro::SendLateUpdateState(bool bEnabled)
+{
+	check(IsInGameThread());
+	if (!ViewExtension.IsValid())
+	{
+		return;
+	}
+
+	FViewExtension::FLateUpdateState& State = ViewExtension->LateUpdateState.GetWriteBuffer();
+	State.bEnabled = bEnabled;
+	State.bHasAuthority = bHasAuthority;
+	State.PlayerIndex = PlayerIndex;
+	State.MotionSource = MotionSource;
+	ViewExtension->LateUpdateState.SwapWriteBuffers();
+}
+
 //=============================================================================
 UVRTunnellingPro::FViewExtension::FViewExtension(const FAutoRegister& AutoRegister, UVRTunnellingPro* InMotionControllerComponent)
 	: FSceneViewExtensionBase(AutoRegister)
@@ -454,67 +584,93 @@ void UVRTunnellingPro::FViewExtension::BeginRenderViewFamily(FSceneViewFamily& I
 //=============================================================================
 void UVRTunnellingPro::FViewExtension::PreRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily)
 {
-	if (!MotionControllerComponent)
+	// Picks up the newest state the game thread published, or keeps the last one; never waits on the game thread
+	if (LateUpdateState.IsDirty())
+	{
+		LateUpdateState.SwapReadBuffers();
+	}
+	const FLateUpdateState& State = LateUpdateState.Read();
+
+	// The extension may only be active for the native vignette
+	if (!State.bEnabled || !State.bHasAuthority || !CVarEnableMotionControllerLateUpdate.GetValueOnRenderThread())
 	{
 		return;
 	}
 
-	FTransform NewTransform;
-	
+	// Find a view that is associated with this player.
+	float WorldToMetersScale = -1.0f;
+	for (const FSceneView* SceneView : InViewFamily.Views)
 	{
-		FScopeLock ScopeLock(&CritSect);
-		if (!MotionControllerComponent)
+		if (SceneView && SceneView->PlayerIndex == State.PlayerIndex)
 		{
-			return;
+			WorldToMetersScale = SceneView->WorldToMetersScale;
+			break;
 		}
+	}
+	// If there are no views associated with this player use view 0.
+	if (WorldToMetersScale < 0.0f)
+	{
+		check(InViewFamily.Views.Num() > 0);
+		WorldToMetersScale = InViewFamily.Views[0]->WorldToMetersScale;
+	}
 
-		// Find a view that is associated with this player.
-		float WorldToMetersScale = -1.0f;
-		for (const FSceneView* SceneView : InViewFamily.Views)
-		{
-			if (SceneView && SceneView->PlayerIndex == MotionControllerComponent->PlayerIndex)
-			{
-				WorldToMetersScale = SceneView->WorldToMetersScale;
-				break;
-			}
-		}
-		// If there are no views associated with this player use view 0.
-		if (WorldToMetersScale < 0.0f)
-		{
-			check(InViewFamily.Views.Num() > 0);
-			WorldToMetersScale = InViewFamily.Views[0]->WorldToMetersScale;
-		}
+	// Poll state for the most recent controller transform
+	FVector Position;
+	FRotator Orientation;
+	ETrackingStatus TrackingStatus;
+	IMotionController* MotionController;
+	if (PollTrackedPose(State.PlayerIndex, State.MotionSource, WorldToMetersScale, Position, Orientation, TrackingStatus, MotionController))
+	{
+		LatePoseHistory.Push({ FPlatformTime::Seconds(), Position, Orientation.Quaternion() });
+	}
+}
 
-		// Poll state for the most recent controller transform
-		FVector Position;
-		FRotator Orientation;
-		if (!MotionControllerComponent->PollControllerState(Position, Orientation, WorldToMetersScale))
-		{
-			return;
-		}
+void UVRTunnellingPro::FViewExtension::PostRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily)
+{
+	check(IsInRenderingThread());
 
-		NewTransform = FTransform(Orientation, Position, MotionControllerComponent->RenderThreadComponentScale);
-		
-	} // Release the lock on the MotionControllerComponent
+	// LateUpdate.PostRender_RenderThread(); // not required in 4.24
+}
 
+bool UVRTunnellingPro::FViewExtension::IsActiveThisFrame(class FViewport* InViewport) const
+{
+	check(IsInGameThread());
+	return MotionControllerComponent
+		&& ((!MotionControllerComponent->bDisableLowLatencyUpdate && CVarEnableMotionControllerLateUpdate.GetValueOnGameThread()) || MotionControllerComponent->UsesNativePass());
 }
 
-void UVRTunnellingPro::FViewExtension::PostRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily)
+void UVRTunnellingPro::FViewExtension::SubscribeToPostProcessingPass(EPostProcessingPass Pass, FAfterPassCallbackDelegateArray& InOutPassCallbacks, bool bIsPassEnabled)
 {
-	check(IsInRenderingThread());
+	// After tonemapping, where the post process material is blended by default
+	if (Pass == EPostProcessingPass::Tonemap && (RenderState.bEnabled || PendingWarmup != 0))
+	{
+		InOutPassCallbacks.Add(FAfterPassCallbackDelegate::CreateRaw(this, &FViewExtension::PostProcessPass_RenderThread));
+	}
+}
 
-	if (!MotionControllerComponent)
+FScreenPassTexture UVRTunnellingPro::FViewExtension::PostProcessPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs)
+{
+	// The component only enables the pass for SM5 worlds, but another view of a lower feature level must not look up missing shaders
+	if (!IsVRTPNativePassSupported(View.GetFeatureLevel()))
 	{
-		return;
+		return Inputs.GetInput(EPostProcessMaterialInput::SceneColor);
 	}
 
-	// LateUpdate.PostRender_RenderThread(); // not required in 4.24
+	if (PendingWarmup != 0)
+	{
+		AddVRTPWarmupPasses(GraphBuilder, View, Inputs, PendingWarmup);
+		PendingWarmup = 0;
+	}
+	return AddVRTPVignettePass(GraphBuilder, View, Inputs, RenderState);
 }
 
-bool UVRTunnellingPro::FViewExtension::IsActiveThisFrame(class FViewport* InViewport) const
+void UVRTunnellingPro::GetTrackedMotion(FVector& LinearVelocity, FVector& AngularVelocity) const
 {
-	check(IsInGameThread());
-	return MotionControllerComponent && !MotionControllerComponent->bDisableLowLatencyUpdate && CVarEnableMotionControllerLateUpdate.GetValueOnGameThread();
+	const FVRTPKinematics Kinematics = ViewExtension.IsValid()
+		? FVRTPPoseHistory::Estimate(TrackedPoseHistory, ViewExtension->LatePoseHistory)
+		: TrackedPoseHistory.Estimate();
+	LinearVelocity = Kinematics.Velocity;
+	AngularVelocity = FMath::RadiansToDegrees(Kinematics.AngularVelocity);
 }
 
 float UVRTunnellingPro::GetParameterValue(FName InName, bool& bValueFound)
@@ -530,89 +686,476 @@ float UVRTunnellingPro::GetParameterValue(FName InName, bool& bValueFound)
 
 //*************************************************************
 
-void UVRTunnellingPro::InitCapture()
+void UVRTunnellingPro::AdvanceInit()
 {
-	// Initialise Cube Capture
-	SceneCaptureCube = NewObject<USceneCaptureComponentCube>(GetOwner());
-	
-	TC = NewObject<UTextureRenderTargetCube>();
-	TC->ClearColor = FLinearColor::Black;
-	TC->bHDR = false;
-	TC->InitAutoFormat(1024);
-
-	SceneCaptureCube->TextureTarget = TC;
-	SceneCaptureCube->bCaptureOnMovement = false;
-	SceneCaptureCube->bCaptureEveryFrame = false;
-	SceneCaptureCube->bAutoActivate = true;
-	SceneCaptureCube->CaptureStereoPass = EStereoscopicPass::eSSP_FULL;
-
-	SceneCaptureCube->ShowFlags.SetAntiAliasing(false);
-	SceneCaptureCube->ShowFlags.SetAtmosphere(false);
-	SceneCaptureCube->ShowFlags.SetBloom(false);
-	SceneCaptureCube->ShowFlags.SetBSP(false);
-	SceneCaptureCube->ShowFlags.SetDeferredLighting(false);
-	SceneCaptureCube->ShowFlags.SetEyeAdaptation(true);
-	SceneCaptureCube->ShowFlags.SetFog(false);
-	SceneCaptureCube->ShowFlags.SetVolumetricFog(false);
+	switch (InitStage)
+	{
+		case EVRTPInitStage::LoadAssets:
+			RequestAssets();
+			InitStage = EVRTPInitStage::CreateMaterials;
+			break;
+
+		case EVRTPInitStage::CreateMaterials:
+			// Queued first, so the native pass warms up before its first draw
+			StartWarmup();
+			InitCapture();
+			InitStage = EVRTPInitStage::AllocateCapture;
+			break;
 
+		case EVRTPInitStage::AllocateCapture:
+			UpdateCaptureResources(0.0f);
+			InitStage = EVRTPInitStage::WarmUp;
+			break;
+
+		case EVRTPInitStage::WarmUp:
+			if (UVRTPWarmupSubsystem* Warmup = GetWorld()->GetSubsystem<UVRTPWarmupSubsystem>())
+			{
+				if (!Warmup->IsIdle())
+				{
+					break;
+				}
+			}
+			InitStage = EVRTPInitStage::Ready;
+
+			// Swap the colour fallback for the real background
+			bSettingsPending = false;
+			UpdatePostProcessSettings();
+			OnTunnellingReady.Broadcast();
+			break;
+
+		default:
+			InitStage = EVRTPInitStage::Ready;
+			break;
+	}
+}
+
+void UVRTunnellingPro::RequestAssets()
+{
+	// A preset waiting to be applied is loaded in place of the current settings, whose assets stay loaded until it arrives
+	TArray<FSoftObjectPath> Paths;
+	if (PendingPreset != NULL)
+	{
+		const FVRTPPreset& Data = PendingPreset->Data;
+		Paths = {
+			Data.SkyboxBlueprint.ToSoftObjectPath(),
+			Data.CubeMapOverride.ToSoftObjectPath(),
+			Data.BakedSkybox.ToSoftObjectPath(),
+			Data.PostProcessMaterial.ToSoftObjectPath(),
+			Data.MaterialPermutations.ToSoftObjectPath()
+		};
+	}
+	else
+	{
+		Paths = {
+			SkyboxBlueprint.ToSoftObjectPath(),
+			CubeMapOverride.ToSoftObjectPath(),
+			BakedSkybox.ToSoftObjectPath(),
+			PostProcessMaterial.ToSoftObjectPath(),
+			MaterialPermutations.ToSoftObjectPath()
+		};
+	}
+
+	// The warm-up presets' materials stay loaded too, so applying them later neither loads nor compiles anything
+	FVRTPWarmupSet Warmup;
+	GatherWarmup(Warmup);
+	Warmup.GetAssetPaths(Paths);
+	AssetLoader.Request(Paths);
+}
+
+void UVRTunnellingPro::GatherWarmup(FVRTPWarmupSet& OutWarmup) const
+{
+	// Native modes fall back to the material where the native pass is unsupported
+	const bool bNativeSupported = GetWorld() != NULL && IsVRTPNativePassSupported(GetWorld()->GetFeatureLevel());
+	const auto AddSettings = [&OutWarmup, bNativeSupported](const TSoftObjectPtr<UMaterial>& Material, const TSoftObjectPtr<UVRTPMaterialPermutations>& Permutations, EVRTPRenderMode Mode)
+	{
+		if (Mode == EVRTPRenderMode::RM_MATERIAL || !bNativeSupported)
+		{
+			OutWarmup.AddMaterial(Material, Permutations);
+		}
+		else
+		{
+			OutWarmup.AddNative(Mode == EVRTPRenderMode::RM_ANNULUS);
+		}
+	};
+
+	// The current settings, the defaults a disabled preset restores, and every preset the component may apply
+	AddSettings(PostProcessMaterial, MaterialPermutations, RenderMode);
+	AddSettings(PostProcessMaterialSwap, MaterialPermutationsSwap, RenderModeSwap);
+	if (Preset != NULL)
+	{
+		AddSettings(Preset->Data.PostProcessMaterial, Preset->Data.MaterialPermutations, Preset->Data.RenderMode);
+	}
+	for (const UVRTPPresetData* WarmupPreset : WarmupPresets)
+	{
+		if (WarmupPreset != NULL)
+		{
+			AddSettings(WarmupPreset->Data.PostProcessMaterial, WarmupPreset->Data.MaterialPermutations, WarmupPreset->Data.RenderMode);
+		}
+	}
+}
+
+void UVRTunnellingPro::StartWarmup()
+{
+	UVRTPWarmupSubsystem* Subsystem = GetWorld()->GetSubsystem<UVRTPWarmupSubsystem>();
+	if (Subsystem == NULL || !UVRTPWarmupSubsystem::IsEnabled())
+	{
+		return;
+	}
+
+	FVRTPWarmupSet Warmup;
+	GatherWarmup(Warmup);
+
+	TArray<UMaterialInterface*> Materials;
+	Warmup.GetMaterials(Materials);
+	Subsystem->Warm(Materials, !FVRTPAssetLoader::IsAsync());
+
+	const uint32 NativePermutations = Warmup.GetNativePermutations();
+	if (ViewExtension.IsValid() && NativePermutations != 0)
+	{
+		ENQUEUE_RENDER_COMMAND(VRTPWarmup)(
+			[Extension = ViewExtension, NativePermutations](FRHICommandListImmediate& RHICmdList)
+			{
+				Extension->PendingWarmup |= NativePermutations;
+			});
+	}
+}
+
+bool UVRTunnellingPro::IsTunnellingReady() const
+{
+	return InitStage == EVRTPInitStage::Ready;
+}
+
+EVRTPBackgroundMode UVRTunnellingPro::GetActiveBackgroundMode() const
+{
+	// Colour needs no assets or capture, so it stands in until the component is ready, and for the skybox at low scalability
+	if (!IsTunnellingReady() || (BackgroundMode == EVRTPBackgroundMode::MM_SKYBOX && FVRTPScalability::UseSkyboxFallback()))
+	{
+		return EVRTPBackgroundMode::MM_COLOR;
+	}
+	return BackgroundMode;
+}
+
+EVRTPMaskMode UVRTunnellingPro::GetActiveMaskMode() const
+{
+	return FVRTPScalability::AllowMasks() ? MaskMode : EVRTPMaskMode::MM_OFF;
+}
+
+void UVRTunnellingPro::ApplyScalability()
+{
+	// Recapture at the new resolution; UpdateCaptureResources allocates it again if the background still needs it
+	if (TC != NULL && TC->SizeX != CaptureSettings.GetResolution())
+	{
+		ReleaseCapture();
+	}
+	UpdateCaptureResources(0.0f);
+	bSettingsPending = true;
+}
+
+void UVRTunnellingPro::InitCapture()
+{
+	// The cube capture itself is allocated by UpdateCaptureResources, once the background mode needs it
 	UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
 	if (PlayerCamera != NULL)
 	{
 		IXRTrackingSystem* TrackingSys = GEngine->XRSystem.Get();
 		if (TrackingSys)
 		{
-			PostProcessMID = UMaterialInstanceDynamic::Create(PostProcessMaterial, this);
-			PlayerCamera->PostProcessSettings.AddBlendable(PostProcessMID, 1.0f);
+			SelectPermutation();
 			UpdatePostProcessSettings();
 			IHeadMountedDisplay* HMD = GEngine->XRSystem->GetHMDDevice();
 			HMD->GetFieldOfView(HFov, VFov);
+		}
+	}
+}
+
+bool UVRTunnellingPro::SelectPermutation()
+{
+	// The static-switch instance for the active modes, or the effect material itself if there is none
+	UMaterialInterface* Source = PostProcessMaterial.Get();
+	if (const UVRTPMaterialPermutations* Permutations = MaterialPermutations.Get())
+	{
+		const int32 Key = FVRTPMaterialPermutation::MakeKey((uint8)GetActiveBackgroundMode(), (uint8)GetActiveMaskMode(), ApplyEffectColor, GetSkyboxCubeMap() != NULL);
+		if (UMaterialInterface* Permutation = Permutations->Find(Key))
+		{
+			Source = Permutation;
+		}
+	}
+	if (PostProcessMID != NULL && PostProcessMID->Parent == Source)
+	{
+		return false;
+	}
+
+	// Switching during gameplay compiles the material's on-screen pipeline state now; the native pass does not draw it
+	UVRTPWarmupSubsystem* Warmup = GetWorld()->GetSubsystem<UVRTPWarmupSubsystem>();
+	if (Warmup != NULL && IsTunnellingReady() && !UsesNativePass())
+	{
+		Warmup->NoteGameplayUse(Source);
+	}
+
+	UMaterialInstanceDynamic*& MID = PostProcessMIDs.FindOrAdd(Source);
+	if (MID == NULL)
+	{
+		MID = UMaterialInstanceDynamic::Create(Source, this);
+	}
+
+	if (PostProcessMID != NULL)
+	{
+		ParameterBlock.RemoveTarget(PostProcessMID);
+		UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
+		if (PlayerCamera != NULL)
+		{
+			PlayerCamera->PostProcessSettings.RemoveBlendable(PostProcessMID);
+		}
+	}
+	PostProcessMID = MID;
+	ParameterBlock.AddTarget(PostProcessMID);
+	PostProcessMID->SetTextureParameterValue(FName("TC"), TC);
+	return true;
+}
+
+void UVRTunnellingPro::UpdatePermutation()
+{
+	// A newly selected permutation needs the per-instance parameters and the blendable; the parameter block has already written the rest
+	if (PostProcessMID != NULL && SelectPermutation())
+	{
+		PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilMatch.MaterialStencil);
+		PostProcessMID->SetScalarParameterValue(FName("ApplyEffectColor"), (float)ApplyEffectColor);
+		ApplyBackgroundMode();
+		ApplyMaskMode();
+		ApplyRenderMode();
+	}
+}
+
+void UVRTunnellingPro::UpdateCaptureResources(float DeltaTime)
+{
+	// Only the skybox background samples the capture, and not at all with a cube map override or baked skybox
+	const bool bNeeded = BackgroundMode == EVRTPBackgroundMode::MM_SKYBOX && !FVRTPScalability::UseSkyboxFallback() && GetSkyboxCubeMap() == NULL;
+	switch (CaptureLifetime.Update(bNeeded, DeltaTime))
+	{
+		case FVRTPCaptureLifetime::EAction::Allocate:
+			AllocateCapture();
+			break;
+
+		case FVRTPCaptureLifetime::EAction::Release:
+			ReleaseCapture();
+			break;
+
+		default:
+			break;
+	}
+}
+
+void UVRTunnellingPro::AllocateCapture()
+{
+	UVRTPCaptureSubsystem* CaptureSubsystem = UVRTPCaptureSubsystem::GetShared(GetWorld());
+	if (CaptureSubsystem != NULL && SkyboxBlueprint.Get() != NULL && !CaptureSettings.bLiveCapture)
+	{
+		// Captured once and shared with every other component using the same skybox
+		TC = CaptureSubsystem->AcquireCapture(SkyboxBlueprint.Get(), CaptureSettings);
+		bSharedCapture = TC != NULL;
+	}
+	else
+	{
+		SceneCaptureCube = NewObject<USceneCaptureComponentCube>(GetOwner());
+
+		TC = CaptureSettings.CreateRenderTarget();
+
+		SceneCaptureCube->TextureTarget = TC;
+		FVRTPCaptureSettings::InitCaptureComponent(SceneCaptureCube);
+
+		UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
+		if (PlayerCamera != NULL)
+		{
 			SceneCaptureCube->AttachToComponent(PlayerCamera, FAttachmentTransformRules::KeepRelativeTransform);
-			PostProcessMID->SetTextureParameterValue(FName("TC"), TC);
 		}
+		InitSkybox();
+	}
+
+	if (PostProcessMID != NULL)
+	{
+		PostProcessMID->SetTextureParameterValue(FName("TC"), TC);
+	}
+	SendRenderState();
+}
+
+void UVRTunnellingPro::ReleaseCapture()
+{
+	CaptureLifetime.Reset();
+	LiveCapture.Release();
+
+	// Stop the native pass and the material sampling the capture before it is released
+	UTextureRenderTargetCube* Target = TC;
+	TC = NULL;
+	SendRenderState();
+	for (const TPair<UMaterialInterface*, UMaterialInstanceDynamic*>& Entry : PostProcessMIDs)
+	{
+		if (Entry.Value != NULL)
+		{
+			Entry.Value->SetTextureParameterValue(FName("TC"), NULL);
+		}
+	}
+
+	if (bSharedCapture)
+	{
+		if (UVRTPCaptureSubsystem* CaptureSubsystem = GetWorld()->GetSubsystem<UVRTPCaptureSubsystem>())
+		{
+			CaptureSubsystem->ReleaseCapture(Target);
+		}
+		bSharedCapture = false;
+	}
+	else
+	{
+		FVRTPCaptureSettings::ReleaseRenderTarget(Target);
+	}
+
+	if (SceneCaptureCube != NULL)
+	{
+		SceneCaptureCube->DestroyComponent();
+		SceneCaptureCube = NULL;
+	}
+	if (Skybox != NULL)
+	{
+		Skybox->Destroy();
+		Skybox = NULL;
+		bSkyboxParked = false;
 	}
 }
 
 void UVRTunnellingPro::InitSkybox()
 {
-	if (SkyboxBlueprint != NULL)
+	if (SkyboxBlueprint.Get() != NULL && SceneCaptureCube != NULL)
+	{
+		CaptureSkybox();
+	}
+
+	if (CaptureSettings.bLiveCapture && SceneCaptureCube != NULL)
 	{
-		FVector Location = GetOwner()->GetActorLocation();
-		FRotator Rotation = GetOwner()->GetActorRotation();
-		FActorSpawnParameters SpawnInfo;
-		SpawnInfo.Owner = GetOwner();
-		Skybox = GetWorld()->SpawnActor(SkyboxBlueprint, &Location, &Rotation, SpawnInfo);
+		LiveCapture.Init(GetOwner(), SceneCaptureCube->GetAttachParent(), TC, CaptureSettings, Skybox);
+	}
+}
+
+void UVRTunnellingPro::SpawnSkybox()
+{
+	FVector Location = GetOwner()->GetActorLocation();
+	FRotator Rotation = GetOwner()->GetActorRotation();
+	FActorSpawnParameters SpawnInfo;
+	SpawnInfo.Owner = GetOwner();
+	Skybox = GetWorld()->SpawnActor(SkyboxBlueprint.Get(), &Location, &Rotation, SpawnInfo);
 
-		if (Skybox != NULL)
+	if (Skybox != NULL)
+	{
+		// Spawned on the owner, so it keeps no offset from it and shares its frame
+		Skybox->GetRootComponent()->AttachToComponent(GetOwner()->GetRootComponent(), FAttachmentTransformRules::KeepWorldTransform);
+		TInlineComponentArray<UActorComponent*> MeshComponents(Skybox);
+		for (int32 i = 0; i < MeshComponents.Num(); ++i)
 		{
-			Skybox->GetRootComponent()->AttachToComponent(GetOwner()->GetRootComponent(), FAttachmentTransformRules::KeepRelativeTransform);
-				TInlineComponentArray<UActorComponent*> MeshComponents(Skybox);
-			for (int32 i = 0; i < MeshComponents.Num(); ++i)
-			{
-				UStaticMeshComponent* Mesh = Cast<UStaticMeshComponent>(MeshComponents[i]);
-				Mesh->SetOwnerNoSee(true);
-			}
+			UStaticMeshComponent* Mesh = Cast<UStaticMeshComponent>(MeshComponents[i]);
+			Mesh->SetOwnerNoSee(true);
+		}
+	}
+}
+
+void UVRTunnellingPro::CaptureSkybox()
+{
+	// A parked or destroyed skybox is brought back for the capture
+	if (Skybox == NULL)
+	{
+		SpawnSkybox();
+	}
+	else if (bSkyboxParked)
+	{
+		FVRTPCaptureSettings::UnparkSkybox(Skybox, GetOwner()->GetRootComponent(), bSkyboxCollision);
+		bSkyboxParked = false;
+	}
+
+	SceneCaptureCube->ClearShowOnlyComponents();
+	SceneCaptureCube->ShowOnlyActorComponents(Skybox);
+
+	// The skybox is spawned on the owner, so this is its frame even when it could not be spawned
+	FVRTPCaptureSettings::CaptureCube(SceneCaptureCube, GetOwner()->GetActorTransform());
+
+	// A static snapshot no longer needs the skybox in the scene. The capture is already queued ahead of its removal.
+	if (Skybox != NULL && !CaptureSettings.bLiveCapture)
+	{
+		switch (CaptureSettings.SkyboxAfterCapture)
+		{
+			case EVRTPSkyboxRetention::SR_PARK:
+				FVRTPCaptureSettings::ParkSkybox(Skybox, bSkyboxCollision);
+				bSkyboxParked = true;
+				break;
+
+			case EVRTPSkyboxRetention::SR_DESTROY:
+				Skybox->Destroy();
+				Skybox = NULL;
+				break;
+
+			default:
+				break;
+		}
+	}
+}
+
+void UVRTunnellingPro::RequestRecapture()
+{
+	if (bSharedCapture)
+	{
+		if (UVRTPCaptureSubsystem* CaptureSubsystem = GetWorld()->GetSubsystem<UVRTPCaptureSubsystem>())
+		{
+			CaptureSubsystem->RecaptureShared(TC);
 		}
-		
-		SceneCaptureCube->ShowOnlyActorComponents(Skybox);
-		SceneCaptureCube->CaptureScene();
 	}
+	else if (SkyboxBlueprint.Get() != NULL && SceneCaptureCube != NULL)
+	{
+		CaptureSkybox();
+	}
+}
+
+UTextureCube* UVRTunnellingPro::GetSkyboxCubeMap() const
+{
+	// Null until the soft references have streamed in
+	return CubeMapOverride.Get() != NULL ? CubeMapOverride.Get() : BakedSkybox.Get();
+}
+
+int64 UVRTunnellingPro::GetCaptureMemory() const
+{
+	return FVRTPCaptureSettings::GetMemoryBytes(TC);
 }
 
 void UVRTunnellingPro::SetBackgroundMode(EVRTPBackgroundMode NewBackgroundMode)
 {
 	BackgroundMode = NewBackgroundMode;
+	if (IsTunnellingReady())
+	{
+		UpdateCaptureResources(0.0f);
+	}
+	UpdatePermutation();
 	ApplyBackgroundMode();
 }
 
 void UVRTunnellingPro::SetMaskMode(EVRTPMaskMode NewMaskMode)
 {
 	MaskMode = NewMaskMode;
+	UpdatePermutation();
 	ApplyMaskMode();
+	IdleGate.Reset();
+	ApplyRenderMode();
+}
+
+void UVRTunnellingPro::SetRenderMode(EVRTPRenderMode NewRenderMode)
+{
+	RenderMode = NewRenderMode;
+	ApplyRenderMode();
 }
 
 void UVRTunnellingPro::ApplyBackgroundMode()
 {
-	switch (BackgroundMode)
+	// Until the materials exist the mode is only stored; UpdatePostProcessSettings applies it once they do
+	if (PostProcessMID == NULL)
+	{
+		return;
+	}
+
+	switch (GetActiveBackgroundMode())
 	{
 		case EVRTPBackgroundMode::MM_COLOR:
 			PostProcessMID->SetScalarParameterValue(FName("BackgroundColor"), 1.0f);
@@ -627,16 +1170,16 @@ void UVRTunnellingPro::ApplyBackgroundMode()
 			PostProcessMID->SetScalarParameterValue(FName("BackgroundSkybox"), 1.0f);
 			PostProcessMID->SetScalarParameterValue(FName("BackgroundBlur"), 0.0f);
 
-			if (CubeMapOverride != NULL)
+			if (GetSkyboxCubeMap() != NULL)
 			{
 				PostProcessMID->SetScalarParameterValue(FName("CubeMapOverride"), 1.0f);
-				PostProcessMID->SetTextureParameterValue(FName("CustomCubeMap"), CubeMapOverride);
+				PostProcessMID->SetTextureParameterValue(FName("CustomCubeMap"), GetSkyboxCubeMap());
 			}
 			else
 			{
 				PostProcessMID->SetScalarParameterValue(FName("CubeMapOverride"), 0.0f);
 			}
-			if (Skybox != NULL) Skybox->SetActorHiddenInGame(false);
+			if (Skybox != NULL && !bSkyboxParked) Skybox->SetActorHiddenInGame(false);
 			break;
 	
 		case EVRTPBackgroundMode::MM_BLUR:
@@ -650,7 +1193,12 @@ void UVRTunnellingPro::ApplyBackgroundMode()
 
 void UVRTunnellingPro::ApplyMaskMode()
 {
-	switch (MaskMode)
+	if (PostProcessMID == NULL)
+	{
+		return;
+	}
+
+	switch (GetActiveMaskMode())
 	{
 		case EVRTPMaskMode::MM_OFF:
 			PostProcessMID->SetScalarParameterValue(FName("MaskOn"), 0.0f);
@@ -678,22 +1226,145 @@ void UVRTunnellingPro::ApplyMaskMode()
 	}
 }
 
+bool UVRTunnellingPro::UsesNativePass() const
+{
+	// Below SM5 (mobile renderers and their previews) the native shaders are not compiled, so the material is blended instead
+	const UWorld* World = GetWorld();
+	return RenderMode != EVRTPRenderMode::RM_MATERIAL && World != NULL && IsVRTPNativePassSupported(World->GetFeatureLevel());
+}
+
+bool UVRTunnellingPro::UsesMaskCapture() const
+{
+	// The effect material can only read the custom stencil
+	return UsesNativePass() && GetActiveMaskMode() != EVRTPMaskMode::MM_OFF && FVRTPMaskCapture::IsEnabled();
+}
+
+void UVRTunnellingPro::UpdateMaskCapture()
+{
+	// The render and mask modes and vr.Tunnelling.MaskPass all decide whether masks render custom depth, so reapply them on any switch
+	const bool bUseCapture = UsesMaskCapture();
+	if (bUseCapture != MaskCapture.IsActive())
+	{
+		if (bUseCapture)
+		{
+			TArray<UPrimitiveComponent*> Primitives;
+			if (UVRTPMaskSubsystem* MaskSubsystem = GetWorld()->GetSubsystem<UVRTPMaskSubsystem>())
+			{
+				MaskSubsystem->GetMaskedPrimitives(MaskLayers, Primitives);
+			}
+			MaskCapture.Init(GetOwner(), Primitives);
+		}
+		else
+		{
+			MaskCapture.Release();
+		}
+		ApplyStencilMasks();
+	}
+
+	if (MaskCapture.IsActive() && !IdleGate.bIdle)
+	{
+		MaskCapture.Tick(GetOwner()->FindComponentByClass<UCameraComponent>(), HFov, VFov);
+	}
+}
+
+void UVRTunnellingPro::ApplyRenderMode()
+{
+	// The material is blended in by the camera; the native pass is added by the view extension instead.
+	// An idle material keeps its blendable at zero weight, which the renderer skips.
+	UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
+	if (PlayerCamera != NULL && PostProcessMID != NULL)
+	{
+		if (UsesNativePass())
+		{
+			PlayerCamera->PostProcessSettings.RemoveBlendable(PostProcessMID);
+		}
+		else
+		{
+			PlayerCamera->PostProcessSettings.AddBlendable(PostProcessMID, IdleGate.bIdle ? 0.0f : 1.0f);
+		}
+	}
+	SendRenderState();
+}
+
+void UVRTunnellingPro::SendRenderState()
+{
+	if (!ViewExtension.IsValid())
+	{
+		return;
+	}
+
+	FVRTPRenderState State;
+	FTextureResource* CubemapResource = nullptr;
+	FTextureResource* MaskResource = nullptr;
+	State.bEnabled = PostProcessMID != NULL && IsActive() && UsesNativePass() && !IdleGate.bIdle;
+
+	// In the material render mode, or while idle, the render thread already has a disabled state
+	if (!State.bEnabled && !bRenderStateEnabled)
+	{
+		return;
+	}
+	bRenderStateEnabled = State.bEnabled;
+
+	if (State.bEnabled)
+	{
+		const FTransform& ActorTransform = GetOwner()->GetActorTransform();
+		UTexture* Cubemap = GetSkyboxCubeMap();
+		if (Cubemap == NULL)
+		{
+			Cubemap = TC;
+		}
+
+		State.Scene = GetWorld()->Scene;
+		State.PlayerIndex = PlayerIndex;
+		State.bAnnulus = RenderMode == EVRTPRenderMode::RM_ANNULUS;
+		State.Radius = MotionResult.Radius;
+		State.Shift = FVector2f(MotionResult.XShift, MotionResult.YShift);
+		State.Feather = EffectFeather;
+		State.EffectColor = EffectColor;
+		State.bApplyEffectColor = ApplyEffectColor;
+		State.BackgroundMode = (uint8)GetActiveBackgroundMode();
+		CubemapResource = Cubemap != NULL ? Cubemap->GetResource() : nullptr;
+		State.Forward = FVector3f(ActorTransform.GetUnitAxis(EAxis::X));
+		State.Right = FVector3f(ActorTransform.GetUnitAxis(EAxis::Y));
+		State.Up = FVector3f(ActorTransform.GetUnitAxis(EAxis::Z));
+		State.MaskMode = (uint8)GetActiveMaskMode();
+		State.StencilIndex = (uint32)StencilIndex;
+		State.bStencilBits = StencilMatch.bShared;
+		if (MaskCapture.IsActive() && MaskCapture.GetTarget() != NULL)
+		{
+			MaskResource = MaskCapture.GetTarget()->GetResource();
+			State.MaskWorldToClip = MaskCapture.GetWorldToClip();
+		}
+	}
+
+	ENQUEUE_RENDER_COMMAND(VRTPSendRenderState)(
+		[Extension = ViewExtension, State, CubemapResource, MaskResource](FRHICommandListImmediate& RHICmdList) mutable
+		{
+			// The resources are released on the render thread after this command, so resolve them here; the references then outlive them
+			State.Cubemap = CubemapResource != nullptr ? CubemapResource->TextureRHI : nullptr;
+			State.MaskTexture = MaskResource != nullptr ? MaskResource->TextureRHI : nullptr;
+			Extension->RenderState = State;
+		});
+}
+
 void UVRTunnellingPro::SetEffectColor(FLinearColor NewColor)
 {
 	EffectColor = NewColor;
-	PostProcessMID->SetVectorParameterValue(FName("EffectColor"), FVector(EffectColor.R, EffectColor.G, EffectColor.B));
+	ParameterBlock.SetVector(EVRTPVectorParameter::EffectColor, FVector(EffectColor.R, EffectColor.G, EffectColor.B));
 }
 
 void UVRTunnellingPro::SetFeather(float NewFeather)
 {
 	EffectFeather = NewFeather;
-	PostProcessMID->SetScalarParameterValue(FName("Feather"), EffectFeather);
+	ParameterBlock.SetScalar(EVRTPScalarParameter::Feather, EffectFeather);
 }
 
 void UVRTunnellingPro::SetStencilMask(int32 NewStencilIndex, bool UpdateMaskedObjects)
 {
 	StencilIndex = NewStencilIndex;
-	PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilIndex);
+	StencilMatch = FVRTPStencilMatch();
+	StencilMatch.MaterialStencil = StencilIndex;
+	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilMatch.MaterialStencil);
 	if (UpdateMaskedObjects) ApplyStencilMasks();
 }
 
@@ -705,125 +1376,178 @@ void UVRTunnellingPro::UpdateMaskedObjects()
 void UVRTunnellingPro::ApplyStencilMasks()
 {
 	// Apply Custom Depth Stencil Index to all primitives within actors containing VRTPMask Component
-	TArray<AActor*> AllActors;
-	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AActor::StaticClass(), AllActors);
-	for (AActor* Actor : AllActors)
+	if (UVRTPMaskSubsystem* MaskSubsystem = GetWorld()->GetSubsystem<UVRTPMaskSubsystem>())
 	{
-		if (Actor->FindComponentByClass(UVRTPMask::StaticClass()))
+		// Other components' settings and the masks' layers change which masks are shared
+		if (!MasksChangedHandle.IsValid())
 		{
-			TInlineComponentArray<UActorComponent*> Components(Actor);
-			for (UActorComponent* Component : Components)
-			{
-				UPrimitiveComponent* Primitive = Cast<UPrimitiveComponent>(Component);
-				if (Primitive)
-				{
-					if (Primitive->IsValidLowLevel()) {
-						Primitive->SetCustomDepthStencilValue(StencilIndex);
-						if (MaskMode != EVRTPMaskMode::MM_OFF) Primitive->SetRenderCustomDepth(true);
-						else Primitive->SetRenderCustomDepth(false);
-					}
-				}
-			}
+			MasksChangedHandle = MaskSubsystem->OnMasksChanged.AddUObject(this, &UVRTunnellingPro::OnMasksChanged);
 		}
+		// The mask capture draws the masks itself, so they only need custom depth for the stencil
+		MaskSubsystem->ApplyStencil(this, StencilIndex, MaskLayers, GetActiveMaskMode() != EVRTPMaskMode::MM_OFF && !UsesMaskCapture());
+	}
+}
+
+void UVRTunnellingPro::OnMasksChanged()
+{
+	UVRTPMaskSubsystem* MaskSubsystem = GetWorld()->GetSubsystem<UVRTPMaskSubsystem>();
+	StencilMatch = MaskSubsystem->GetStencilMatch(this);
+	if (MaskCapture.IsActive())
+	{
+		TArray<UPrimitiveComponent*> Primitives;
+		MaskSubsystem->GetMaskedPrimitives(MaskLayers, Primitives);
+		MaskCapture.SetPrimitives(Primitives);
 	}
+	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilMatch.MaterialStencil);
+	SendRenderState();
 }
 
 void UVRTunnellingPro::ApplyColor(bool Enabled)
 {
 	ApplyEffectColor = Enabled;
+	UpdatePermutation();
 	SetEffectColor(EffectColor);
-	PostProcessMID->SetScalarParameterValue(FName("ApplyEffectColor"), (float)ApplyEffectColor);
+	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("ApplyEffectColor"), (float)ApplyEffectColor);
 }
 
-void UVRTunnellingPro::CalculateMotion(float DeltaTime)
+FVRTPMotionSample UVRTunnellingPro::GatherMotionSample()
 {
-	float Radius = 0;
-	float RadiusTarget = 0;
-	float VelocityFinal = 0;
-	FVector velocityVector = GetOwner()->GetActorLocation() - LastPosition;
-	if (PostProcessMID != NULL)
+	// Read the owner transform once per tick; the pose history and the basis vectors both use it
+	const AActor* Owner = GetOwner();
+	const FTransform& ActorTransform = Owner->GetActorTransform();
+
+	FVRTPPose Pose;
+	Pose.Time = GetWorld()->GetTimeSeconds();
+	Pose.Position = ActorTransform.GetLocation();
+	Pose.Orientation = ActorTransform.GetRotation();
+	const bool bNewPose = PoseHistory.Push(Pose);
+
+	FVRTPMotionSample Sample;
+	Sample.Forward = ActorTransform.GetUnitAxis(EAxis::X);
+	Sample.Right = ActorTransform.GetUnitAxis(EAxis::Y);
+	Sample.Up = ActorTransform.GetUnitAxis(EAxis::Z);
+	// World time stops while paused, so no pose is new and the pawn is treated as still rather than keeping its last fitted motion
+	if (bNewPose)
+	{
+		Sample.Kinematics = PoseHistory.Estimate();
+	}
+
+	if (bDirectionSpecific)
 	{
-		if (!ForceEffect)
+		UCameraComponent* PlayerCamera = Owner->FindComponentByClass<UCameraComponent>();
+		if (PlayerCamera != NULL)
 		{
-			if (bUseAngularVelocity)
-			{
-				float AngleDelta = FMath::RadiansToDegrees(FMath::Acos(FVector::DotProduct(GetOwner()->GetActorForwardVector(), LastForward))) / DeltaTime;
-				// Check for divide by zero
-				if (FMath::IsNearlyEqual(AngularMin, AngularMax, 0.001f)) AngleDelta = 0;
-				else AngleDelta = (AngleDelta - AngularMin) / (AngularMax - AngularMin);
-				float InterpSpeed = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1, 20), AngularSmoothing);
-				AngleSmoothed = FMath::FInterpTo(AngleSmoothed, AngleDelta, DeltaTime, InterpSpeed);
-				RadiusTarget += AngleSmoothed * (AngularStrength * 0.5);
-				LastForward = GetOwner()->GetActorForwardVector();
-			}
+			Sample.CameraForward = PlayerCamera->GetForwardVector();
+			Sample.CameraRight = PlayerCamera->GetRightVector();
+			Sample.bHasCamera = true;
+		}
+	}
+	return Sample;
+}
 
-			if (bUseVelocity || bUseAcceleration)
-			{
-				float VelocityDelta = FVector::Distance(GetOwner()->GetActorLocation(), LastPosition) / DeltaTime;
-				LastPosition = GetOwner()->GetActorLocation();
+// Explicit, so the UENUM and the motion model's filter enum can be reordered independently
+static EVRTPMotionFilter ToMotionFilter(EVRTPSmoothingMode Mode)
+{
+	switch (Mode)
+	{
+		case EVRTPSmoothingMode::SM_INTERP:				return EVRTPMotionFilter::Interp;
+		case EVRTPSmoothingMode::SM_ONE_EURO:			return EVRTPMotionFilter::OneEuro;
+		case EVRTPSmoothingMode::SM_CRITICALLY_DAMPED:	return EVRTPMotionFilter::CriticallyDamped;
+	}
+	return EVRTPMotionFilter::Interp;
+}
 
-				if (bUseVelocity)
-				{
-					float InterpSpeed = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1, 20), VelocitySmoothing);
-					VelocitySmoothed = FMath::FInterpTo(VelocitySmoothed, VelocityDelta, DeltaTime, InterpSpeed);
-
-					// Check for divide by zero
-					if (!FMath::IsNearlyEqual(VelocityMin, VelocityMax, 0.001f))
-					{
-						VelocityFinal = FMath::Clamp((VelocitySmoothed - VelocityMin) / (VelocityMax - VelocityMin), 0.0f, 1.0f);
-					}
-					RadiusTarget += VelocityFinal * VelocityStrength;
-				}
+void UVRTunnellingPro::UpdateMotionSettings()
+{
+	FVRTPMotionSettings& Settings = MotionModel.Settings;
+	Settings.bForceEffect					= ForceEffect;
+	Settings.EffectCoverage					= EffectCoverage;
+	Settings.bDirectionSpecific				= bDirectionSpecific;
+	Settings.DirectionalVerticalStrength	= DirectionalVerticalStrength;
+	Settings.DirectionalHorizontalStrength	= DirectionalHorizontalStrength;
+	Settings.bUseAngularVelocity			= bUseAngularVelocity;
+	Settings.AngularStrength				= AngularStrength;
+	Settings.AngularMin						= AngularMin;
+	Settings.AngularMax						= AngularMax;
+	Settings.AngularSmoothing				= AngularSmoothing;
+	Settings.bUseVelocity					= bUseVelocity;
+	Settings.VelocityStrength				= VelocityStrength;
+	Settings.VelocityMin					= VelocityMin;
+	Settings.VelocityMax					= VelocityMax;
+	Settings.VelocitySmoothing				= VelocitySmoothing;
+	Settings.bUseAcceleration				= bUseAcceleration;
+	Settings.AccelerationStrength			= AccelerationStrength;
+	Settings.AccelerationMin				= AccelerationMin;
+	Settings.AccelerationMax				= AccelerationMax;
+	Settings.AccelerationSmoothing			= AccelerationSmoothing;
+	Settings.Filter							= ToMotionFilter(SmoothingMode);
+	Settings.FilterBeta						= SmoothingBeta;
+}
 
-				if (bUseAcceleration)
-				{
-					float AccelerationDelta = FMath::Abs(GetOwner()->GetVelocity().Size() - LastSpeed) / DeltaTime;
-					LastSpeed = GetOwner()->GetVelocity().Size();
-
-					// Check for divide by zero
-					if (!FMath::IsNearlyEqual(AccelerationMin, AccelerationMax, 0.001f))
-					{
-						AccelerationDelta = FMath::Clamp((AccelerationDelta - AccelerationMin) / (AccelerationMax - AccelerationMin), 0.0f, 1.0f);
-					}
-
-					float InterpSpeed = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1, 20), AccelerationSmoothing);
-					AccelerationSmoothed = FMath::FInterpTo(AccelerationSmoothed, AccelerationDelta, DeltaTime, InterpSpeed);
-					RadiusTarget += AccelerationSmoothed * AccelerationStrength;
-				}
-			}
+void UVRTunnellingPro::CalculateMotion(const FVRTPMotionSample& Sample, float DeltaTime)
+{
+	UpdateMotionSettings();
 
-			if (bUseAngularVelocity || bUseAcceleration || bUseVelocity)
-			{
-				Radius = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1.5, 1 - EffectCoverage), RadiusTarget);
-			}
-			else
-			{
-				Radius = 1.5f;
-			}
+	// Batched: the result arrives through ApplyMotionResult once the world's batch has been evaluated
+	if (UVRTPMotionSubsystem* MotionSubsystem = UVRTPMotionSubsystem::GetBatched(GetWorld()))
+	{
+		if (MotionInstance == INDEX_NONE)
+		{
+			// Switching paths; the scalar model's filters would be stale by the time it is used again
+			MotionModel.Reset();
+			MotionInstance = MotionSubsystem->RegisterInstance(FVRTPOnMotionEvaluated::CreateUObject(this, &UVRTunnellingPro::ApplyMotionResult));
 		}
-		else
+		// A rejected sample gets no result, so nothing would clear a pending flush
+		bMotionPending = MotionSubsystem->SubmitSample(MotionInstance, MotionModel.Settings, Sample, DeltaTime);
+		return;
+	}
+
+	// Batching was turned off; drop the lane and restart the scalar model from rest rather than from its state before batching
+	if (MotionInstance != INDEX_NONE)
+	{
+		ReleaseMotionInstance();
+		MotionModel.Reset();
+	}
+
+	ApplyMotionResult(MotionModel.Evaluate(Sample, DeltaTime));
+}
+
+void UVRTunnellingPro::ReleaseMotionInstance()
+{
+	if (MotionInstance != INDEX_NONE)
+	{
+		if (UVRTPMotionSubsystem* MotionSubsystem = GetWorld()->GetSubsystem<UVRTPMotionSubsystem>())
 		{
-			Radius = 0.3f;
-		}
-
-		PostProcessMID->SetScalarParameterValue(FName("Radius"), Radius);
-		if (bDirectionSpecific) {
-			PostProcessMID->SetScalarParameterValue(FName("XShift"), 0.0f);
-			PostProcessMID->SetScalarParameterValue(FName("YShift"), 0.0f);
-			UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
-			if (PlayerCamera != NULL) {
-				FVector cameraRight = PlayerCamera->GetRightVector();
-				velocityVector.Normalize();
-				FVector rightVelocity = velocityVector.ProjectOnTo(cameraRight);
-				float strafeFactor = FVector::DotProduct(rightVelocity, cameraRight);
-				FVector cameraForward = PlayerCamera->GetForwardVector();
-				cameraForward.Normalize();
-				PostProcessMID->SetScalarParameterValue(FName("YShift"), cameraForward.Z * ((1.5f - Radius) / 1.5f) * DirectionalVerticalStrength);
-				PostProcessMID->SetScalarParameterValue(FName("XShift"), strafeFactor * DirectionalHorizontalStrength);
-			}
-		} else {
-			PostProcessMID->SetScalarParameterValue(FName("XShift"), 0.0f);
-			PostProcessMID->SetScalarParameterValue(FName("YShift"), 0.0f);
+			MotionSubsystem->UnregisterInstance(MotionInstance);
 		}
+		MotionInstance = INDEX_NONE;
+	}
+}
+
+void UVRTunnellingPro::ApplyMotionResult(const FVRTPMotionResult& Result)
+{
+	// Batched results arrive after the tick, so the delay is reported with the result it belongs to
+	MotionModel.FilterDelay = Result.FilterDelay;
+	MotionModel.ReportFilterDelay();
+	MotionResult = Result;
+
+	// Window and portal masks show the background even while the vignette is open
+	const EVRTPMaskMode ActiveMaskMode = GetActiveMaskMode();
+	const bool bCanIdle = ActiveMaskMode == EVRTPMaskMode::MM_OFF || ActiveMaskMode == EVRTPMaskMode::MM_MASK;
+	if (IdleGate.Update(Result, GetWorld()->GetDeltaSeconds(), bCanIdle))
+	{
+		ApplyRenderMode();
 	}
-}
\ No newline at end of file
+
+	ParameterBlock.SetScalar(EVRTPScalarParameter::Radius, Result.Radius);
+	ParameterBlock.SetScalar(EVRTPScalarParameter::XShift, Result.XShift);
+	ParameterBlock.SetScalar(EVRTPScalarParameter::YShift, Result.YShift);
+
+	// Batched results arrive after the tick, so flush here instead
+	if (bMotionPending)
+	{
+		bMotionPending = false;
+		ParameterBlock.Flush();
+		SendRenderState();
+	}
+}
@@ -13,6 +13,18 @@
 #include "Components/SceneCaptureComponentCube.h"
 #include "Engine/TextureRenderTargetCube.h"
 #include "Engine/DataAsset.h"
+#include "Containers/TripleBuffer.h"
+#include "Materials/MaterialParameterCollection.h"
+#include "VRTPMotionModel.h"
+#include "VRTPIdleGate.h"
+#include "VRTPParameterBlock.h"
+#include "VRTPCapture.h"
+#include "VRTPMaskCapture.h"
+#include "VRTPInit.h"
+#include "VRTPWarmup.h"
+#include "VRTPPermutations.h"
+#include "VRTPMaskSubsystem.h"
+#include "VRTPRendering.h"
 #include "VRTP.generated.h"
 
 /// Background Mode Enumerator (Color || Skybox || Blur)
@@ -34,6 +46,24 @@ enum class EVRTPMaskMode : uint8
 	MM_PORTAL		UMETA(DisplayName = "Portal")
 };
 
+/// Motion Smoothing Mode Enumerator (Interp || One Euro || Critically Damped)
+UENUM(BlueprintType)
+enum class EVRTPSmoothingMode : uint8
+{
+	SM_INTERP 		UMETA(DisplayName = "Interp (Legacy)"),
+	SM_ONE_EURO		UMETA(DisplayName = "One Euro"),
+	SM_CRITICALLY_DAMPED	UMETA(DisplayName = "Critically Damped")
+};
+
+/// Render Mode Enumerator (Material || Native || Annulus)
+UENUM(BlueprintType)
+enum class EVRTPRenderMode : uint8
+{
+	RM_MATERIAL		UMETA(DisplayName = "Material"),
+	RM_NATIVE		UMETA(DisplayName = "Native"),
+	RM_ANNULUS		UMETA(DisplayName = "Native Annulus")
+};
+
 /// VRTP Preset Definition (Applied to desktop version only)
 USTRUCT(BlueprintType)
 struct FVRTPPreset
@@ -42,15 +72,37 @@ struct FVRTPPreset
 
 	/// Skybox blueprint to use
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
-	TSubclassOf<class AActor> SkyboxBlueprint;
+	TSoftClassPtr<AActor> SkyboxBlueprint;
 
 	/// Cubemap texture cube to use as an override for skybox-only modes
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
-	UTextureCube* CubeMapOverride;
+	TSoftObjectPtr<UTextureCube> CubeMapOverride;
+
+	/// Skybox capture resolution and format
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FVRTPCaptureSettings CaptureSettings;
+
+	/// Snapshot of the skybox blueprint baked by the VRTPBakeSkybox commandlet; used like a cube map override, so nothing is captured at runtime
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	TSoftObjectPtr<UTextureCube> BakedSkybox;
 
 	/// Effect material to use for post process effect
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Post Process")
-	UMaterial* PostProcessMaterial;
+	TSoftObjectPtr<UMaterial> PostProcessMaterial;
+
+	/// Static-switch instances of the effect material, generated by the VRTPMaterialPermutations commandlet. The instance matching the
+	/// current background and mask modes is used in place of the effect material, so the shader only contains the active features.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Post Process")
+	TSoftObjectPtr<UVRTPMaterialPermutations> MaterialPermutations;
+
+	/// Optional parameter collection the effect materials read from; when set, per-frame parameters are published here once instead of to each material instance
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Post Process")
+	UMaterialParameterCollection* ParameterCollection;
+
+	/// How the vignette is drawn. Native uses the plugin's own post-processing pass instead of the post process material, and Native Annulus
+	/// limits that pass to a ring around the clear radius
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Post Process")
+	EVRTPRenderMode RenderMode;
 	
 	/// Effect vignette color
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Effect Settings")
@@ -156,11 +208,18 @@ struct FVRTPPreset
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Motion Settings|Acceleration", meta = (ClampMin = "0.0", ClampMax = "1.0"))
 	float AccelerationSmoothing;
 
+	/// Smoothing filter. Interp lags more at low frame rates; One Euro and Critically Damped lag by the same time at any frame rate
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Motion Settings|Smoothing")
+	EVRTPSmoothingMode SmoothingMode;
+
+	/// One Euro speed coefficient; higher values reduce lag during fast motion at the cost of more jitter
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Motion Settings|Smoothing", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float SmoothingBeta;
+
 	FVRTPPreset()
 	{
-		SkyboxBlueprint = NULL;
-		CubeMapOverride = NULL;
-		PostProcessMaterial = NULL;
+		ParameterCollection = NULL;
+		RenderMode = EVRTPRenderMode::RM_MATERIAL;
 		EffectColor = FLinearColor::Black;
 		EffectCoverage = 0;
 		EffectFeather = 0;
@@ -187,6 +246,8 @@ struct FVRTPPreset
 		AccelerationMin = 0;
 		AccelerationMax = 0;
 		AccelerationSmoothing = 0;
+		SmoothingMode = EVRTPSmoothingMode::SM_INTERP;
+		SmoothingBeta = 0;
 	}
 };
 
@@ -215,6 +276,7 @@ class UVRTunnellingPro : public UPrimitiveComponent
 
 public:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	void BeginDestroy() override;
 
 	/// Which player index this motion controller should automatically follow
@@ -263,23 +325,59 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "VR Tunnelling|Effect Preset")
 	bool bEnablePreset;
 
+	/// Presets this component may apply during gameplay. Their effect materials are loaded with the component and drawn once while it initialises, so applying them later does not hitch.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "VR Tunnelling|Effect Preset")
+	TArray<UVRTPPresetData*> WarmupPresets;
+
 	/// Skybox blueprint to use
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
-	TSubclassOf<class AActor> SkyboxBlueprint;
+	TSoftClassPtr<AActor> SkyboxBlueprint;
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
-	TSubclassOf<class AActor> SkyboxBlueprintSwap;
+	TSoftClassPtr<AActor> SkyboxBlueprintSwap;
 
 	/// Cubemap texture cube to use as an override for skybox-only modes
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
-	UTextureCube* CubeMapOverride;
+	TSoftObjectPtr<UTextureCube> CubeMapOverride;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	TSoftObjectPtr<UTextureCube> CubeMapOverrideSwap;
+
+	/// Skybox capture resolution and format
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	FVRTPCaptureSettings CaptureSettings;
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
-	UTextureCube* CubeMapOverrideSwap;
+	FVRTPCaptureSettings CaptureSettingsSwap;
+
+	/// Snapshot of the skybox blueprint baked by the VRTPBakeSkybox commandlet; used like a cube map override, so nothing is captured at runtime
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	TSoftObjectPtr<UTextureCube> BakedSkybox;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	TSoftObjectPtr<UTextureCube> BakedSkyboxSwap;
 
 	/// Effect material to use for post process effect
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
-	UMaterial* PostProcessMaterial;
+	TSoftObjectPtr<UMaterial> PostProcessMaterial;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	TSoftObjectPtr<UMaterial> PostProcessMaterialSwap;
+
+	/// Static-switch instances of the effect material, generated by the VRTPMaterialPermutations commandlet. The instance matching the
+	/// current background and mask modes is used in place of the effect material, so the shader only contains the active features.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	TSoftObjectPtr<UVRTPMaterialPermutations> MaterialPermutations;
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
-	UMaterial* PostProcessMaterialSwap;
+	TSoftObjectPtr<UVRTPMaterialPermutations> MaterialPermutationsSwap;
+
+	/// Optional parameter collection the effect materials read from; when set, per-frame parameters are published here once instead of to each material instance
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	UMaterialParameterCollection* ParameterCollection;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	UMaterialParameterCollection* ParameterCollectionSwap;
+
+	/// How the vignette is drawn. Native uses the plugin's own post-processing pass instead of the post process material, and Native Annulus
+	/// limits that pass to a ring around the clear radius
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	EVRTPRenderMode RenderMode;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	EVRTPRenderMode RenderModeSwap;
 
 	/// Effect vignette color
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Effect Settings")
@@ -329,6 +427,11 @@ public:
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Effect Settings|Mask Settings")
 	int32 StencilIndexSwap;
 
+	/// Mask layers this component applies its stencil index to. A VRTPMask is only affected if its Layers share one of these.
+	/// Components sharing masks should use stencil indices with different bits (1, 2, 4...), as masks combine them bitwise.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling|Effect Settings|Mask Settings", meta = (Bitmask, BitmaskEnum = "/Script/VRTunnellingPro.EVRTPMaskLayer"))
+	int32 MaskLayers;
+
 	/// Enable directional-specific tunnelling
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Motion Settings|Direction Specific")
 	bool bDirectionSpecific;
@@ -437,20 +540,77 @@ public:
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Motion Settings|Acceleration")
 	float AccelerationSmoothingSwap;
 
+	/// Smoothing filter. Interp lags more at low frame rates; One Euro and Critically Damped lag by the same time at any frame rate
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Motion Settings|Smoothing")
+	EVRTPSmoothingMode SmoothingMode;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Motion Settings|Smoothing")
+	EVRTPSmoothingMode SmoothingModeSwap;
+
+	/// One Euro speed coefficient; higher values reduce lag during fast motion at the cost of more jitter
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Motion Settings|Smoothing", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float SmoothingBeta;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Motion Settings|Smoothing")
+	float SmoothingBetaSwap;
+
 private:
 	USceneCaptureComponentCube* SceneCaptureCube;
 	UTextureRenderTargetCube* TC;
+	UPROPERTY(Transient)
+	FVRTPLiveCapture LiveCapture;
+	/// Masked objects drawn without custom depth, while UsesMaskCapture
+	UPROPERTY(Transient)
+	FVRTPMaskCapture MaskCapture;
+	bool bSharedCapture;
+	FVRTPCaptureLifetime CaptureLifetime;
+	bool bSkyboxParked;
+	/// Whether the parked skybox had collision, restored when it is unparked
+	bool bSkyboxCollision;
 	float HFov;
 	float VFov;
 	UMaterialInstanceDynamic* PostProcessMID;
+
+	/// Effect MIDs by source material (the effect material or one of its permutations), kept for when the modes switch back
+	UPROPERTY()
+	TMap<UMaterialInterface*, UMaterialInstanceDynamic*> PostProcessMIDs;
+
 	AActor* Skybox;
-	bool CaptureInit;
+	EVRTPInitStage InitStage;
+	FVRTPAssetLoader AssetLoader;
+	bool bSettingsPending;
+
+	/// Preset applied while its assets are still streaming in; it replaces the current settings once they have arrived
+	UPROPERTY()
+	UVRTPPresetData* PendingPreset;
+
+	/// FVRTPScalability::GetGeneration when the settings were last applied
+	uint32 ScalabilityGeneration;
+
+	/// How this component's masks are recognised in the custom stencil (UVRTPMaskSubsystem::GetStencilMatch)
+	FVRTPStencilMatch StencilMatch;
+	FDelegateHandle MasksChangedHandle;
 
 public:
-	/// Load and apply a new VRTP preset, from a VRTP preset data asset
+	/// Broadcast once the effect's assets have streamed in and its materials and capture exist. Until then the vignette uses a colour background.
+	UPROPERTY(BlueprintAssignable, Category = "VR Tunnelling")
+	FVRTPOnTunnellingReady OnTunnellingReady;
+
+	/// Whether initialisation has finished and OnTunnellingReady has been broadcast
+	UFUNCTION(BlueprintPure, Category = "VR Tunnelling")
+	bool IsTunnellingReady() const;
+
+	/// Load and apply a new VRTP preset, from a VRTP preset data asset. Assets the preset references are streamed in first.
 	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
 	void ApplyPreset(UVRTPPresetData* NewPreset);
 
+	/// Capture the skybox blueprint again, e.g. after changing it at runtime. A parked or destroyed skybox is brought back for the capture;
+	/// a snapshot shared with other components is recaptured for all of them. Does nothing while no snapshot is allocated.
+	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
+	void RequestRecapture();
+
+	/// GPU memory used by the skybox capture render target, in bytes (0 when not capturing, e.g. with a cubemap override)
+	UFUNCTION(BlueprintPure, Category = "VR Tunnelling")
+	int64 GetCaptureMemory() const;
+
 	/// Change the background mode
 	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
 	void SetBackgroundMode(EVRTPBackgroundMode NewBackgroundMode);
@@ -459,6 +619,10 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
 	void SetMaskMode(EVRTPMaskMode NewMaskMode);
 
+	/// Change how the vignette is drawn
+	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
+	void SetRenderMode(EVRTPRenderMode NewRenderMode);
+
 	/// Change the effect color
 	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
 	void SetEffectColor(FLinearColor NewColor);
@@ -494,7 +658,6 @@ public:
 protected:
 	//~ Begin UActorComponent Interface.
 	//virtual void CreateRenderState_Concurrent();
-	virtual void SendRenderTransform_Concurrent();
 	//~ End UActorComponent Interface.
 
 	// Cached Motion Controller that can be read by GetParameterValue. Only valid for the duration of OnMotionControllerUpdated
@@ -508,15 +671,35 @@ protected:
 	UFUNCTION(BlueprintCallable, Category = "Motion Controller Update")
 	float GetParameterValue(FName InName, bool& bValueFound);
 
+	// Tracking-space motion of the tracked device, fitted over its recent game and render thread poses. AngularVelocity is in degrees per second.
+	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling | MotionController")
+	void GetTrackedMotion(FVector& LinearVelocity, FVector& AngularVelocity) const;
+
 private:
 
-	FVector LastForward;
-	FVector LastPosition;
-	float LastSpeed;
+	// Shared motion model, fed once per tick from GatherMotionSample. Only used when batched evaluation is disabled, and reset whenever it is toggled.
+	FVRTPMotionModel MotionModel;
+
+	// Lane in the world's motion batch, or INDEX_NONE when not registered
+	int32 MotionInstance = INDEX_NONE;
+
+	// True while a batched motion result is outstanding; the parameter block is then flushed when it arrives
+	bool bMotionPending = false;
+
+	// Per-frame material parameters, flushed to every effect MID once per frame
+	FVRTPParameterBlock ParameterBlock;
+
+	// Latest motion result, forwarded to the native pass
+	FVRTPMotionResult MotionResult;
 
-	float AngleSmoothed;
-	float VelocitySmoothed;
-	float AccelerationSmoothed;
+	// Whether the vignette is open and its pass skipped
+	FVRTPIdleGate IdleGate;
+
+	// Owner poses, pushed and fitted once per tick by GatherMotionSample
+	FVRTPPoseHistory PoseHistory;
+
+	// Tracked device poses polled on the game thread; the view extension keeps those polled on the render thread
+	FVRTPPoseHistory TrackedPoseHistory;
 
 	// Whether or not this component had a valid tracked controller associated with it this frame
 	bool bTracked;
@@ -524,22 +707,47 @@ private:
 	// Whether or not this component has authority within the frame
 	bool bHasAuthority;
 
-	// If true, the Position and Orientation args will contain the most recent controller state
+	// If true, the Position and Orientation args will contain the most recent controller state. Game thread only.
 	bool PollControllerState(FVector& Position, FRotator& Orientation, float WorldToMetersScale);
 
-	FTransform RenderThreadRelativeTransform;
-	FVector RenderThreadComponentScale;
+	// Publish what the view extension needs to poll the tracked pose again on the render thread
+	void SendLateUpdateState(bool bEnabled);
 
 	void CacheSettings();
+	void AdvanceInit();
+	void RequestAssets();
+	void GatherWarmup(FVRTPWarmupSet& OutWarmup) const;
+	void StartWarmup();
+	EVRTPBackgroundMode GetActiveBackgroundMode() const;
+	EVRTPMaskMode GetActiveMaskMode() const;
+	void ApplyScalability();
 	void InitCapture();
+	bool SelectPermutation();
+	void UpdatePermutation();
 	void InitSkybox();
+	void SpawnSkybox();
+	void CaptureSkybox();
+	void UpdateCaptureResources(float DeltaTime);
+	void AllocateCapture();
+	void ReleaseCapture();
+	UTextureCube* GetSkyboxCubeMap() const;
 	void InitFromPreset();
 	void SetPresetData(UVRTPPresetData* NewPreset);
 	void UpdatePostProcessSettings();
-	void CalculateMotion(float DeltaTime);
+	FVRTPMotionSample GatherMotionSample();
+	void UpdateMotionSettings();
+	void CalculateMotion(const FVRTPMotionSample& Sample, float DeltaTime);
+	void ApplyMotionResult(const FVRTPMotionResult& Result);
+	void ReleaseMotionInstance();
 	void ApplyBackgroundMode();
 	void ApplyMaskMode();
+	void ApplyRenderMode();
 	void ApplyStencilMasks();
+	void OnMasksChanged();
+	bool UsesNativePass() const;
+	bool UsesMaskCapture() const;
+	void UpdateMaskCapture();
+	void SendRenderState();
 
 	// View extension object that can persist on the render thread without the motion controller component
 	class FViewExtension : public FSceneViewExtensionBase
@@ -557,17 +765,45 @@ private:
 		virtual void PostRenderViewFamily_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneViewFamily& InViewFamily) override;
 		virtual int32 GetPriority() const override { return -10; }
 		virtual bool IsActiveThisFrame(class FViewport* InViewport) const;
+		virtual void SubscribeToPostProcessingPass(EPostProcessingPass Pass, FAfterPassCallbackDelegateArray& InOutPassCallbacks, bool bIsPassEnabled) override;
 
 	private:
 		friend class UVRTunnellingPro;
 
-		/** Motion controller component associated with this view extension */
+		/** Component settings the render thread polls the tracked pose with, copied on the game thread each tick */
+		struct FLateUpdateState
+		{
+			/** False while late updates are off, and for good once the component is destroyed */
+			bool bEnabled = false;
+			bool bHasAuthority = false;
+			int32 PlayerIndex = 0;
+			FName MotionSource;
+		};
+
+		/** Motion controller component associated with this view extension. Game thread only; the render thread reads LateUpdateState instead */
 		UVRTunnellingPro* MotionControllerComponent;
+
+		/** Newest late update state. The game thread writes and the render thread reads without either waiting on the other */
+		TTripleBuffer<FLateUpdateState> LateUpdateState;
 		FLateUpdateManager LateUpdate;
 		FTransform PrevTransform;
+
+		/** Tracked device poses polled on the render thread; read on the game thread */
+		FVRTPPoseHistory LatePoseHistory;
+
+		/** Native vignette state, written and read on the render thread only */
+		FVRTPRenderState RenderState;
+
+		/** Native permutations to draw once offscreen before the next vignette pass, render thread only */
+		uint32 PendingWarmup = 0;
+
+		FScreenPassTexture PostProcessPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs);
 	};
 	TSharedPtr< FViewExtension, ESPMode::ThreadSafe > ViewExtension;
 
+	/// Whether the last state sent to the view extension had the native pass enabled
+	bool bRenderStateEnabled = false;
+
 #if WITH_EDITOR
 	int32 PreEditMaterialCount = 0;
 #endif
@@ -0,0 +1,204 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPBakeSkyboxCommandlet.h"
+#include "VRTP.h"
+#include "VRTPMobile.h"
+#include "VRTPCapture.h"
+
+#if WITH_EDITOR
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "Engine/Engine.h"
+#include "Engine/TextureCube.h"
+#include "Engine/TextureRenderTargetCube.h"
+#include "Engine/World.h"
+#include "Misc/App.h"
+#include "Misc/PackageName.h"
+#include "DynamicRHI.h"
+#include "RenderingThread.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+#endif
+
+DEFINE_LOG_CATEGORY_STATIC(LogVRTPBakeSkybox, Log, All);
+
+#if WITH_EDITOR
+namespace {
+	/// The skybox fields of a desktop or mobile preset
+	struct FPresetSkybox
+	{
+		TSubclassOf<AActor> SkyboxBlueprint;
+		bool bHasCubeMapOverride = false;
+		FVRTPCaptureSettings CaptureSettings;
+		TSoftObjectPtr<UTextureCube>* BakedSkybox = nullptr;
+	};
+
+	bool GetPresetSkybox(UObject* Object, FPresetSkybox& Out)
+	{
+		if (UVRTPPresetData* Preset = Cast<UVRTPPresetData>(Object))
+		{
+			Out.SkyboxBlueprint = Preset->Data.SkyboxBlueprint.LoadSynchronous();
+			Out.bHasCubeMapOverride = !Preset->Data.CubeMapOverride.IsNull();
+			Out.CaptureSettings = Preset->Data.CaptureSettings;
+			Out.BakedSkybox = &Preset->Data.BakedSkybox;
+			return true;
+		}
+		if (UVRTPMPresetData* Preset = Cast<UVRTPMPresetData>(Object))
+		{
+			Out.SkyboxBlueprint = Preset->Data.SkyboxBlueprint.LoadSynchronous();
+			Out.bHasCubeMapOverride = !Preset->Data.CubeMapOverride.IsNull();
+			Out.CaptureSettings = Preset->Data.CaptureSettings;
+			Out.BakedSkybox = &Preset->Data.BakedSkybox;
+			return true;
+		}
+		return false;
+	}
+
+	bool SaveAssetPackage(UObject* Asset)
+	{
+		UPackage* Package = Asset->GetOutermost();
+		const FString Filename = FPackageName::LongPackageNameToFilename(Package->GetName(), FPackageName::GetAssetPackageExtension());
+		FSavePackageArgs SaveArgs;
+		SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+		return UPackage::SavePackage(Package, Asset, *Filename, SaveArgs);
+	}
+
+	/// Captures need a renderer, which commandlets only start with -AllowCommandletRendering
+	bool CanRender()
+	{
+		if (!FApp::CanEverRender() || GDynamicRHI == nullptr)
+		{
+			UE_LOG(LogVRTPBakeSkybox, Error, TEXT("Skyboxes can only be baked with rendering enabled; run the commandlet with -AllowCommandletRendering"));
+			return false;
+		}
+		return true;
+	}
+} // anonymous namespace
+#endif
+
+UVRTPBakeSkyboxCommandlet::UVRTPBakeSkyboxCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UVRTPBakeSkyboxCommandlet::Main(const FString& Params)
+{
+#if WITH_EDITOR
+	if (!CanRender())
+	{
+		return 1;
+	}
+
+	FString Path = TEXT("/Game");
+	FParse::Value(*Params, TEXT("Path="), Path);
+	const bool bForce = FParse::Param(*Params, TEXT("Force"));
+
+	IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+	AssetRegistry.SearchAllAssets(true);
+
+	FARFilter Filter;
+	Filter.PackagePaths.Add(FName(*Path));
+	Filter.bRecursivePaths = true;
+	Filter.ClassPaths.Add(UVRTPPresetData::StaticClass()->GetClassPathName());
+	Filter.ClassPaths.Add(UVRTPMPresetData::StaticClass()->GetClassPathName());
+	TArray<FAssetData> Assets;
+	AssetRegistry.GetAssets(Filter, Assets);
+
+	// Presets sharing a blueprint and capture settings share one baked cube
+	TMap<FString, UTextureCube*> BakedCubes;
+	int32 NumBaked = 0;
+	int32 NumFailed = 0;
+	for (const FAssetData& Asset : Assets)
+	{
+		UObject* Object = Asset.GetAsset();
+		FPresetSkybox Skybox;
+		if (!GetPresetSkybox(Object, Skybox) || Skybox.SkyboxBlueprint == NULL || Skybox.bHasCubeMapOverride)
+		{
+			continue;
+		}
+		if (!Skybox.BakedSkybox->IsNull() && !bForce)
+		{
+			continue;
+		}
+
+		const FString Key = FString::Printf(TEXT("%s:%d:%d"), *Skybox.SkyboxBlueprint->GetPathName(), Skybox.CaptureSettings.Resolution, (int32)Skybox.CaptureSettings.Format);
+		UTextureCube* Cube = BakedCubes.FindRef(Key);
+		if (Cube == NULL)
+		{
+			FString BlueprintName = Skybox.SkyboxBlueprint->GetName();
+			BlueprintName.RemoveFromEnd(TEXT("_C"));
+			FString FormatName = StaticEnum<EVRTPCaptureFormat>()->GetNameStringByValue((int64)Skybox.CaptureSettings.Format);
+			FormatName.RemoveFromStart(TEXT("CF_"));
+			const FString PackageName = FString::Printf(TEXT("%s/TC_%s_%d_%s"), *FPackageName::GetLongPackagePath(Asset.PackageName.ToString()), *BlueprintName, Skybox.CaptureSettings.Resolution, *FormatName);
+
+			Cube = BakeSkybox(Skybox.SkyboxBlueprint, Skybox.CaptureSettings, PackageName);
+			if (Cube == NULL)
+			{
+				UE_LOG(LogVRTPBakeSkybox, Error, TEXT("Failed to bake %s for %s"), *Skybox.SkyboxBlueprint->GetPathName(), *Asset.GetObjectPathString());
+				++NumFailed;
+				continue;
+			}
+			BakedCubes.Add(Key, Cube);
+			++NumBaked;
+		}
+
+		*Skybox.BakedSkybox = Cube;
+		Object->MarkPackageDirty();
+		if (!SaveAssetPackage(Object))
+		{
+			UE_LOG(LogVRTPBakeSkybox, Error, TEXT("Failed to save %s"), *Asset.GetObjectPathString());
+			++NumFailed;
+			continue;
+		}
+		UE_LOG(LogVRTPBakeSkybox, Display, TEXT("%s uses %s"), *Asset.GetObjectPathString(), *Cube->GetPathName());
+	}
+
+	UE_LOG(LogVRTPBakeSkybox, Display, TEXT("Baked %d skybox(es) for %d preset(s), %d failure(s)"), NumBaked, Assets.Num(), NumFailed);
+	return NumFailed > 0 ? 1 : 0;
+#else
+	UE_LOG(LogVRTPBakeSkybox, Error, TEXT("Skyboxes can only be baked by the editor"));
+	return 1;
+#endif
+}
+
+#if WITH_EDITOR
+UTextureCube* UVRTPBakeSkyboxCommandlet::BakeSkybox(TSubclassOf<AActor> SkyboxBlueprint, const FVRTPCaptureSettings& Settings, const FString& PackageName)
+{
+	if (!CanRender())
+	{
+		return NULL;
+	}
+
+	// An otherwise empty world, so nothing but the skybox ends up in the snapshot
+	UWorld* World = UWorld::CreateWorld(EWorldType::EditorPreview, false);
+	FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::EditorPreview);
+	WorldContext.SetCurrentWorld(World);
+
+	UTextureCube* Cube = NULL;
+	UTextureRenderTargetCube* RenderTarget = Settings.CreateRenderTarget();
+	if (FVRTPCaptureSettings::CaptureSkybox(World, SkyboxBlueprint, RenderTarget, true))
+	{
+		FlushRenderingCommands();
+
+		UPackage* Package = CreatePackage(*PackageName);
+		Cube = RenderTarget->ConstructTextureCube(Package, FPackageName::GetShortName(PackageName), RF_Public | RF_Standalone);
+		if (Cube != NULL)
+		{
+			// Compressed for each platform at cook time, rather than kept in the render target's format
+			Cube->CompressionSettings = RenderTarget->bHDR ? TC_HDR_Compressed : TC_Default;
+			Cube->PostEditChange();
+			FAssetRegistryModule::AssetCreated(Cube);
+			if (!SaveAssetPackage(Cube))
+			{
+				Cube = NULL;
+			}
+		}
+	}
+	FVRTPCaptureSettings::ReleaseRenderTarget(RenderTarget);
+
+	GEngine->DestroyWorldContext(World);
+	World->DestroyWorld(false);
+	return Cube;
+}
+#endif
@@ -0,0 +1,32 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "Templates/SubclassOf.h"
+#include "VRTPBakeSkyboxCommandlet.generated.h"
+
+class AActor;
+class UTextureCube;
+struct FVRTPCaptureSettings;
+
+/// Bakes the skybox blueprint of every desktop and mobile preset into a compressed Texture Cube asset and stores it as the preset's Baked Skybox,
+/// so packaged builds never spawn or capture the skybox. Run it before cooking:
+///   UnrealEditor-Cmd <Project>.uproject -run=VRTPBakeSkybox -AllowCommandletRendering [-Path=/Game] [-Force]
+/// Commandlets do not start a renderer otherwise, and the commandlet fails without one.
+/// Presets that already have a baked skybox are skipped unless -Force is given; presets with a cube map override are always skipped.
+UCLASS()
+class UVRTPBakeSkyboxCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UVRTPBakeSkyboxCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+#if WITH_EDITOR
+	/// Capture a skybox blueprint on its own in a transient world and save the result as a Texture Cube in a new package
+	static UTextureCube* BakeSkybox(TSubclassOf<AActor> SkyboxBlueprint, const FVRTPCaptureSettings& Settings, const FString& PackageName);
+#endif
+};
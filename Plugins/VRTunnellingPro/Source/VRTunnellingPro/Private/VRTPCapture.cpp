@@ -0,0 +1,394 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPCapture.h"
+#include "Engine/TextureRenderTargetCube.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Components/SceneCaptureComponentCube.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "HAL/IConsoleManager.h"
+#include "RenderingThread.h"
+#include "RHICommandList.h"
+#include "TextureResource.h"
+#include "VRTPScalability.h"
+#include "VRTPStats.h"
+#include "ContentStreaming.h"
+#if WITH_EDITOR
+#include "AssetCompilingManager.h"
+#endif
+
+DECLARE_MEMORY_STAT(TEXT("Capture Render Targets"), STAT_VRTP_CaptureMemory, STATGROUP_VRTunnelling);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Live Capture Tiles"), STAT_VRTP_LiveCaptureTiles, STATGROUP_VRTunnelling);
+
+namespace {
+	TAutoConsoleVariable<float> CVarLiveCaptureBudget(
+		TEXT("vr.Tunnelling.LiveCaptureBudget"),
+		0.5f,
+		TEXT("GPU milliseconds per frame each live skybox capture may spend. At least one tile is captured every frame."),
+		ECVF_Scalability);
+
+	TAutoConsoleVariable<float> CVarLiveCaptureCost(
+		TEXT("vr.Tunnelling.LiveCaptureCost"),
+		2.0f,
+		TEXT("Estimated GPU milliseconds per megapixel of live capture, used to turn vr.Tunnelling.LiveCaptureBudget into tiles.\n")
+		TEXT("Raise it when capturing the whole scene, lower it for a simple skybox."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<float> CVarLiveCaptureTileCost(
+		TEXT("vr.Tunnelling.LiveCaptureTileCost"),
+		0.1f,
+		TEXT("Estimated fixed GPU milliseconds of each live capture tile, which is a scene render of its own, on top of vr.Tunnelling.LiveCaptureCost."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<float> CVarCaptureReleaseDelay(
+		TEXT("vr.Tunnelling.CaptureReleaseDelay"),
+		5.0f,
+		TEXT("Seconds a skybox capture is kept after the background mode stops using it, in case it is switched back.\n")
+		TEXT("Negative values keep it until the component ends play."),
+		ECVF_Default);
+
+	/// Extra priority of a tile straight ahead of the player over one behind
+	constexpr float ViewPriority = 3.0f;
+
+	/// Direction and up vector of each cube face, in face order, matching the engine's cube captures
+	const FVector FaceDirections[CubeFace_MAX] = { FVector(1, 0, 0), FVector(-1, 0, 0), FVector(0, 1, 0), FVector(0, -1, 0), FVector(0, 0, 1), FVector(0, 0, -1) };
+	const FVector FaceUps[CubeFace_MAX] = { FVector(0, 1, 0), FVector(0, 1, 0), FVector(0, 0, -1), FVector(0, 0, 1), FVector(0, 1, 0), FVector(0, 1, 0) };
+
+	int64 CubeBytes(int32 Resolution, EPixelFormat Format)
+	{
+		return 6 * (int64)Resolution * Resolution * GPixelFormats[Format].BlockBytes;
+	}
+
+	int64 TextureBytes(const UTextureRenderTarget2D* RenderTarget)
+	{
+		return (int64)RenderTarget->SizeX * RenderTarget->SizeY * GPixelFormats[RenderTarget->GetFormat()].BlockBytes;
+	}
+} // anonymous namespace
+
+EPixelFormat FVRTPCaptureSettings::GetPixelFormat() const
+{
+	switch (Format)
+	{
+		case EVRTPCaptureFormat::CF_RGBA16F:
+			return PF_FloatRGBA;
+
+		case EVRTPCaptureFormat::CF_RG11B10F:
+			return PF_FloatR11G11B10;
+
+		default:
+			return PF_B8G8R8A8;
+	}
+}
+
+int32 FVRTPCaptureSettings::GetResolution() const
+{
+	return FMath::Clamp(FVRTPScalability::ClampCaptureResolution(Resolution), 16, 4096);
+}
+
+int64 FVRTPCaptureSettings::GetMemoryBytes() const
+{
+	return CubeBytes(GetResolution(), GetPixelFormat());
+}
+
+UTextureRenderTargetCube* FVRTPCaptureSettings::CreateRenderTarget() const
+{
+	UTextureRenderTargetCube* RenderTarget = NewObject<UTextureRenderTargetCube>();
+	RenderTarget->ClearColor = FLinearColor::Black;
+	RenderTarget->bHDR = Format != EVRTPCaptureFormat::CF_RGBA8;
+	RenderTarget->Init(GetResolution(), GetPixelFormat());
+
+	INC_MEMORY_STAT_BY(STAT_VRTP_CaptureMemory, GetMemoryBytes(RenderTarget));
+	return RenderTarget;
+}
+
+void FVRTPCaptureSettings::ReleaseRenderTarget(UTextureRenderTargetCube* RenderTarget)
+{
+	if (RenderTarget)
+	{
+		DEC_MEMORY_STAT_BY(STAT_VRTP_CaptureMemory, GetMemoryBytes(RenderTarget));
+		RenderTarget->ReleaseResource();
+	}
+}
+
+int64 FVRTPCaptureSettings::GetMemoryBytes(const UTextureRenderTargetCube* RenderTarget)
+{
+	return RenderTarget ? CubeBytes(RenderTarget->SizeX, RenderTarget->GetFormat()) : 0;
+}
+
+void FVRTPCaptureSettings::InitCaptureComponent(USceneCaptureComponent* Capture)
+{
+	Capture->bCaptureOnMovement = false;
+	Capture->bCaptureEveryFrame = false;
+	Capture->bAutoActivate = true;
+	Capture->CaptureStereoPass = EStereoscopicPass::eSSP_FULL;
+
+	Capture->ShowFlags.SetAntiAliasing(false);
+	Capture->ShowFlags.SetAtmosphere(false);
+	Capture->ShowFlags.SetBloom(false);
+	Capture->ShowFlags.SetBSP(false);
+	Capture->ShowFlags.SetDeferredLighting(false);
+	Capture->ShowFlags.SetEyeAdaptation(true);
+	Capture->ShowFlags.SetFog(false);
+	Capture->ShowFlags.SetVolumetricFog(false);
+}
+
+void FVRTPCaptureSettings::CaptureCube(USceneCaptureComponentCube* Capture, const FTransform& SkyboxFrame)
+{
+	// The capture reads the component's transform straight away, so its place relative to the camera can be put back afterwards
+	const FVector RelativeLocation = Capture->GetRelativeLocation();
+	const FRotator RelativeRotation = Capture->GetRelativeRotation();
+	Capture->bCaptureRotation = true;
+	Capture->SetWorldLocationAndRotation(SkyboxFrame.GetLocation(), SkyboxFrame.GetRotation());
+	Capture->CaptureScene();
+	Capture->SetRelativeLocationAndRotation(RelativeLocation, RelativeRotation);
+}
+
+void FVRTPCaptureSettings::ParkSkybox(AActor* Skybox, bool& bOutCollisionEnabled)
+{
+	bOutCollisionEnabled = Skybox->GetActorEnableCollision();
+
+	// Hidden actors are not added to the scene at all, and a detached one is not moved with the pawn
+	Skybox->DetachFromActor(FDetachmentTransformRules::KeepRelativeTransform);
+	Skybox->SetActorHiddenInGame(true);
+	Skybox->SetActorTickEnabled(false);
+	Skybox->SetActorEnableCollision(false);
+}
+
+void FVRTPCaptureSettings::UnparkSkybox(AActor* Skybox, USceneComponent* Parent, bool bCollisionEnabled)
+{
+	Skybox->SetActorEnableCollision(bCollisionEnabled);
+	Skybox->SetActorTickEnabled(Skybox->PrimaryActorTick.bStartWithTickEnabled);
+	Skybox->SetActorHiddenInGame(false);
+	Skybox->GetRootComponent()->AttachToComponent(Parent, FAttachmentTransformRules::KeepRelativeTransform);
+}
+
+bool FVRTPCaptureSettings::CaptureSkybox(UWorld* World, TSubclassOf<AActor> SkyboxBlueprint, UTextureRenderTargetCube* Target, bool bWaitForAssets)
+{
+	// At the origin without rotation, so the capture below is taken from the skybox's origin in its own frame, like CaptureCube
+	FActorSpawnParameters SpawnInfo;
+	SpawnInfo.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	SpawnInfo.ObjectFlags |= RF_Transient;
+	AActor* Skybox = World->SpawnActor(SkyboxBlueprint, &FVector::ZeroVector, &FRotator::ZeroRotator, SpawnInfo);
+	if (Skybox == nullptr)
+	{
+		return false;
+	}
+
+	USceneCaptureComponentCube* Capture = NewObject<USceneCaptureComponentCube>(Skybox);
+	Capture->TextureTarget = Target;
+	InitCaptureComponent(Capture);
+	Capture->ShowOnlyActorComponents(Skybox);
+	Capture->RegisterComponentWithWorld(World);
+
+	if (bWaitForAssets)
+	{
+		// Nothing is rendered between spawning and capturing, so compile the skybox's shaders and stream in its textures first
+#if WITH_EDITOR
+		FAssetCompilingManager::Get().FinishAllCompilation();
+#endif
+		IStreamingManager::Get().StreamAllResources();
+		IStreamingManager::Get().BlockTillAllRequestsFinished();
+	}
+	Capture->CaptureScene();
+
+	// The capture is already queued on the render thread, ahead of the skybox's removal
+	Skybox->Destroy();
+	return true;
+}
+
+//*************************************************************
+
+FVRTPCaptureLifetime::EAction FVRTPCaptureLifetime::Update(bool bNeeded, float DeltaTime)
+{
+	if (bNeeded)
+	{
+		UnusedTime = 0.0f;
+		if (!bAllocated)
+		{
+			bAllocated = true;
+			return EAction::Allocate;
+		}
+		return EAction::None;
+	}
+
+	if (bAllocated)
+	{
+		UnusedTime += DeltaTime;
+		const float ReleaseDelay = CVarCaptureReleaseDelay.GetValueOnGameThread();
+		if (ReleaseDelay >= 0.0f && UnusedTime >= ReleaseDelay)
+		{
+			Reset();
+			return EAction::Release;
+		}
+	}
+	return EAction::None;
+}
+
+void FVRTPCaptureLifetime::Reset()
+{
+	bAllocated = false;
+	UnusedTime = 0.0f;
+}
+
+//*************************************************************
+
+void FVRTPLiveCapture::Init(AActor* Owner, USceneComponent* AttachParent, UTextureRenderTargetCube* Target, const FVRTPCaptureSettings& Settings, AActor* Skybox)
+{
+	Release();
+	if (Target == nullptr || (Skybox == nullptr && !Settings.bLiveCaptureScene))
+	{
+		return;
+	}
+
+	CubeTarget = Target;
+	FaceSize = Target->SizeX;
+	TilesPerSide = FMath::Clamp(Settings.LiveTilesPerSide, 1, 8);
+	TileSize = FMath::DivideAndRoundUp(FaceSize, TilesPerSide);
+
+	Capture = NewObject<USceneCaptureComponent2D>(Owner);
+	FVRTPCaptureSettings::InitCaptureComponent(Capture);
+	Capture->bUseCustomProjectionMatrix = true;
+	Capture->CaptureSource = ESceneCaptureSource::SCS_SceneColorHDR;
+	if (Settings.bLiveCaptureScene)
+	{
+		Capture->HiddenActors.Add(Owner);
+		if (Skybox != nullptr)
+		{
+			Capture->HiddenActors.Add(Skybox);
+		}
+	}
+	else
+	{
+		Capture->ShowOnlyActorComponents(Skybox);
+	}
+
+	// Held by our TileTarget property until Release
+	TileTarget = NewObject<UTextureRenderTarget2D>(Capture);
+	TileTarget->ClearColor = FLinearColor::Black;
+	TileTarget->InitCustomFormat(TileSize, TileSize, Settings.GetPixelFormat(), false);
+	Capture->TextureTarget = TileTarget;
+	INC_MEMORY_STAT_BY(STAT_VRTP_CaptureMemory, TextureBytes(TileTarget));
+
+	// Faces are oriented explicitly, so only the location follows the parent
+	Capture->SetUsingAbsoluteRotation(true);
+	Capture->RegisterComponent();
+	if (AttachParent != nullptr)
+	{
+		Capture->AttachToComponent(AttachParent, FAttachmentTransformRules::KeepRelativeTransform);
+	}
+
+	const int32 NumTiles = CubeFace_MAX * TilesPerSide * TilesPerSide;
+	TileAges.Init(0, NumTiles);
+	TileDirections.SetNum(NumTiles);
+	for (int32 Tile = 0; Tile < NumTiles; ++Tile)
+	{
+		const int32 Face = Tile / (TilesPerSide * TilesPerSide);
+		const int32 X = Tile % TilesPerSide;
+		const int32 Y = (Tile / TilesPerSide) % TilesPerSide;
+		const float U = ((X + 0.5f) * TileSize / FaceSize) * 2.0f - 1.0f;
+		const float V = 1.0f - ((Y + 0.5f) * TileSize / FaceSize) * 2.0f;
+		const FVector Right = FaceUps[Face] ^ FaceDirections[Face];
+		TileDirections[Tile] = (FaceDirections[Face] + Right * U + FaceUps[Face] * V).GetSafeNormal();
+	}
+}
+
+void FVRTPLiveCapture::Release()
+{
+	if (Capture != nullptr)
+	{
+		DEC_MEMORY_STAT_BY(STAT_VRTP_CaptureMemory, TextureBytes(TileTarget));
+		TileTarget->ReleaseResource();
+		Capture->DestroyComponent();
+	}
+	Capture = nullptr;
+	TileTarget = nullptr;
+	CubeTarget = nullptr;
+	TileAges.Reset();
+	TileDirections.Reset();
+}
+
+void FVRTPLiveCapture::Tick(const FQuat& CubeRotation, const FVector& ViewForward)
+{
+	if (Capture == nullptr)
+	{
+		return;
+	}
+
+	// Tiles that fit in the budget, but always at least one so the cubemap keeps refreshing
+	const float PixelCost = CVarLiveCaptureCost.GetValueOnGameThread() * FMath::Square((float)TileSize) * 1.e-6f;
+	const float TileCost = FMath::Max(PixelCost + CVarLiveCaptureTileCost.GetValueOnGameThread(), KINDA_SMALL_NUMBER);
+	const int32 NumToCapture = FMath::Clamp(FMath::FloorToInt(CVarLiveCaptureBudget.GetValueOnGameThread() / TileCost), 1, TileAges.Num());
+
+	for (uint32& Age : TileAges)
+	{
+		++Age;
+	}
+
+	// Oldest first, with tiles towards the view counting as up to 1 + ViewPriority times older
+	const FVector LocalForward = CubeRotation.UnrotateVector(ViewForward);
+	for (int32 Captured = 0; Captured < NumToCapture; ++Captured)
+	{
+		int32 BestTile = INDEX_NONE;
+		float BestPriority = 0.0f;
+		for (int32 Tile = 0; Tile < TileAges.Num(); ++Tile)
+		{
+			const float Priority = TileAges[Tile] * (1.0f + ViewPriority * FMath::Max(FVector::DotProduct(TileDirections[Tile], LocalForward), 0.0f));
+			if (Priority > BestPriority)
+			{
+				BestTile = Tile;
+				BestPriority = Priority;
+			}
+		}
+		if (BestTile == INDEX_NONE)
+		{
+			break;
+		}
+
+		CaptureTile(BestTile, CubeRotation);
+		TileAges[BestTile] = 0;
+		INC_DWORD_STAT(STAT_VRTP_LiveCaptureTiles);
+	}
+}
+
+void FVRTPLiveCapture::CaptureTile(int32 Tile, const FQuat& CubeRotation)
+{
+	const int32 Face = Tile / (TilesPerSide * TilesPerSide);
+	const FIntPoint Origin((Tile % TilesPerSide) * TileSize, ((Tile / TilesPerSide) % TilesPerSide) * TileSize);
+
+	// Orient the capture like the engine's own cube face views: X forward, Y right, Z up
+	Capture->SetWorldRotation(CubeRotation * FRotationMatrix::MakeFromXZ(FaceDirections[Face], FaceUps[Face]).ToQuat());
+
+	// The face's 90 degree projection, scaled and offset in clip space so the tile fills the target
+	const float Scale = (float)FaceSize / TileSize;
+	const float CentreX = (Origin.X + 0.5f * TileSize) / FaceSize * 2.0f - 1.0f;
+	const float CentreY = 1.0f - (Origin.Y + 0.5f * TileSize) / FaceSize * 2.0f;
+	const FMatrix TileMatrix(
+		FPlane(Scale, 0.0f, 0.0f, 0.0f),
+		FPlane(0.0f, Scale, 0.0f, 0.0f),
+		FPlane(0.0f, 0.0f, 1.0f, 0.0f),
+		FPlane(-CentreX * Scale, -CentreY * Scale, 0.0f, 1.0f));
+	Capture->CustomProjectionMatrix = FReversedZPerspectiveMatrix(PI / 4.0f, 1.0f, 1.0f, GNearClippingPlane) * TileMatrix;
+	Capture->CaptureScene();
+
+	// Copy into the face, clipping the tiles that overhang its edge
+	FRHICopyTextureInfo CopyInfo;
+	CopyInfo.Size = FIntVector(FMath::Min(TileSize, FaceSize - Origin.X), FMath::Min(TileSize, FaceSize - Origin.Y), 1);
+	CopyInfo.DestSliceIndex = Face;
+	CopyInfo.DestPosition = FIntVector(Origin.X, Origin.Y, 0);
+
+	FTextureRenderTargetResource* Source = TileTarget->GameThread_GetRenderTargetResource();
+	FTextureRenderTargetResource* Dest = CubeTarget->GameThread_GetRenderTargetResource();
+	ENQUEUE_RENDER_COMMAND(VRTPCopyCaptureTile)(
+		[Source, Dest, CopyInfo](FRHICommandListImmediate& RHICmdList)
+		{
+			FRHITexture* SourceTexture = Source->GetRenderTargetTexture();
+			FRHITexture* DestTexture = Dest->GetRenderTargetTexture();
+			RHICmdList.Transition({
+				FRHITransitionInfo(SourceTexture, ERHIAccess::Unknown, ERHIAccess::CopySrc),
+				FRHITransitionInfo(DestTexture, ERHIAccess::Unknown, ERHIAccess::CopyDest) });
+			RHICmdList.CopyTexture(SourceTexture, DestTexture, CopyInfo);
+			RHICmdList.Transition({
+				FRHITransitionInfo(SourceTexture, ERHIAccess::CopySrc, ERHIAccess::SRVMask),
+				FRHITransitionInfo(DestTexture, ERHIAccess::CopyDest, ERHIAccess::SRVMask) });
+		});
+}
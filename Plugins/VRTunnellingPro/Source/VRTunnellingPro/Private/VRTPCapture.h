@@ -0,0 +1,178 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "PixelFormat.h"
+#include "Templates/SubclassOf.h"
+#include "VRTPCapture.generated.h"
+
+class AActor;
+class UWorld;
+class USceneComponent;
+class USceneCaptureComponent;
+class USceneCaptureComponent2D;
+class USceneCaptureComponentCube;
+class UTextureRenderTarget2D;
+class UTextureRenderTargetCube;
+
+/// Skybox Capture Format Enumerator (RGBA8 || RGBA16F || RG11B10F)
+UENUM(BlueprintType)
+enum class EVRTPCaptureFormat : uint8
+{
+	CF_RGBA8		UMETA(DisplayName = "RGBA8 (4 bytes)"),
+	CF_RGBA16F		UMETA(DisplayName = "RGBA16F (8 bytes, HDR)"),
+	CF_RG11B10F		UMETA(DisplayName = "RG11B10F (4 bytes, HDR)")
+};
+
+/// What happens to the spawned skybox blueprint once a static snapshot is captured (Keep || Park || Destroy)
+UENUM(BlueprintType)
+enum class EVRTPSkyboxRetention : uint8
+{
+	SR_KEEP			UMETA(DisplayName = "Keep"),
+	SR_PARK			UMETA(DisplayName = "Park"),
+	SR_DESTROY		UMETA(DisplayName = "Destroy")
+};
+
+/// Skybox cubemap capture settings, shared by the desktop and mobile components
+USTRUCT(BlueprintType)
+struct FVRTPCaptureSettings
+{
+	GENERATED_USTRUCT_BODY()
+
+	/// Width and height of each cube face, in pixels
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "16", ClampMax = "4096"))
+	int32 Resolution;
+
+	/// Pixel format of the capture
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EVRTPCaptureFormat Format;
+
+	/// Keep recapturing the cubemap a few tiles per frame, so a changing skybox (time of day, moving clouds) stays current.
+	/// The tiles captured each frame are capped by vr.Tunnelling.LiveCaptureBudget
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	bool bLiveCapture;
+
+	/// Tiles along each edge of a cube face when live capturing; more tiles spread each face over more frames
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (ClampMin = "1", ClampMax = "8", EditCondition = "bLiveCapture"))
+	int32 LiveTilesPerSide;
+
+	/// Live capture the surrounding scene rather than only the skybox blueprint. The owner and the skybox are left out.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture", meta = (EditCondition = "bLiveCapture"))
+	bool bLiveCaptureScene;
+
+	/// What to do with the skybox blueprint after a static capture. Keep leaves it attached to the owner; Park hides and detaches it,
+	/// with ticking and collision off, until a recapture; Destroy removes it and respawns it for a recapture. Live captures always keep it.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	EVRTPSkyboxRetention SkyboxAfterCapture;
+
+	FVRTPCaptureSettings()
+	{
+		Resolution = 1024;
+		Format = EVRTPCaptureFormat::CF_RGBA8;
+		bLiveCapture = false;
+		LiveTilesPerSide = 2;
+		bLiveCaptureScene = false;
+		SkyboxAfterCapture = EVRTPSkyboxRetention::SR_KEEP;
+	}
+
+	EPixelFormat GetPixelFormat() const;
+
+	/// The face size captures are made at: Resolution, limited by the tunnelling scalability group
+	int32 GetResolution() const;
+
+	/// GPU memory of a render target with these settings, in bytes
+	int64 GetMemoryBytes() const;
+
+	/// Create a render target with these settings. Its memory is counted by "stat VRTunnelling" until ReleaseRenderTarget.
+	UTextureRenderTargetCube* CreateRenderTarget() const;
+
+	/// Stop counting a render target made by CreateRenderTarget, and free its resource
+	static void ReleaseRenderTarget(UTextureRenderTargetCube* RenderTarget);
+
+	/// GPU memory of an existing render target, in bytes
+	static int64 GetMemoryBytes(const UTextureRenderTargetCube* RenderTarget);
+
+	/// Set up a capture component for skybox snapshots: no automatic captures, and no atmosphere, fog or anti-aliasing
+	static void InitCaptureComponent(USceneCaptureComponent* Capture);
+
+	/// Capture a cube from the origin of SkyboxFrame with its faces turned by its rotation, whatever Capture is attached to.
+	/// Every skybox snapshot is taken this way, from the skybox's own origin and in its own frame (the frame the vignette looks the cubemap
+	/// up in), so a snapshot never depends on where its owner stands and can be shared.
+	static void CaptureCube(USceneCaptureComponentCube* Capture, const FTransform& SkyboxFrame);
+
+	/// Take a captured skybox out of the scene without destroying it: hidden, detached, and with ticking and collision off
+	/// bOutCollisionEnabled receives whether the skybox had collision before, for UnparkSkybox.
+	static void ParkSkybox(AActor* Skybox, bool& bOutCollisionEnabled);
+
+	/// Undo ParkSkybox, attaching the skybox back to Parent and restoring the collision it had
+	static void UnparkSkybox(AActor* Skybox, USceneComponent* Parent, bool bCollisionEnabled);
+
+	/// Spawn a skybox blueprint at the origin of World without rotation, capture it on its own into Target, and destroy it again.
+	/// This matches CaptureCube on a skybox spawned anywhere else.
+	/// With bWaitForAssets, blocks until its shaders are compiled and its textures streamed in before capturing (for offline bakes).
+	static bool CaptureSkybox(UWorld* World, TSubclassOf<AActor> SkyboxBlueprint, UTextureRenderTargetCube* Target, bool bWaitForAssets = false);
+};
+
+/// Decides when a component's skybox capture should exist: allocated as soon as it is needed,
+/// and released once it has gone unused for vr.Tunnelling.CaptureReleaseDelay seconds
+struct FVRTPCaptureLifetime
+{
+	enum class EAction : uint8
+	{
+		None,
+		Allocate,
+		Release
+	};
+
+	bool bAllocated = false;
+	float UnusedTime = 0.0f;
+
+	/// Advance by DeltaTime and return what to do with the capture. bAllocated already reflects the action.
+	EAction Update(bool bNeeded, float DeltaTime);
+
+	void Reset();
+};
+
+/// Time-sliced recapture of a cube render target. Each frame, the tiles that fit in the GPU budget are rendered one at a time by a 2D capture
+/// with an off-centre projection and copied into their cube face. Every tile is a full scene capture of its own, so each one pays the fixed cost
+/// of a scene render on top of its pixels. Tiles are picked by age, weighted towards the direction the player is looking.
+USTRUCT()
+struct FVRTPLiveCapture
+{
+	GENERATED_BODY()
+
+public:
+	/// Start recapturing Target. The tile capture is created under Owner and attached to AttachParent (usually the camera).
+	/// Only the Skybox actor is captured, unless the settings ask for the whole scene.
+	void Init(AActor* Owner, USceneComponent* AttachParent, UTextureRenderTargetCube* Target, const FVRTPCaptureSettings& Settings, AActor* Skybox);
+
+	/// Stop recapturing and destroy the tile capture
+	void Release();
+
+	bool IsActive() const { return Capture != nullptr; }
+
+	/// Capture this frame's tiles. CubeRotation is the frame the cubemap is looked up in, which must match the one the cube was first
+	/// captured in (see CaptureCube); ViewForward is the player's view direction.
+	void Tick(const FQuat& CubeRotation, const FVector& ViewForward);
+
+private:
+	void CaptureTile(int32 Tile, const FQuat& CubeRotation);
+
+	UPROPERTY(Transient)
+	USceneCaptureComponent2D* Capture = nullptr;
+
+	UPROPERTY(Transient)
+	UTextureRenderTarget2D* TileTarget = nullptr;
+
+	UPROPERTY(Transient)
+	UTextureRenderTargetCube* CubeTarget = nullptr;
+
+	int32 TilesPerSide = 1;
+	int32 TileSize = 0;
+	int32 FaceSize = 0;
+
+	/// Frames since each tile was captured, and its centre direction in the cube's frame
+	TArray<uint32> TileAges;
+	TArray<FVector> TileDirections;
+};
@@ -0,0 +1,98 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPCaptureSubsystem.h"
+#include "Engine/World.h"
+#include "Engine/TextureRenderTargetCube.h"
+#include "HAL/IConsoleManager.h"
+#include "VRTPStats.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Shared Captures"), STAT_VRTP_SharedCaptures, STATGROUP_VRTunnelling);
+
+namespace {
+	TAutoConsoleVariable<int32> CVarShareCaptures(
+		TEXT("vr.Tunnelling.ShareCaptures"),
+		1,
+		TEXT("Whether components with the same skybox blueprint and capture settings share one skybox snapshot.\n")
+		TEXT(" 0: every component captures its own\n")
+		TEXT(" 1: share per world (default)"),
+		ECVF_Default);
+} // anonymous namespace
+
+UVRTPCaptureSubsystem* UVRTPCaptureSubsystem::GetShared(const UWorld* World)
+{
+	if (World && CVarShareCaptures.GetValueOnGameThread() != 0)
+	{
+		return World->GetSubsystem<UVRTPCaptureSubsystem>();
+	}
+	return nullptr;
+}
+
+bool UVRTPCaptureSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+UTextureRenderTargetCube* UVRTPCaptureSubsystem::AcquireCapture(TSubclassOf<AActor> SkyboxBlueprint, const FVRTPCaptureSettings& Settings)
+{
+	for (FVRTPSharedCapture& Capture : Captures)
+	{
+		if (Capture.SkyboxBlueprint == SkyboxBlueprint && Capture.Resolution == Settings.GetResolution() && Capture.Format == Settings.Format)
+		{
+			++Capture.NumUsers;
+			return Capture.Target;
+		}
+	}
+
+	UTextureRenderTargetCube* Target = Settings.CreateRenderTarget();
+	if (!FVRTPCaptureSettings::CaptureSkybox(GetWorld(), SkyboxBlueprint, Target))
+	{
+		FVRTPCaptureSettings::ReleaseRenderTarget(Target);
+		return nullptr;
+	}
+
+	FVRTPSharedCapture& Capture = Captures.AddDefaulted_GetRef();
+	Capture.SkyboxBlueprint = SkyboxBlueprint;
+	Capture.Target = Target;
+	Capture.Resolution = Settings.GetResolution();
+	Capture.Format = Settings.Format;
+	Capture.NumUsers = 1;
+	INC_DWORD_STAT(STAT_VRTP_SharedCaptures);
+	return Target;
+}
+
+void UVRTPCaptureSubsystem::ReleaseCapture(UTextureRenderTargetCube* Target)
+{
+	const int32 Index = Captures.IndexOfByPredicate([Target](const FVRTPSharedCapture& Capture) { return Capture.Target == Target; });
+	if (Index == INDEX_NONE || --Captures[Index].NumUsers > 0)
+	{
+		return;
+	}
+
+	FVRTPCaptureSettings::ReleaseRenderTarget(Target);
+	Captures.RemoveAtSwap(Index);
+	DEC_DWORD_STAT(STAT_VRTP_SharedCaptures);
+}
+
+void UVRTPCaptureSubsystem::RecaptureShared(UTextureRenderTargetCube* Target)
+{
+	for (const FVRTPSharedCapture& Capture : Captures)
+	{
+		if (Capture.Target == Target)
+		{
+			FVRTPCaptureSettings::CaptureSkybox(GetWorld(), Capture.SkyboxBlueprint, Target);
+			return;
+		}
+	}
+}
+
+void UVRTPCaptureSubsystem::Deinitialize()
+{
+	// Components normally release their captures in EndPlay; catch any that did not
+	for (const FVRTPSharedCapture& Capture : Captures)
+	{
+		FVRTPCaptureSettings::ReleaseRenderTarget(Capture.Target);
+		DEC_DWORD_STAT(STAT_VRTP_SharedCaptures);
+	}
+	Captures.Reset();
+
+	Super::Deinitialize();
+}
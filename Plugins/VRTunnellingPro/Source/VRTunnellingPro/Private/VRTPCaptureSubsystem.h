@@ -0,0 +1,60 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Templates/SubclassOf.h"
+#include "VRTPCapture.h"
+#include "VRTPCaptureSubsystem.generated.h"
+
+class AActor;
+class UTextureRenderTargetCube;
+
+/// A skybox snapshot shared by every component using the same blueprint, resolution and format
+USTRUCT()
+struct FVRTPSharedCapture
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TSubclassOf<AActor> SkyboxBlueprint;
+
+	UPROPERTY()
+	UTextureRenderTargetCube* Target = nullptr;
+
+	int32 Resolution = 0;
+	EVRTPCaptureFormat Format = EVRTPCaptureFormat::CF_RGBA8;
+	int32 NumUsers = 0;
+};
+
+/// World-level pool of skybox snapshots. Components with the same skybox blueprint and capture settings (split-screen players,
+/// several pawns) share one render target, captured once by the first of them and released when the last one lets go.
+/// Snapshots are taken from the skybox's origin in its own frame, as unshared ones are, so they suit any owner's transform.
+UCLASS()
+class UVRTPCaptureSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/// Returns the subsystem for World if capture sharing is enabled (vr.Tunnelling.ShareCaptures), otherwise null
+	static UVRTPCaptureSubsystem* GetShared(const UWorld* World);
+
+	/// Get the snapshot of SkyboxBlueprint with these settings, capturing it if no one holds it yet.
+	/// Every successful call must be matched by a ReleaseCapture. Returns null if the blueprint could not be spawned.
+	UTextureRenderTargetCube* AcquireCapture(TSubclassOf<AActor> SkyboxBlueprint, const FVRTPCaptureSettings& Settings);
+
+	/// Give up a snapshot returned by AcquireCapture; the last user frees it
+	void ReleaseCapture(UTextureRenderTargetCube* Target);
+
+	/// Capture a shared snapshot again, for every component using it. The skybox is spawned for the capture and destroyed after.
+	void RecaptureShared(UTextureRenderTargetCube* Target);
+
+	virtual void Deinitialize() override;
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+private:
+	UPROPERTY()
+	TArray<FVRTPSharedCapture> Captures;
+};
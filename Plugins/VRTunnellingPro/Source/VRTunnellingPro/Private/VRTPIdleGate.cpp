@@ -0,0 +1,36 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPIdleGate.h"
+#include "HAL/IConsoleManager.h"
+
+namespace
+{
+	TAutoConsoleVariable<float> CVarIdleSkipDelay(
+		TEXT("vr.Tunnelling.IdleSkipDelay"),
+		0.5f,
+		TEXT("Seconds the vignette must stay fully open before its post process pass is skipped. Negative values never skip.\n")
+		TEXT("Set by sg.VRTunnellingQuality."),
+		ECVF_Scalability);
+} // anonymous namespace
+
+bool FVRTPIdleGate::Update(const FVRTPMotionResult& Result, float Dt, bool bCanIdle)
+{
+	const bool bWasIdle = bIdle;
+	const float Delay = CVarIdleSkipDelay.GetValueOnAnyThread();
+
+	if (!bCanIdle || Delay < 0.0f || Result.Radius < ArmRadius)
+	{
+		Reset();
+	}
+	else if (!bIdle)
+	{
+		OpenTime = Result.Radius >= OpenRadius ? OpenTime + Dt : 0.0f;
+		bIdle = OpenTime >= Delay;
+	}
+	return bIdle != bWasIdle;
+}
+
+void FVRTPIdleGate::Reset()
+{
+	bIdle = false;
+	OpenTime = 0.0f;
+}
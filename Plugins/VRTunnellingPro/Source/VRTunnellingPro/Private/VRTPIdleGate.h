@@ -0,0 +1,27 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VRTPMotionModel.h"
+
+/// Decides when the vignette has been fully open long enough that its pass can be skipped. Idle begins once the radius has stayed
+/// open for vr.Tunnelling.IdleSkipDelay seconds, and ends on the first result whose radius has closed noticeably, so the pass is
+/// re-armed in the same frame motion starts. The two radius thresholds and the delay keep the pass from toggling at the boundary.
+struct FVRTPIdleGate
+{
+	/// Radius below which an idle vignette is re-armed
+	static constexpr float ArmRadius = FVRTPMotionModel::OpenRadius - 0.02f;
+
+	/// Radius at or above which the vignette counts as open
+	static constexpr float OpenRadius = FVRTPMotionModel::OpenRadius - 0.01f;
+
+	bool bIdle = false;
+	float OpenTime = 0.0f;
+
+	/// Advance by Dt seconds. bCanIdle is false when the effect draws something even while open (e.g. window and portal masks).
+	/// Returns true if bIdle changed.
+	bool Update(const FVRTPMotionResult& Result, float Dt, bool bCanIdle);
+
+	/// Leave idle immediately
+	void Reset();
+};
@@ -0,0 +1,95 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPInit.h"
+#include "Engine/AssetManager.h"
+#include "Engine/StreamableManager.h"
+#include "HAL/IConsoleManager.h"
+
+namespace {
+	TAutoConsoleVariable<int32> CVarAsyncInit(
+		TEXT("vr.Tunnelling.AsyncInit"),
+		1,
+		TEXT("How tunnelling components initialise.\n")
+		TEXT(" 0: load assets synchronously and initialise everything on the first tick\n")
+		TEXT(" 1: stream assets in and initialise one stage per tick, with a colour background until ready (default)"),
+		ECVF_Default);
+} // anonymous namespace
+
+bool FVRTPAssetLoader::IsAsync()
+{
+	return CVarAsyncInit.GetValueOnGameThread() != 0;
+}
+
+void FVRTPAssetLoader::Request(const TArray<FSoftObjectPath>& Paths)
+{
+	Requested.Reset();
+	for (const FSoftObjectPath& Path : Paths)
+	{
+		if (!Path.IsNull())
+		{
+			Requested.AddUnique(Path);
+		}
+	}
+
+	// Requested before the current handle is let go, so assets used by both are never unloaded in between
+	TSharedPtr<FStreamableHandle> NewHandle;
+	if (Requested.Num() > 0)
+	{
+		NewHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(Requested, FStreamableDelegate(), FStreamableManager::AsyncLoadHighPriority);
+		if (NewHandle.IsValid() && !IsAsync())
+		{
+			NewHandle->WaitUntilComplete();
+		}
+	}
+
+	// Only the last completed request is kept alongside the new one; one superseded before completing is dropped
+	if (Handle.IsValid() && Handle->HasLoadCompleted())
+	{
+		ReleaseHandle(PreviousHandle);
+		PreviousHandle = Handle;
+	}
+	else
+	{
+		ReleaseHandle(Handle);
+	}
+	Handle = NewHandle;
+	if (IsLoaded())
+	{
+		ReleaseHandle(PreviousHandle);
+	}
+}
+
+void FVRTPAssetLoader::Update()
+{
+	// Never completes on its own, so ask again; the previous assets stay loaded meanwhile
+	if (Handle.IsValid() && Handle->WasCanceled())
+	{
+		Handle.Reset();
+		Request(TArray<FSoftObjectPath>(Requested));
+		return;
+	}
+	if (IsLoaded())
+	{
+		ReleaseHandle(PreviousHandle);
+	}
+}
+
+bool FVRTPAssetLoader::IsLoaded() const
+{
+	return !Handle.IsValid() || Handle->HasLoadCompleted();
+}
+
+void FVRTPAssetLoader::Release()
+{
+	ReleaseHandle(Handle);
+	ReleaseHandle(PreviousHandle);
+	Requested.Reset();
+}
+
+void FVRTPAssetLoader::ReleaseHandle(TSharedPtr<FStreamableHandle>& InHandle)
+{
+	if (InHandle.IsValid())
+	{
+		InHandle->ReleaseHandle();
+		InHandle.Reset();
+	}
+}
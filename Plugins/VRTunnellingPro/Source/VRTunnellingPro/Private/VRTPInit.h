@@ -0,0 +1,54 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "UObject/SoftObjectPath.h"
+#include "VRTPInit.generated.h"
+
+struct FStreamableHandle;
+
+/// Broadcast once a tunnelling component has finished initialising
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FVRTPOnTunnellingReady);
+
+/// Initialisation stages of the desktop and mobile components. One stage runs per tick, so spawning a pawn never
+/// loads assets, creates materials and captures the skybox in a single frame. Until Ready the vignette uses a colour background.
+enum class EVRTPInitStage : uint8
+{
+	LoadAssets,			// Request the soft asset references from the streamable manager
+	CreateMaterials,	// Create the effect material instances
+	CreateIris,			// Create the iris mesh (mobile only)
+	AllocateCapture,	// Allocate and capture the skybox, if the background mode needs it
+	WarmUp,				// Wait for the effect materials the component may use to be drawn once offscreen
+	Ready
+};
+
+/// Streams in a component's soft asset references and keeps them loaded while the component uses them
+class FVRTPAssetLoader
+{
+public:
+	/// Whether components initialise over several ticks (vr.Tunnelling.AsyncInit). Otherwise assets are loaded synchronously
+	/// and every stage runs on the first tick.
+	static bool IsAsync();
+
+	/// Load Paths, replacing any previous request. Null paths are ignored. The previous request's assets stay loaded until
+	/// this one completes, since the component keeps using them in the meantime.
+	void Request(const TArray<FSoftObjectPath>& Paths);
+
+	/// Call once per tick: requests the same assets again if the last request was canceled (e.g. by the streamable manager
+	/// during a level transition), and lets go of the previous request's assets once the last one has completed
+	void Update();
+
+	/// Whether the last request has completed (or there is none). A canceled request never counts as loaded.
+	bool IsLoaded() const;
+
+	/// Let go of the loaded assets
+	void Release();
+
+private:
+	static void ReleaseHandle(TSharedPtr<FStreamableHandle>& InHandle);
+
+	TSharedPtr<FStreamableHandle> Handle;
+	TSharedPtr<FStreamableHandle> PreviousHandle;
+	TArray<FSoftObjectPath> Requested;
+};
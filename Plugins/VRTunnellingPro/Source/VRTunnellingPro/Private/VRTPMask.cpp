@@ -1,9 +1,16 @@
 // Copyright 2021 Darby Costello. All Rights Reserved.
 #include "VRTPMask.h"
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "VRTPMaskSubsystem.h"
 
 UVRTPMask::UVRTPMask()
 {
 	PrimaryComponentTick.bCanEverTick = false;
+
+	// Every layer, so a mask is applied by every tunnelling component unless told otherwise
+	Layers = 0xFF;
 }
 
 
@@ -11,4 +18,95 @@ UVRTPMask::UVRTPMask()
 void UVRTPMask::BeginPlay()
 {
 	Super::BeginPlay();
+
+	if (UVRTPMaskSubsystem* MaskSubsystem = GetMaskSubsystem())
+	{
+		MaskSubsystem->RegisterMask(this);
+	}
+}
+
+void UVRTPMask::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (UVRTPMaskSubsystem* MaskSubsystem = GetMaskSubsystem())
+	{
+		MaskSubsystem->UnregisterMask(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UVRTPMask::SetLayers(int32 NewLayers)
+{
+	Layers = NewLayers;
+	if (UVRTPMaskSubsystem* MaskSubsystem = GetMaskSubsystem())
+	{
+		MaskSubsystem->UpdateMask(this);
+	}
+}
+
+void UVRTPMask::SetPrimitiveTag(FName NewPrimitiveTag)
+{
+	UVRTPMaskSubsystem* MaskSubsystem = GetMaskSubsystem();
+	TArray<UPrimitiveComponent*> PreviousPrimitives;
+	if (MaskSubsystem)
+	{
+		GetMaskedPrimitives(PreviousPrimitives);
+	}
+	PrimitiveTag = NewPrimitiveTag;
+	if (MaskSubsystem)
+	{
+		MaskSubsystem->UpdateMask(this, PreviousPrimitives);
+	}
+}
+
+void UVRTPMask::SetPrimitives(const TArray<UPrimitiveComponent*>& NewPrimitives)
+{
+	UVRTPMaskSubsystem* MaskSubsystem = GetMaskSubsystem();
+	TArray<UPrimitiveComponent*> PreviousPrimitives;
+	if (MaskSubsystem)
+	{
+		GetMaskedPrimitives(PreviousPrimitives);
+	}
+	Primitives = NewPrimitives;
+	if (MaskSubsystem)
+	{
+		MaskSubsystem->UpdateMask(this, PreviousPrimitives);
+	}
+}
+
+void UVRTPMask::GetMaskedPrimitives(TArray<UPrimitiveComponent*>& OutPrimitives) const
+{
+	if (Primitives.Num() > 0)
+	{
+		for (UPrimitiveComponent* Primitive : Primitives)
+		{
+			if (Primitive != nullptr)
+			{
+				OutPrimitives.Add(Primitive);
+			}
+		}
+		return;
+	}
+
+	const AActor* Actor = GetOwner();
+	if (Actor == nullptr)
+	{
+		return;
+	}
+
+	TInlineComponentArray<UPrimitiveComponent*> ActorPrimitives(Actor);
+	for (UPrimitiveComponent* Primitive : ActorPrimitives)
+	{
+		if (PrimitiveTag.IsNone() || Primitive->ComponentHasTag(PrimitiveTag))
+		{
+			OutPrimitives.Add(Primitive);
+		}
+	}
+}
+
+UVRTPMaskSubsystem* UVRTPMask::GetMaskSubsystem() const
+{
+	// Only registered masks are updated; before BeginPlay the settings are simply picked up on registration
+	const UWorld* World = GetWorld();
+	return World && HasBegunPlay() ? World->GetSubsystem<UVRTPMaskSubsystem>() : nullptr;
 }
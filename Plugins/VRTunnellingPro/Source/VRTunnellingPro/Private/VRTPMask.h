@@ -5,6 +5,23 @@
 #include "Components/ActorComponent.h"
 #include "VRTPMask.generated.h"
 
+class UPrimitiveComponent;
+class UVRTPMaskSubsystem;
+
+/// Mask layers (Layer 0-7). A tunnelling component only applies its stencil index to masks that share one of its Mask Layers.
+UENUM(BlueprintType, meta = (Bitflags, UseEnumValuesAsMaskValuesInEditor = "true"))
+enum class EVRTPMaskLayer : uint8
+{
+	ML_0 = 1 << 0	UMETA(DisplayName = "Layer 0"),
+	ML_1 = 1 << 1	UMETA(DisplayName = "Layer 1"),
+	ML_2 = 1 << 2	UMETA(DisplayName = "Layer 2"),
+	ML_3 = 1 << 3	UMETA(DisplayName = "Layer 3"),
+	ML_4 = 1 << 4	UMETA(DisplayName = "Layer 4"),
+	ML_5 = 1 << 5	UMETA(DisplayName = "Layer 5"),
+	ML_6 = 1 << 6	UMETA(DisplayName = "Layer 6"),
+	ML_7 = 1 << 7	UMETA(DisplayName = "Layer 7")
+};
+
 /// Mask Component for both desktop and mobile applications. Used to add parent actor to the stencil buffer
 UCLASS(ClassGroup = (Custom), meta = (BlueprintSpawnableComponent))
 class UVRTPMask : public UActorComponent
@@ -14,10 +31,41 @@ class UVRTPMask : public UActorComponent
 public:
 	UVRTPMask();
 
+	/// Layers of this mask. Every tunnelling component whose Mask Layers share a bit with these writes its stencil index into the
+	/// masked primitives; the stencil values of several components are combined bitwise.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "VR Tunnelling|Mask", meta = (Bitmask, BitmaskEnum = "/Script/VRTunnellingPro.EVRTPMaskLayer"))
+	int32 Layers;
+
+	/// If set, only primitives of the actor with this component tag are masked
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "VR Tunnelling|Mask")
+	FName PrimitiveTag;
+
+	/// If not empty, only these primitives are masked instead of the actor's, regardless of Primitive Tag
+	UPROPERTY(BlueprintReadOnly, Category = "VR Tunnelling|Mask")
+	TArray<UPrimitiveComponent*> Primitives;
+
+	/// Set the layers of this mask, updating its primitives only
+	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
+	void SetLayers(int32 NewLayers);
+
+	/// Mask only primitives of the actor with this component tag (None for all of them). Primitives no longer masked are cleared.
+	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
+	void SetPrimitiveTag(FName NewPrimitiveTag);
+
+	/// Mask only these primitives (empty for the actor's). Primitives no longer masked are cleared.
+	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
+	void SetPrimitives(const TArray<UPrimitiveComponent*>& NewPrimitives);
+
+	/// The primitives this mask covers, after the filters above
+	void GetMaskedPrimitives(TArray<UPrimitiveComponent*>& OutPrimitives) const;
+
 protected:
-	// Called when the game starts
+	// Called when the game starts; registers with the world's mask subsystem, which applies the current stencil settings
 	virtual void BeginPlay() override;
 
-public:
+	// Called when the game ends or the actor is removed; unregisters from the mask subsystem
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
+private:
+	UVRTPMaskSubsystem* GetMaskSubsystem() const;
 };
@@ -0,0 +1,161 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPMaskCapture.h"
+#include "VRTPCapture.h"
+#include "VRTPStats.h"
+#include "Camera/CameraComponent.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Engine/Engine.h"
+#include "Engine/GameViewportClient.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "GameFramework/Actor.h"
+#include "HAL/IConsoleManager.h"
+#include "UnrealClient.h"
+
+DECLARE_MEMORY_STAT(TEXT("Mask Capture Targets"), STAT_VRTP_MaskCaptureMemory, STATGROUP_VRTunnelling);
+
+namespace {
+	TAutoConsoleVariable<int32> CVarMaskPass(
+		TEXT("vr.Tunnelling.MaskPass"),
+		0,
+		TEXT("How the native render modes find masked objects.\n")
+		TEXT(" 0: masked objects render custom depth, which needs r.CustomDepth=3 (default)\n")
+		TEXT(" 1: a scene capture draws only the masked objects into a mask of the plugin's own, with no custom depth\n")
+		TEXT("The material render mode and the mobile component always use custom depth."),
+		ECVF_Default);
+
+	TAutoConsoleVariable<float> CVarMaskScale(
+		TEXT("vr.Tunnelling.MaskScale"),
+		0.5f,
+		TEXT("Resolution of the mask captured by vr.Tunnelling.MaskPass, relative to the view height, from 0.25 to 1. Lower values coarsen mask edges."),
+		ECVF_Scalability);
+
+	/// Degrees added to the capture's field of view, so each eye's view, offset from the camera, still falls inside it
+	constexpr float FOVMargin = 10.0f;
+
+	/// Device depth holds the nearest masked surface; reversed Z leaves 0 wherever nothing was drawn
+	constexpr EPixelFormat MaskFormat = PF_R32_FLOAT;
+
+	int64 TextureBytes(const UTextureRenderTarget2D* RenderTarget)
+	{
+		return (int64)RenderTarget->SizeX * RenderTarget->SizeY * GPixelFormats[RenderTarget->GetFormat()].BlockBytes;
+	}
+} // anonymous namespace
+
+bool FVRTPMaskCapture::IsEnabled()
+{
+	return CVarMaskPass.GetValueOnGameThread() != 0;
+}
+
+void FVRTPMaskCapture::Init(AActor* Owner, const TArray<UPrimitiveComponent*>& Primitives)
+{
+	if (Capture != nullptr)
+	{
+		return;
+	}
+
+	Capture = NewObject<USceneCaptureComponent2D>(Owner);
+	FVRTPCaptureSettings::InitCaptureComponent(Capture);
+	Capture->CaptureSource = ESceneCaptureSource::SCS_DeviceDepth;
+	Capture->PrimitiveRenderMode = ESceneCapturePrimitiveRenderMode::PRM_UseShowOnlyList;
+	Capture->bUseCustomProjectionMatrix = true;
+
+	// Only depth is read back, so skip the lighting and post processing the capture would otherwise render
+	Capture->ShowFlags.SetAmbientOcclusion(false);
+	Capture->ShowFlags.SetDynamicShadows(false);
+	Capture->ShowFlags.SetGlobalIllumination(false);
+	Capture->ShowFlags.SetLighting(false);
+	Capture->ShowFlags.SetMotionBlur(false);
+	Capture->ShowFlags.SetPostProcessing(false);
+	Capture->ShowFlags.SetScreenSpaceReflections(false);
+	Capture->ShowFlags.SetTranslucency(false);
+
+	// Placed explicitly each tick, so it is neither attached nor moved with the owner
+	Capture->SetUsingAbsoluteLocation(true);
+	Capture->SetUsingAbsoluteRotation(true);
+	Capture->RegisterComponent();
+	SetPrimitives(Primitives);
+}
+
+void FVRTPMaskCapture::Release()
+{
+	if (Target != nullptr)
+	{
+		DEC_MEMORY_STAT_BY(STAT_VRTP_MaskCaptureMemory, TextureBytes(Target));
+		Target->ReleaseResource();
+	}
+	if (Capture != nullptr)
+	{
+		Capture->DestroyComponent();
+	}
+	Capture = nullptr;
+	Target = nullptr;
+	WorldToClip = FMatrix::Identity;
+}
+
+void FVRTPMaskCapture::SetPrimitives(const TArray<UPrimitiveComponent*>& Primitives)
+{
+	if (Capture == nullptr)
+	{
+		return;
+	}
+
+	Capture->ShowOnlyComponents.Reset();
+	for (UPrimitiveComponent* Primitive : Primitives)
+	{
+		Capture->ShowOnlyComponent(Primitive);
+	}
+}
+
+void FVRTPMaskCapture::Tick(const UCameraComponent* Camera, float HFov, float VFov)
+{
+	if (Capture == nullptr || Camera == nullptr || GEngine->GameViewport == nullptr || GEngine->GameViewport->Viewport == nullptr)
+	{
+		return;
+	}
+
+	// The HMD's field of view when it reports one, otherwise the camera's across the viewport's aspect ratio
+	const FIntPoint ViewportSize = GEngine->GameViewport->Viewport->GetSizeXY();
+	if (ViewportSize.X <= 0 || ViewportSize.Y <= 0)
+	{
+		return;
+	}
+	if (HFov <= 0.0f || VFov <= 0.0f)
+	{
+		HFov = Camera->FieldOfView;
+		VFov = FMath::RadiansToDegrees(2.0f * FMath::Atan(FMath::Tan(FMath::DegreesToRadians(HFov * 0.5f)) * ViewportSize.Y / ViewportSize.X));
+	}
+	const float HalfFovX = FMath::DegreesToRadians(FMath::Min(HFov + FOVMargin, 170.0f) * 0.5f);
+	const float HalfFovY = FMath::DegreesToRadians(FMath::Min(VFov + FOVMargin, 170.0f) * 0.5f);
+
+	// Sized from the view height, keeping texels roughly square
+	const float Scale = FMath::Clamp(CVarMaskScale.GetValueOnGameThread(), 0.25f, 1.0f);
+	const int32 Height = FMath::Clamp(FMath::RoundToInt(ViewportSize.Y * Scale), 16, 4096);
+	const int32 Width = FMath::Clamp(FMath::RoundToInt(Height * FMath::Tan(HalfFovX) / FMath::Tan(HalfFovY)), 16, 4096);
+	if (Target == nullptr || Target->SizeX != Width || Target->SizeY != Height)
+	{
+		if (Target != nullptr)
+		{
+			DEC_MEMORY_STAT_BY(STAT_VRTP_MaskCaptureMemory, TextureBytes(Target));
+			Target->ReleaseResource();
+		}
+
+		// Held by our Target property until Release
+		Target = NewObject<UTextureRenderTarget2D>(Capture);
+		Target->ClearColor = FLinearColor::Black;
+		Target->InitCustomFormat(Width, Height, MaskFormat, false);
+		Capture->TextureTarget = Target;
+		INC_MEMORY_STAT_BY(STAT_VRTP_MaskCaptureMemory, TextureBytes(Target));
+	}
+
+	const FVector Location = Camera->GetComponentLocation();
+	const FRotator Rotation = Camera->GetComponentRotation();
+	Capture->SetWorldLocationAndRotation(Location, Rotation);
+	Capture->CustomProjectionMatrix = FReversedZPerspectiveMatrix(HalfFovX, HalfFovY, 1.0f, 1.0f, GNearClippingPlane, GNearClippingPlane);
+	Capture->CaptureScene();
+
+	// The capture's view matrix, with the engine's swap from X forward, Z up to the view's Z forward, Y up
+	WorldToClip = FTranslationMatrix(-Location)
+		* FInverseRotationMatrix(Rotation)
+		* FMatrix(FPlane(0, 0, 1, 0), FPlane(1, 0, 0, 0), FPlane(0, 1, 0, 0), FPlane(0, 0, 0, 1))
+		* Capture->CustomProjectionMatrix;
+}
@@ -0,0 +1,55 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "VRTPMaskCapture.generated.h"
+
+class AActor;
+class UCameraComponent;
+class UPrimitiveComponent;
+class USceneCaptureComponent2D;
+class UTextureRenderTarget2D;
+
+/// Draws the masked primitives of one tunnelling component into a small mask target of its own, with a show-only scene capture
+/// from the player's camera, so the native pass can find masked objects without custom depth (vr.Tunnelling.MaskPass).
+/// The target holds device depth: 0 where no masked primitive was drawn. The vignette reprojects each pixel into it.
+USTRUCT()
+struct FVRTPMaskCapture
+{
+	GENERATED_BODY()
+
+public:
+	/// Whether the native render modes use a mask capture instead of custom depth (vr.Tunnelling.MaskPass)
+	static bool IsEnabled();
+
+	/// Create the capture under Owner, drawing only Primitives. Does nothing if it already exists.
+	void Init(AActor* Owner, const TArray<UPrimitiveComponent*>& Primitives);
+
+	/// Destroy the capture and its target
+	void Release();
+
+	bool IsActive() const { return Capture != nullptr; }
+
+	/// Replace the primitives drawn into the mask
+	void SetPrimitives(const TArray<UPrimitiveComponent*>& Primitives);
+
+	/// Capture the mask this frame from Camera, covering the HMD's field of view in degrees (the camera's if zero), at
+	/// vr.Tunnelling.MaskScale of the game viewport's height. The capture is queued now, so it renders before this frame's views.
+	void Tick(const UCameraComponent* Camera, float HFov, float VFov);
+
+	/// The target the mask is drawn into, or null before the first Tick
+	UTextureRenderTarget2D* GetTarget() const { return Target; }
+
+	/// World to clip space of the last capture, for reprojecting the view's pixels into the mask
+	const FMatrix& GetWorldToClip() const { return WorldToClip; }
+
+private:
+	UPROPERTY(Transient)
+	USceneCaptureComponent2D* Capture = nullptr;
+
+	UPROPERTY(Transient)
+	UTextureRenderTarget2D* Target = nullptr;
+
+	FMatrix WorldToClip = FMatrix::Identity;
+};
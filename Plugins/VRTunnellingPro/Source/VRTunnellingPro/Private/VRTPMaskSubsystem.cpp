@@ -0,0 +1,256 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPMaskSubsystem.h"
+#include "Components/PrimitiveComponent.h"
+#include "VRTPMask.h"
+#include "VRTPStats.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Mask Proxy Updates"), STAT_VRTP_MaskProxyUpdates, STATGROUP_VRTunnelling);
+
+DEFINE_LOG_CATEGORY_STATIC(LogVRTPMask, Log, All);
+
+namespace {
+	/// Whether an index can be combined with others in a shared mask
+	bool IsSingleBit(int32 StencilIndex)
+	{
+		return StencilIndex > 0 && FMath::IsPowerOfTwo(StencilIndex);
+	}
+} // anonymous namespace
+
+bool UVRTPMaskSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UVRTPMaskSubsystem::RegisterMask(UVRTPMask* Mask)
+{
+	if (Mask == nullptr || Masks.Contains(Mask))
+	{
+		return;
+	}
+
+	Masks.Add(Mask);
+	UpdateMask(Mask);
+}
+
+void UVRTPMaskSubsystem::UnregisterMask(UVRTPMask* Mask)
+{
+	if (Masks.RemoveSwap(Mask) > 0)
+	{
+		OnMasksChanged.Broadcast();
+	}
+}
+
+void UVRTPMaskSubsystem::ApplyStencil(const UObject* Applier, int32 StencilIndex, int32 Layers, bool bRenderCustomDepth)
+{
+	FVRTPMaskApplier& Settings = Appliers.FindOrAdd(Applier);
+	// Primitives store the value clamped, so an unclamped one would never compare equal
+	Settings.StencilIndex = FMath::Clamp(StencilIndex, 0, 255);
+	Settings.Layers = Layers;
+	Settings.bRenderCustomDepth = bRenderCustomDepth;
+
+	if (!IsSingleBit(Settings.StencilIndex) && Settings.StencilIndex != 0)
+	{
+		for (const TPair<const UObject*, FVRTPMaskApplier>& Other : Appliers)
+		{
+			if (Other.Key != Applier && (Other.Value.Layers & Layers) != 0 && Other.Value.StencilIndex != Settings.StencilIndex)
+			{
+				UE_LOG(LogVRTPMask, Warning, TEXT("%s shares mask layers with %s, but its stencil index %d is not a single bit (1, 2, 4...); it is left out of the masks they share"),
+					*GetNameSafe(Applier), *GetNameSafe(Other.Key), Settings.StencilIndex);
+				break;
+			}
+		}
+	}
+
+	UpdateAllMasks();
+	OnMasksChanged.Broadcast();
+}
+
+void UVRTPMaskSubsystem::RemoveApplier(const UObject* Applier)
+{
+	if (Appliers.Remove(Applier) > 0)
+	{
+		UpdateAllMasks();
+		OnMasksChanged.Broadcast();
+	}
+}
+
+void UVRTPMaskSubsystem::UpdateMask(const UVRTPMask* Mask)
+{
+	// Nothing has applied any settings yet, so leave the primitives as they were authored
+	if (Appliers.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<TPair<UPrimitiveComponent*, FPrimitiveState>> Changed;
+	GatherChanged(Mask, GetMaskState(Mask), Changed);
+	UpdatePrimitives(Changed);
+
+	// A new mask or new layers may change which masks are shared
+	OnMasksChanged.Broadcast();
+}
+
+void UVRTPMaskSubsystem::UpdateMask(const UVRTPMask* Mask, const TArray<UPrimitiveComponent*>& PreviousPrimitives)
+{
+	if (Appliers.Num() == 0 || Mask == nullptr)
+	{
+		return;
+	}
+
+	TArray<TPair<UPrimitiveComponent*, FPrimitiveState>> Changed;
+	GatherChanged(Mask, GetMaskState(Mask), Changed);
+
+	TArray<UPrimitiveComponent*> CurrentPrimitives;
+	Mask->GetMaskedPrimitives(CurrentPrimitives);
+	const FPrimitiveState Unmasked;
+	for (UPrimitiveComponent* Primitive : PreviousPrimitives)
+	{
+		if (IsValid(Primitive) && !CurrentPrimitives.Contains(Primitive) && !IsState(Primitive, Unmasked))
+		{
+			Changed.Emplace(Primitive, Unmasked);
+		}
+	}
+	UpdatePrimitives(Changed);
+
+	// Mask captures draw the new primitives instead
+	OnMasksChanged.Broadcast();
+}
+
+FVRTPStencilMatch UVRTPMaskSubsystem::GetStencilMatch(const UObject* Applier) const
+{
+	FVRTPStencilMatch Match;
+	const FVRTPMaskApplier* Settings = Appliers.Find(Applier);
+	if (Settings == nullptr)
+	{
+		return Match;
+	}
+	Match.MaterialStencil = Settings->StencilIndex;
+
+	// Index 0 marks the unmasked pixels, which hold no bits to share
+	if (Settings->StencilIndex == 0)
+	{
+		return Match;
+	}
+
+	// The material can only match one value exactly, so it uses the shared value only when every mask of Applier holds it.
+	// With partly overlapping layers, some masks hold only Applier's own bit and the material keeps matching that instead.
+	int32 CommonValue = INDEX_NONE;
+	bool bCommon = true;
+	for (const UVRTPMask* Mask : Masks)
+	{
+		if (Mask == nullptr || (Mask->Layers & Settings->Layers) == 0)
+		{
+			continue;
+		}
+
+		const int32 Value = GetMaskState(Mask).StencilValue;
+		Match.bShared |= Value != Settings->StencilIndex;
+		bCommon &= CommonValue == INDEX_NONE || CommonValue == Value;
+		CommonValue = Value;
+	}
+	if (Match.bShared && bCommon)
+	{
+		Match.MaterialStencil = CommonValue;
+	}
+	return Match;
+}
+
+void UVRTPMaskSubsystem::GetMaskedPrimitives(int32 Layers, TArray<UPrimitiveComponent*>& OutPrimitives) const
+{
+	for (const UVRTPMask* Mask : Masks)
+	{
+		if (Mask != nullptr && (Mask->Layers & Layers) != 0)
+		{
+			Mask->GetMaskedPrimitives(OutPrimitives);
+		}
+	}
+}
+
+void UVRTPMaskSubsystem::UpdateAllMasks()
+{
+	TArray<TPair<UPrimitiveComponent*, FPrimitiveState>> Changed;
+	for (const UVRTPMask* Mask : Masks)
+	{
+		GatherChanged(Mask, GetMaskState(Mask), Changed);
+	}
+	UpdatePrimitives(Changed);
+}
+
+UVRTPMaskSubsystem::FPrimitiveState UVRTPMaskSubsystem::GetMaskState(const UVRTPMask* Mask) const
+{
+	FPrimitiveState State;
+	int32 SingleBits = 0;
+	bool bSameIndex = true;
+	bool bFirst = true;
+	for (const TPair<const UObject*, FVRTPMaskApplier>& Applier : Appliers)
+	{
+		if ((Applier.Value.Layers & Mask->Layers) != 0)
+		{
+			bSameIndex &= bFirst || State.StencilValue == Applier.Value.StencilIndex;
+			bFirst = false;
+			State.StencilValue = Applier.Value.StencilIndex;
+			SingleBits |= IsSingleBit(Applier.Value.StencilIndex) ? Applier.Value.StencilIndex : 0;
+			State.bRenderCustomDepth |= Applier.Value.bRenderCustomDepth;
+		}
+	}
+
+	// Masks shared by components with different indices combine single bits only; another index would set bits of other components
+	if (!bSameIndex)
+	{
+		State.StencilValue = SingleBits;
+	}
+
+	// A value of a single bit is written on its own, so overlapping masks of other layers keep their bits. A primitive has
+	// one write mask, so a mask shared by several components writes all bits, like any nearer surface.
+	if (IsSingleBit(State.StencilValue))
+	{
+		State.WriteMask = (ERendererStencilMask)((int32)ERendererStencilMask::ERSM_1 + FMath::FloorLog2(State.StencilValue));
+	}
+	return State;
+}
+
+void UVRTPMaskSubsystem::GatherChanged(const UVRTPMask* Mask, const FPrimitiveState& State, TArray<TPair<UPrimitiveComponent*, FPrimitiveState>>& OutChanged) const
+{
+	if (Mask == nullptr)
+	{
+		return;
+	}
+
+	TArray<UPrimitiveComponent*> Primitives;
+	Mask->GetMaskedPrimitives(Primitives);
+	for (UPrimitiveComponent* Primitive : Primitives)
+	{
+		if (!IsState(Primitive, State))
+		{
+			OutChanged.Emplace(Primitive, State);
+		}
+	}
+}
+
+bool UVRTPMaskSubsystem::IsState(const UPrimitiveComponent* Primitive, const FPrimitiveState& State)
+{
+	return Primitive->CustomDepthStencilValue == State.StencilValue
+		&& Primitive->CustomDepthStencilWriteMask == State.WriteMask
+		&& (bool)Primitive->bRenderCustomDepth == State.bRenderCustomDepth;
+}
+
+void UVRTPMaskSubsystem::UpdatePrimitives(const TArray<TPair<UPrimitiveComponent*, FPrimitiveState>>& Changed) const
+{
+	// Each setter only marks the render state dirty when its value changes, and dirty primitives are all updated together
+	// at the end of the frame, so a primitive is updated once however many of its settings changed
+	for (const TPair<UPrimitiveComponent*, FPrimitiveState>& Update : Changed)
+	{
+		Update.Key->SetCustomDepthStencilValue(Update.Value.StencilValue);
+		Update.Key->SetCustomDepthStencilWriteMask(Update.Value.WriteMask);
+		Update.Key->SetRenderCustomDepth(Update.Value.bRenderCustomDepth);
+	}
+	INC_DWORD_STAT_BY(STAT_VRTP_MaskProxyUpdates, Changed.Num());
+}
+
+void UVRTPMaskSubsystem::Deinitialize()
+{
+	Masks.Reset();
+	Appliers.Reset();
+	OnMasksChanged.Clear();
+	Super::Deinitialize();
+}
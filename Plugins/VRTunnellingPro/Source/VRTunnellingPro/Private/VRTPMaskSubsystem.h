@@ -0,0 +1,108 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "VRTPMaskSubsystem.generated.h"
+
+class UPrimitiveComponent;
+class UVRTPMask;
+
+/// Stencil settings one tunnelling component applies to the masks sharing one of its layers
+struct FVRTPMaskApplier
+{
+	int32 StencilIndex = 0;
+	int32 Layers = 0;
+	bool bRenderCustomDepth = false;
+};
+
+/// How a tunnelling component should recognise its masks in the custom stencil
+struct FVRTPStencilMatch
+{
+	/// Value the post process material matches exactly: the component's own index, or the bits every one of its masks holds
+	/// when they are all shared with the same components
+	int32 MaterialStencil = 0;
+
+	/// Whether any of its masks is shared with another component, so holds other bits; the native pass then tests only its own
+	bool bShared = false;
+};
+
+/// Registry of the VRTPMask components in a world. Masks register themselves when they begin play, so applying the stencil
+/// settings only visits masked actors rather than every actor in the world, and masks spawned or streamed in later are given
+/// the current settings as soon as they register.
+///
+/// Several tunnelling components can share the registry. Each masked primitive gets the bitwise OR of the stencil indices of
+/// the components sharing a layer with its mask, and renders custom depth if any of them needs it. Only single-bit indices are
+/// combined; a component with any other index is left out of masks it shares with other indices, with a warning.
+UCLASS()
+class UVRTPMaskSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/// Add Mask to the registry, applying the current settings to its primitives if any have been applied yet
+	void RegisterMask(UVRTPMask* Mask);
+
+	/// Remove Mask from the registry. Its primitives keep the settings last applied to them.
+	void UnregisterMask(UVRTPMask* Mask);
+
+	/// Set the stencil settings of Applier (a tunnelling component) and update every registered mask.
+	/// Only primitives whose settings differ are touched; the number updated is counted in "stat VRTunnelling".
+	void ApplyStencil(const UObject* Applier, int32 StencilIndex, int32 Layers, bool bRenderCustomDepth);
+
+	/// Remove the settings of Applier, once it ends play, and update every registered mask
+	void RemoveApplier(const UObject* Applier);
+
+	/// Update the primitives of one registered mask after its layers have changed
+	void UpdateMask(const UVRTPMask* Mask);
+
+	/// Update the primitives of one registered mask after its filters have changed, resetting those of PreviousPrimitives it no
+	/// longer covers to unmasked. Each primitive is updated once, with its final settings.
+	void UpdateMask(const UVRTPMask* Mask, const TArray<UPrimitiveComponent*>& PreviousPrimitives);
+
+	/// How Applier should recognise the stencil values its masks hold
+	FVRTPStencilMatch GetStencilMatch(const UObject* Applier) const;
+
+	/// Add the primitives of every registered mask in any of Layers to OutPrimitives, for a mask capture to draw
+	void GetMaskedPrimitives(int32 Layers, TArray<UPrimitiveComponent*>& OutPrimitives) const;
+
+	/// Broadcast once any component's settings or any mask's layers or filters have changed, or masks have come or gone, so
+	/// every component can refresh its stencil match and mask capture
+	FSimpleMulticastDelegate OnMasksChanged;
+
+	virtual void Deinitialize() override;
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+private:
+	/// Custom depth settings of a masked primitive
+	struct FPrimitiveState
+	{
+		int32 StencilValue = 0;
+		ERendererStencilMask WriteMask = ERendererStencilMask::ERSM_Default;
+		bool bRenderCustomDepth = false;
+	};
+
+	/// The settings every primitive of Mask should have, from the appliers sharing its layers
+	FPrimitiveState GetMaskState(const UVRTPMask* Mask) const;
+
+	/// Whether Primitive already has the settings of State
+	static bool IsState(const UPrimitiveComponent* Primitive, const FPrimitiveState& State);
+
+	/// Add the primitives of Mask whose settings differ from State to OutChanged
+	void GatherChanged(const UVRTPMask* Mask, const FPrimitiveState& State, TArray<TPair<UPrimitiveComponent*, FPrimitiveState>>& OutChanged) const;
+
+	/// Give each primitive in Changed its settings
+	void UpdatePrimitives(const TArray<TPair<UPrimitiveComponent*, FPrimitiveState>>& Changed) const;
+
+	/// Update the primitives of every registered mask
+	void UpdateAllMasks();
+
+	UPROPERTY()
+	TArray<UVRTPMask*> Masks;
+
+	// Settings of each tunnelling component that has applied them, keyed by component; only compared, never dereferenced
+	TMap<const UObject*, FVRTPMaskApplier> Appliers;
+};
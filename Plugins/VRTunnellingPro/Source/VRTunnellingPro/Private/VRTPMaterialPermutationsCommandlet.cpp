@@ -0,0 +1,264 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPMaterialPermutationsCommandlet.h"
+#include "VRTP.h"
+#include "VRTPMobile.h"
+#include "VRTPPermutations.h"
+
+#if WITH_EDITOR
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "Materials/Material.h"
+#include "Materials/MaterialInstanceConstant.h"
+#include "Misc/PackageName.h"
+#include "StaticParameterSet.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+#endif
+
+DEFINE_LOG_CATEGORY_STATIC(LogVRTPMaterialPermutations, Log, All);
+
+#if WITH_EDITOR
+namespace {
+	/// The effect material of a desktop or mobile preset, and the permutations it needs
+	struct FPresetMaterial
+	{
+		UMaterial* Material = nullptr;
+		TArray<int32> Keys;
+		TSoftObjectPtr<UVRTPMaterialPermutations>* Permutations = nullptr;
+	};
+
+	void AddKeys(uint8 NumBackgroundModes, uint8 BackgroundMode, uint8 MaskMode, bool bApplyEffectColor, bool bCubeMapOverride, bool bAll, TArray<int32>& OutKeys)
+	{
+		if (bAll)
+		{
+			for (uint8 Background = 0; Background < NumBackgroundModes; ++Background)
+			{
+				for (uint8 Mask = 0; Mask < 4; ++Mask)
+				{
+					for (int32 Flags = 0; Flags < 4; ++Flags)
+					{
+						OutKeys.AddUnique(FVRTPMaterialPermutation::MakeKey(Background, Mask, (Flags & 1) != 0, (Flags & 2) != 0));
+					}
+				}
+			}
+			return;
+		}
+
+		// The preset's own modes, and the colour background used until the component is ready
+		OutKeys.AddUnique(FVRTPMaterialPermutation::MakeKey(BackgroundMode, MaskMode, bApplyEffectColor, bCubeMapOverride));
+		OutKeys.AddUnique(FVRTPMaterialPermutation::MakeKey(0, MaskMode, bApplyEffectColor, false));
+	}
+
+	bool GetPresetMaterial(UObject* Object, bool bAll, FPresetMaterial& Out)
+	{
+		if (UVRTPPresetData* Preset = Cast<UVRTPPresetData>(Object))
+		{
+			const FVRTPPreset& Data = Preset->Data;
+			Out.Material = Data.PostProcessMaterial.LoadSynchronous();
+			AddKeys(3, (uint8)Data.BackgroundMode, (uint8)Data.MaskMode, Data.ApplyEffectColor, !Data.CubeMapOverride.IsNull() || !Data.BakedSkybox.IsNull(), bAll, Out.Keys);
+			Out.Permutations = &Preset->Data.MaterialPermutations;
+			return true;
+		}
+		if (UVRTPMPresetData* Preset = Cast<UVRTPMPresetData>(Object))
+		{
+			const FVRTPMPreset& Data = Preset->Data;
+			Out.Material = Data.PostProcessMaterial.LoadSynchronous();
+			AddKeys(2, (uint8)Data.BackgroundMode, (uint8)Data.MaskMode, Data.ApplyEffectColor, !Data.CubeMapOverride.IsNull() || !Data.BakedSkybox.IsNull(), bAll, Out.Keys);
+			Out.Permutations = &Preset->Data.MaterialPermutations;
+			return true;
+		}
+		return false;
+	}
+
+	/// Whether Material has any of the static switches the permutations set; without them every permutation would compile the same shader
+	bool HasStaticSwitches(UMaterial* Material)
+	{
+		TArray<FMaterialParameterInfo> ParameterInfos;
+		TArray<FGuid> ParameterIds;
+		Material->GetAllParameterInfoOfType(EMaterialParameterType::StaticSwitch, ParameterInfos, ParameterIds);
+
+		TArray<TPair<FName, bool>> Switches;
+		FVRTPMaterialPermutation::GetStaticSwitches(0, Switches);
+		return Switches.ContainsByPredicate([&ParameterInfos](const TPair<FName, bool>& Switch)
+		{
+			return ParameterInfos.ContainsByPredicate([&Switch](const FMaterialParameterInfo& Info) { return Info.Name == Switch.Key; });
+		});
+	}
+
+	template<typename T>
+	T* LoadAsset(const FString& PackageName)
+	{
+		const FString ObjectPath = PackageName + TEXT(".") + FPackageName::GetShortName(PackageName);
+		return LoadObject<T>(nullptr, *ObjectPath, nullptr, LOAD_NoWarn | LOAD_Quiet);
+	}
+
+	bool SaveAssetPackage(UObject* Asset)
+	{
+		UPackage* Package = Asset->GetOutermost();
+		const FString Filename = FPackageName::LongPackageNameToFilename(Package->GetName(), FPackageName::GetAssetPackageExtension());
+		FSavePackageArgs SaveArgs;
+		SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+		return UPackage::SavePackage(Package, Asset, *Filename, SaveArgs);
+	}
+
+	/// The permutation table of Material, next to it, created if it does not exist yet
+	UVRTPMaterialPermutations* FindOrCreateTable(UMaterial* Material)
+	{
+		const FString PackageName = FPackageName::GetLongPackagePath(Material->GetOutermost()->GetName()) / (Material->GetName() + TEXT("_Permutations"));
+		UVRTPMaterialPermutations* Table = LoadAsset<UVRTPMaterialPermutations>(PackageName);
+		if (Table == nullptr)
+		{
+			UPackage* Package = CreatePackage(*PackageName);
+			Table = NewObject<UVRTPMaterialPermutations>(Package, FName(*FPackageName::GetShortName(PackageName)), RF_Public | RF_Standalone);
+			Table->BaseMaterial = Material;
+			FAssetRegistryModule::AssetCreated(Table);
+		}
+		return Table;
+	}
+} // anonymous namespace
+#endif
+
+UVRTPMaterialPermutationsCommandlet::UVRTPMaterialPermutationsCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+}
+
+int32 UVRTPMaterialPermutationsCommandlet::Main(const FString& Params)
+{
+#if WITH_EDITOR
+	FString Path = TEXT("/Game");
+	FParse::Value(*Params, TEXT("Path="), Path);
+	const bool bAll = FParse::Param(*Params, TEXT("All"));
+	const bool bForce = FParse::Param(*Params, TEXT("Force"));
+
+	IAssetRegistry& AssetRegistry = FModuleManager::LoadModuleChecked<FAssetRegistryModule>(TEXT("AssetRegistry")).Get();
+	AssetRegistry.SearchAllAssets(true);
+
+	FARFilter Filter;
+	Filter.PackagePaths.Add(FName(*Path));
+	Filter.bRecursivePaths = true;
+	Filter.ClassPaths.Add(UVRTPPresetData::StaticClass()->GetClassPathName());
+	Filter.ClassPaths.Add(UVRTPMPresetData::StaticClass()->GetClassPathName());
+	TArray<FAssetData> Assets;
+	AssetRegistry.GetAssets(Filter, Assets);
+
+	// Presets sharing an effect material share its table, and each permutation is generated at most once per run
+	TMap<UMaterial*, UVRTPMaterialPermutations*> Tables;
+	TSet<UMaterial*> SkippedMaterials;
+	TSet<FString> Generated;
+	int32 NumGenerated = 0;
+	int32 NumFailed = 0;
+	for (const FAssetData& Asset : Assets)
+	{
+		UObject* Object = Asset.GetAsset();
+		FPresetMaterial Preset;
+		if (!GetPresetMaterial(Object, bAll, Preset) || Preset.Material == NULL || SkippedMaterials.Contains(Preset.Material))
+		{
+			continue;
+		}
+		if (!HasStaticSwitches(Preset.Material))
+		{
+			UE_LOG(LogVRTPMaterialPermutations, Warning, TEXT("%s has none of the tunnelling static switches, skipping it"), *Preset.Material->GetPathName());
+			SkippedMaterials.Add(Preset.Material);
+			continue;
+		}
+
+		UVRTPMaterialPermutations*& Table = Tables.FindOrAdd(Preset.Material);
+		if (Table == NULL)
+		{
+			Table = FindOrCreateTable(Preset.Material);
+		}
+
+		bool bTableChanged = false;
+		for (const int32 Key : Preset.Keys)
+		{
+			FVRTPMaterialPermutation* Existing = Table->Permutations.FindByPredicate([Key](const FVRTPMaterialPermutation& Entry) { return Entry.Key == Key; });
+			const FString PackageName = FPackageName::GetLongPackagePath(Preset.Material->GetOutermost()->GetName())
+				/ FString::Printf(TEXT("MI_%s_%s"), *Preset.Material->GetName(), *FVRTPMaterialPermutation::GetKeyName(Key));
+			if ((Existing != NULL && Existing->Material != NULL && !bForce) || Generated.Contains(PackageName))
+			{
+				continue;
+			}
+
+			UMaterialInstanceConstant* Instance = CreatePermutation(Preset.Material, Key, PackageName);
+			if (Instance == NULL)
+			{
+				UE_LOG(LogVRTPMaterialPermutations, Error, TEXT("Failed to create %s"), *PackageName);
+				++NumFailed;
+				continue;
+			}
+			if (Existing == NULL)
+			{
+				Existing = &Table->Permutations.AddDefaulted_GetRef();
+				Existing->Key = Key;
+			}
+			Existing->Material = Instance;
+			Generated.Add(PackageName);
+			bTableChanged = true;
+			++NumGenerated;
+		}
+
+		if (bTableChanged)
+		{
+			Table->MarkPackageDirty();
+			if (!SaveAssetPackage(Table))
+			{
+				UE_LOG(LogVRTPMaterialPermutations, Error, TEXT("Failed to save %s"), *Table->GetPathName());
+				++NumFailed;
+				continue;
+			}
+		}
+
+		if (Preset.Permutations->Get() != Table)
+		{
+			*Preset.Permutations = Table;
+			Object->MarkPackageDirty();
+			if (!SaveAssetPackage(Object))
+			{
+				UE_LOG(LogVRTPMaterialPermutations, Error, TEXT("Failed to save %s"), *Asset.GetObjectPathString());
+				++NumFailed;
+				continue;
+			}
+		}
+		UE_LOG(LogVRTPMaterialPermutations, Display, TEXT("%s uses %s"), *Asset.GetObjectPathString(), *Table->GetPathName());
+	}
+
+	UE_LOG(LogVRTPMaterialPermutations, Display, TEXT("Generated %d permutation(s) for %d preset(s), %d failure(s)"), NumGenerated, Assets.Num(), NumFailed);
+	return NumFailed > 0 ? 1 : 0;
+#else
+	UE_LOG(LogVRTPMaterialPermutations, Error, TEXT("Material permutations can only be generated by the editor"));
+	return 1;
+#endif
+}
+
+#if WITH_EDITOR
+UMaterialInstanceConstant* UVRTPMaterialPermutationsCommandlet::CreatePermutation(UMaterial* Material, int32 Key, const FString& PackageName)
+{
+	// An instance left by an earlier run is updated in place
+	UMaterialInstanceConstant* Instance = LoadAsset<UMaterialInstanceConstant>(PackageName);
+	if (Instance == NULL)
+	{
+		UPackage* Package = CreatePackage(*PackageName);
+		Instance = NewObject<UMaterialInstanceConstant>(Package, FName(*FPackageName::GetShortName(PackageName)), RF_Public | RF_Standalone);
+		FAssetRegistryModule::AssetCreated(Instance);
+	}
+	Instance->SetParentEditorOnly(Material);
+
+	TArray<TPair<FName, bool>> Switches;
+	FVRTPMaterialPermutation::GetStaticSwitches(Key, Switches);
+	FStaticParameterSet StaticParameters;
+	for (const TPair<FName, bool>& Switch : Switches)
+	{
+		FStaticSwitchParameter& Parameter = StaticParameters.StaticSwitchParameters.AddDefaulted_GetRef();
+		Parameter.ParameterInfo = FMaterialParameterInfo(Switch.Key);
+		Parameter.Value = Switch.Value;
+		Parameter.bOverride = true;
+	}
+	Instance->UpdateStaticPermutation(StaticParameters);
+	Instance->PostEditChange();
+
+	return SaveAssetPackage(Instance) ? Instance : NULL;
+}
+#endif
@@ -0,0 +1,31 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "VRTPMaterialPermutationsCommandlet.generated.h"
+
+class UMaterial;
+class UMaterialInstanceConstant;
+
+/// Generates static-switch instances of the effect material of every desktop and mobile preset, and stores them as the preset's Material Permutations.
+/// Run it before cooking:
+///   UnrealEditor-Cmd <Project>.uproject -run=VRTPMaterialPermutations [-Path=/Game] [-All] [-Force]
+/// By default each preset gets the instance for its own modes, plus the colour background it shows while initialising. -All generates every
+/// combination the preset could switch to at runtime. Existing instances are kept unless -Force is given. The effect material needs the static
+/// switch parameters listed by FVRTPMaterialPermutation::GetStaticSwitches; materials without any of them are skipped.
+UCLASS()
+class UVRTPMaterialPermutationsCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UVRTPMaterialPermutationsCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+#if WITH_EDITOR
+	/// Create, or update if it already exists, the instance of Material with the static switches of Key set, and save its package
+	static UMaterialInstanceConstant* CreatePermutation(UMaterial* Material, int32 Key, const FString& PackageName);
+#endif
+};
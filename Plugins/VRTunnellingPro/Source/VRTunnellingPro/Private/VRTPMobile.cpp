@@ -5,9 +5,14 @@
 #include "Materials/MaterialInstanceDynamic.h"
 #include "Kismet/KismetMathLibrary.h"
 #include "Kismet/GameplayStatics.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerController.h"
 #include "Components/StaticMeshComponent.h"
 #include "Engine/TextureCube.h"
-#include "VRTPMask.h"
+#include "VRTPMaskSubsystem.h"
+#include "VRTPMotionSubsystem.h"
+#include "VRTPCaptureSubsystem.h"
+#include "VRTPScalability.h"
 
 UVRTunnellingProMobile::UVRTunnellingProMobile()
 {
@@ -16,6 +21,7 @@ UVRTunnellingProMobile::UVRTunnellingProMobile()
 	PrimaryComponentTick.TickGroup = TG_PrePhysics;
 	PrimaryComponentTick.bTickEvenWhenPaused = true;
 
+	MaskLayers = 0xFF;
 	bAutoActivate = true;
 	bWantsInitializeComponent = true;
 }
@@ -30,7 +36,11 @@ void UVRTunnellingProMobile::CacheSettings()
 {
 	SkyboxBlueprintSwap = SkyboxBlueprint;
 	CubeMapOverrideSwap = CubeMapOverride;
+	CaptureSettingsSwap = CaptureSettings;
+	BakedSkyboxSwap = BakedSkybox;
 	PostProcessMaterialSwap = PostProcessMaterial;
+	MaterialPermutationsSwap = MaterialPermutations;
+	ParameterCollectionSwap = ParameterCollection;
 	EffectColorSwap = EffectColor;
 	EffectCoverageSwap = EffectCoverage;
 	EffectFeatherSwap = EffectFeather;
@@ -54,6 +64,8 @@ void UVRTunnellingProMobile::CacheSettings()
 	AccelerationMinSwap = AccelerationMin;
 	AccelerationMaxSwap = AccelerationMax;
 	AccelerationSmoothingSwap = AccelerationSmoothing;
+	SmoothingModeSwap = SmoothingMode;
+	SmoothingBetaSwap = SmoothingBeta;
 }
 
 void UVRTunnellingProMobile::InitFromPreset()
@@ -69,7 +81,11 @@ void UVRTunnellingProMobile::InitFromPreset()
 	{
 		SkyboxBlueprint = SkyboxBlueprintSwap;
 		CubeMapOverride = CubeMapOverrideSwap;
+		CaptureSettings = CaptureSettingsSwap;
+		BakedSkybox = BakedSkyboxSwap;
 		PostProcessMaterial = PostProcessMaterialSwap;
+		MaterialPermutations = MaterialPermutationsSwap;
+		ParameterCollection = ParameterCollectionSwap;
 		EffectColor = EffectColorSwap;
 		EffectCoverage = EffectCoverageSwap;
 		EffectFeather = EffectFeatherSwap;
@@ -93,6 +109,8 @@ void UVRTunnellingProMobile::InitFromPreset()
 		AccelerationMin = AccelerationMinSwap;
 		AccelerationMax = AccelerationMaxSwap;
 		AccelerationSmoothing = AccelerationSmoothingSwap;
+		SmoothingMode = SmoothingModeSwap;
+		SmoothingBeta = SmoothingBetaSwap;
 	}
 }
 
@@ -103,7 +121,11 @@ void UVRTunnellingProMobile::SetPresetData(UVRTPMPresetData* NewPreset)
 		Preset = NewPreset;
 		SkyboxBlueprint			= Preset->Data.SkyboxBlueprint;
 		CubeMapOverride			= Preset->Data.CubeMapOverride;
+		CaptureSettings			= Preset->Data.CaptureSettings;
+		BakedSkybox				= Preset->Data.BakedSkybox;
 		PostProcessMaterial		= Preset->Data.PostProcessMaterial;
+		MaterialPermutations	= Preset->Data.MaterialPermutations;
+		ParameterCollection		= Preset->Data.ParameterCollection;
 		EffectColor				= Preset->Data.EffectColor;
 		EffectCoverage			= Preset->Data.EffectCoverage;
 		EffectFeather			= Preset->Data.EffectFeather;
@@ -127,6 +149,8 @@ void UVRTunnellingProMobile::SetPresetData(UVRTPMPresetData* NewPreset)
 		AccelerationMin			= Preset->Data.AccelerationMin;
 		AccelerationMax			= Preset->Data.AccelerationMax;
 		AccelerationSmoothing	= Preset->Data.AccelerationSmoothing;
+		SmoothingMode			= Preset->Data.SmoothingMode;
+		SmoothingBeta			= Preset->Data.SmoothingBeta;
 	}
 }
 
@@ -135,6 +159,8 @@ void UVRTunnellingProMobile::UpdateEffectSettings()
 {
 	if (PostProcessMID)
 	{
+		SelectPermutation();
+		ParameterBlock.SetCollection(ParameterCollection ? GetWorld()->GetParameterCollectionInstance(ParameterCollection) : nullptr, GetLocalPlayerIndex());
 		ApplyBackgroundMode();
 		ApplyMaskMode();
 		ApplyColor(ApplyEffectColor);
@@ -147,11 +173,17 @@ void UVRTunnellingProMobile::ApplyPreset(UVRTPMPresetData* NewPreset)
 {
 	if (NewPreset)
 	{
-		SetPresetData(NewPreset);
-		if (CaptureInit) 
+		// Before the assets are first requested, the stages pick the preset up as they run
+		if (InitStage == EVRTPInitStage::LoadAssets)
 		{
-			UpdateEffectSettings();
+			SetPresetData(NewPreset);
+			return;
 		}
+
+		// Otherwise the current assets stay in use until the new preset's have streamed in, and it is applied then
+		PendingPreset = NewPreset;
+		RequestAssets();
+		bSettingsPending = true;
 	}
 }
 
@@ -159,7 +191,28 @@ void UVRTunnellingProMobile::ApplyPreset(UVRTPMPresetData* NewPreset)
 void UVRTunnellingProMobile::BeginPlay()
 {
 	Super::BeginPlay();
-	CaptureInit = false;
+	InitStage = EVRTPInitStage::LoadAssets;
+	bSettingsPending = false;
+	PendingPreset = NULL;
+	ScalabilityGeneration = FVRTPScalability::GetGeneration();
+}
+
+void UVRTunnellingProMobile::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	ReleaseMotionInstance();
+
+	// Masks shared with other tunnelling components keep only their stencil bits
+	if (UVRTPMaskSubsystem* MaskSubsystem = GetWorld()->GetSubsystem<UVRTPMaskSubsystem>())
+	{
+		MaskSubsystem->OnMasksChanged.Remove(MasksChangedHandle);
+		MasksChangedHandle.Reset();
+		MaskSubsystem->RemoveApplier(this);
+	}
+
+	ReleaseCapture();
+	AssetLoader.Release();
+
+	Super::EndPlay(EndPlayReason);
 }
 
 // Called every frame
@@ -167,35 +220,58 @@ void UVRTunnellingProMobile::TickComponent(float DeltaTime, ELevelTick TickType,
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 
-	if (!CaptureInit)
+	// Nothing that uses the soft asset references runs while they are streaming in
+	AssetLoader.Update();
+	if (AssetLoader.IsLoaded())
 	{
-		CaptureInit = true;
-		if (!CubeMapOverride)
+		if (PendingPreset != NULL)
 		{
-			InitCapture();
-			InitSkybox();
+			SetPresetData(PendingPreset);
+			PendingPreset = NULL;
+		}
+
+		if (InitStage != EVRTPInitStage::Ready)
+		{
+			do
+			{
+				AdvanceInit();
+			} while (InitStage != EVRTPInitStage::Ready && !FVRTPAssetLoader::IsAsync());
+		}
+		else
+		{
+			if (ScalabilityGeneration != FVRTPScalability::GetGeneration())
+			{
+				ScalabilityGeneration = FVRTPScalability::GetGeneration();
+				ApplyScalability();
+			}
+			if (bSettingsPending)
+			{
+				bSettingsPending = false;
+				UpdateEffectSettings();
+			}
+			UpdateCaptureResources(DeltaTime);
 		}
-		InitIris();
-		UpdateEffectSettings();
 	}
 
+	const FVRTPMotionSample Sample = GatherMotionSample();
+
+	// Staged once for the post process and iris materials alike
 	if (PostProcessMID)
 	{
-		CalculateMotion(DeltaTime);
-		PostProcessMID->SetVectorParameterValue(FName("Up"), GetOwner()->GetActorUpVector());
-		PostProcessMID->SetVectorParameterValue(FName("Right"), GetOwner()->GetActorRightVector());
-		PostProcessMID->SetVectorParameterValue(FName("Forward"), GetOwner()->GetActorForwardVector());
+		CalculateMotion(Sample, DeltaTime);
 	}
-
-	if (IrisOuterMID && IrisInnerMID)
+	ParameterBlock.SetVector(EVRTPVectorParameter::Up, Sample.Up);
+	ParameterBlock.SetVector(EVRTPVectorParameter::Right, Sample.Right);
+	ParameterBlock.SetVector(EVRTPVectorParameter::Forward, Sample.Forward);
+	if (!bMotionPending)
 	{
-		IrisOuterMID->SetVectorParameterValue(FName("Up"), GetOwner()->GetActorUpVector());
-		IrisOuterMID->SetVectorParameterValue(FName("Right"), GetOwner()->GetActorRightVector());
-		IrisOuterMID->SetVectorParameterValue(FName("Forward"), GetOwner()->GetActorForwardVector());
+		ParameterBlock.Flush();
+	}
 
-		IrisInnerMID->SetVectorParameterValue(FName("Up"), GetOwner()->GetActorUpVector());
-		IrisInnerMID->SetVectorParameterValue(FName("Right"), GetOwner()->GetActorRightVector());
-		IrisInnerMID->SetVectorParameterValue(FName("Forward"), GetOwner()->GetActorForwardVector());
+	// Keep a live capture current while the skybox is on screen
+	if (LiveCapture.IsActive() && BackgroundMode == EVRTPMBackgroundMode::MM_SKYBOX && !IdleGate.bIdle)
+	{
+		LiveCapture.Tick(GetOwner()->GetActorQuat(), SceneCaptureCube->GetForwardVector());
 	}
 
 }
@@ -224,86 +300,429 @@ void UVRTunnellingProMobile::PostEditChangeProperty(FPropertyChangedEvent& Prope
 
 //*************************************************************
 
-void UVRTunnellingProMobile::InitCapture()
+void UVRTunnellingProMobile::AdvanceInit()
 {
-	// Initialise Cube Capture
-	SceneCaptureCube = NewObject<USceneCaptureComponentCube>(GetOwner());
-
-	TC = NewObject<UTextureRenderTargetCube>();
-	TC->ClearColor = FLinearColor::Black;
-	TC->bHDR = false;
-	TC->InitAutoFormat(1024);
-
-	SceneCaptureCube->TextureTarget = TC;
-	SceneCaptureCube->bCaptureOnMovement = false;
-	SceneCaptureCube->bCaptureEveryFrame = false;
-	SceneCaptureCube->bAutoActivate = true;
-	SceneCaptureCube->CaptureStereoPass = EStereoscopicPass::eSSP_FULL;
-
-	SceneCaptureCube->ShowFlags.SetAntiAliasing(false);
-	SceneCaptureCube->ShowFlags.SetAtmosphere(false);
-	SceneCaptureCube->ShowFlags.SetBloom(false);
-	SceneCaptureCube->ShowFlags.SetBSP(false);
-	SceneCaptureCube->ShowFlags.SetDeferredLighting(false);
-	SceneCaptureCube->ShowFlags.SetEyeAdaptation(true);
-	SceneCaptureCube->ShowFlags.SetFog(false);
-	SceneCaptureCube->ShowFlags.SetVolumetricFog(false);
+	switch (InitStage)
+	{
+		case EVRTPInitStage::LoadAssets:
+			RequestAssets();
+			InitStage = EVRTPInitStage::CreateMaterials;
+			break;
+
+		case EVRTPInitStage::CreateMaterials:
+			StartWarmup();
+			InitCapture();
+			InitStage = EVRTPInitStage::CreateIris;
+			break;
+
+		case EVRTPInitStage::CreateIris:
+			InitIris();
+			InitStage = EVRTPInitStage::AllocateCapture;
+			break;
 
+		case EVRTPInitStage::AllocateCapture:
+			UpdateCaptureResources(0.0f);
+			InitStage = EVRTPInitStage::WarmUp;
+			break;
+
+		case EVRTPInitStage::WarmUp:
+			if (UVRTPWarmupSubsystem* Warmup = GetWorld()->GetSubsystem<UVRTPWarmupSubsystem>())
+			{
+				if (!Warmup->IsIdle())
+				{
+					break;
+				}
+			}
+			InitStage = EVRTPInitStage::Ready;
+
+			// Swap the colour fallback for the real background
+			bSettingsPending = false;
+			UpdateEffectSettings();
+			OnTunnellingReady.Broadcast();
+			break;
+
+		default:
+			InitStage = EVRTPInitStage::Ready;
+			break;
+	}
+}
+
+void UVRTunnellingProMobile::RequestAssets()
+{
+	// A preset waiting to be applied is loaded in place of the current settings, whose assets stay loaded until it arrives
+	TArray<FSoftObjectPath> Paths;
+	if (PendingPreset != NULL)
+	{
+		const FVRTPMPreset& Data = PendingPreset->Data;
+		Paths = {
+			Data.SkyboxBlueprint.ToSoftObjectPath(),
+			Data.CubeMapOverride.ToSoftObjectPath(),
+			Data.BakedSkybox.ToSoftObjectPath(),
+			Data.PostProcessMaterial.ToSoftObjectPath(),
+			Data.MaterialPermutations.ToSoftObjectPath(),
+			Data.IrisMesh.ToSoftObjectPath()
+		};
+	}
+	else
+	{
+		Paths = {
+			SkyboxBlueprint.ToSoftObjectPath(),
+			CubeMapOverride.ToSoftObjectPath(),
+			BakedSkybox.ToSoftObjectPath(),
+			PostProcessMaterial.ToSoftObjectPath(),
+			MaterialPermutations.ToSoftObjectPath(),
+			IrisMesh.ToSoftObjectPath()
+		};
+	}
+
+	// The warm-up presets' materials stay loaded too, so applying them later neither loads nor compiles anything
+	FVRTPWarmupSet Warmup;
+	GatherWarmup(Warmup);
+	Warmup.GetAssetPaths(Paths);
+	AssetLoader.Request(Paths);
+}
+
+void UVRTunnellingProMobile::GatherWarmup(FVRTPWarmupSet& OutWarmup) const
+{
+	// The current settings, the defaults a disabled preset restores, and every preset the component may apply
+	OutWarmup.AddMaterial(PostProcessMaterial, MaterialPermutations);
+	OutWarmup.AddMaterial(PostProcessMaterialSwap, MaterialPermutationsSwap);
+	if (Preset != NULL)
+	{
+		OutWarmup.AddMaterial(Preset->Data.PostProcessMaterial, Preset->Data.MaterialPermutations);
+	}
+	for (const UVRTPMPresetData* WarmupPreset : WarmupPresets)
+	{
+		if (WarmupPreset != NULL)
+		{
+			OutWarmup.AddMaterial(WarmupPreset->Data.PostProcessMaterial, WarmupPreset->Data.MaterialPermutations);
+		}
+	}
+}
+
+void UVRTunnellingProMobile::StartWarmup()
+{
+	UVRTPWarmupSubsystem* Subsystem = GetWorld()->GetSubsystem<UVRTPWarmupSubsystem>();
+	if (Subsystem == NULL || !UVRTPWarmupSubsystem::IsEnabled())
+	{
+		return;
+	}
+
+	FVRTPWarmupSet Warmup;
+	GatherWarmup(Warmup);
+
+	TArray<UMaterialInterface*> Materials;
+	Warmup.GetMaterials(Materials);
+	Subsystem->Warm(Materials, !FVRTPAssetLoader::IsAsync());
+}
+
+bool UVRTunnellingProMobile::IsTunnellingReady() const
+{
+	return InitStage == EVRTPInitStage::Ready;
+}
+
+EVRTPMBackgroundMode UVRTunnellingProMobile::GetActiveBackgroundMode() const
+{
+	// Colour needs no assets or capture, so it stands in until the component is ready, and for the skybox at low scalability
+	if (!IsTunnellingReady() || (BackgroundMode == EVRTPMBackgroundMode::MM_SKYBOX && FVRTPScalability::UseSkyboxFallback()))
+	{
+		return EVRTPMBackgroundMode::MM_COLOR;
+	}
+	return BackgroundMode;
+}
+
+EVRTPMMaskMode UVRTunnellingProMobile::GetActiveMaskMode() const
+{
+	return FVRTPScalability::AllowMasks() ? MaskMode : EVRTPMMaskMode::MM_OFF;
+}
+
+void UVRTunnellingProMobile::ApplyScalability()
+{
+	// Recapture at the new resolution; UpdateCaptureResources allocates it again if the background still needs it
+	if (TC != NULL && TC->SizeX != CaptureSettings.GetResolution())
+	{
+		ReleaseCapture();
+	}
+	UpdateCaptureResources(0.0f);
+	bSettingsPending = true;
+}
+
+void UVRTunnellingProMobile::InitCapture()
+{
+	// The cube capture itself is allocated by UpdateCaptureResources, once the background mode needs it
 	UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
 	if (PlayerCamera != NULL)
 	{
-		PostProcessMID = UMaterialInstanceDynamic::Create(PostProcessMaterial, this);
+		SelectPermutation();
 		PlayerCamera->PostProcessSettings.AddBlendable(PostProcessMID, 1.0f);
 		UpdateEffectSettings();
-		SceneCaptureCube->AttachToComponent(PlayerCamera, FAttachmentTransformRules::KeepRelativeTransform);
-		PostProcessMID->SetTextureParameterValue(FName("TC"), TC);
 	}
 }
 
+bool UVRTunnellingProMobile::SelectPermutation()
+{
+	// The static-switch instance for the active modes, or the effect material itself if there is none
+	UMaterialInterface* Source = PostProcessMaterial.Get();
+	if (const UVRTPMaterialPermutations* Permutations = MaterialPermutations.Get())
+	{
+		const int32 Key = FVRTPMaterialPermutation::MakeKey((uint8)GetActiveBackgroundMode(), (uint8)GetActiveMaskMode(), ApplyEffectColor, GetSkyboxCubeMap() != NULL);
+		if (UMaterialInterface* Permutation = Permutations->Find(Key))
+		{
+			Source = Permutation;
+		}
+	}
+	if (PostProcessMID != NULL && PostProcessMID->Parent == Source)
+	{
+		return false;
+	}
+
+	// Switching during gameplay compiles the material's on-screen pipeline state now
+	UVRTPWarmupSubsystem* Warmup = GetWorld()->GetSubsystem<UVRTPWarmupSubsystem>();
+	if (Warmup != NULL && IsTunnellingReady())
+	{
+		Warmup->NoteGameplayUse(Source);
+	}
+
+	UMaterialInstanceDynamic*& MID = PostProcessMIDs.FindOrAdd(Source);
+	if (MID == NULL)
+	{
+		MID = UMaterialInstanceDynamic::Create(Source, this);
+	}
+
+	if (PostProcessMID != NULL)
+	{
+		ParameterBlock.RemoveTarget(PostProcessMID);
+		UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
+		if (PlayerCamera != NULL)
+		{
+			PlayerCamera->PostProcessSettings.RemoveBlendable(PostProcessMID);
+		}
+	}
+	PostProcessMID = MID;
+	ParameterBlock.AddTarget(PostProcessMID);
+	PostProcessMID->SetTextureParameterValue(FName("TC"), TC);
+	return true;
+}
+
+void UVRTunnellingProMobile::UpdatePermutation()
+{
+	// A newly selected permutation needs the per-instance parameters and the blendable; the parameter block has already written the rest
+	if (PostProcessMID != NULL && SelectPermutation())
+	{
+		PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilMatch.MaterialStencil);
+		PostProcessMID->SetScalarParameterValue(FName("ApplyEffectColor"), (float)ApplyEffectColor);
+		ApplyBackgroundMode();
+		ApplyMaskMode();
+	}
+}
+
+void UVRTunnellingProMobile::UpdateCaptureResources(float DeltaTime)
+{
+	// Only the skybox background samples the capture, and not at all with a cube map override or baked skybox
+	const bool bNeeded = BackgroundMode == EVRTPMBackgroundMode::MM_SKYBOX && !FVRTPScalability::UseSkyboxFallback() && GetSkyboxCubeMap() == NULL;
+	switch (CaptureLifetime.Update(bNeeded, DeltaTime))
+	{
+		case FVRTPCaptureLifetime::EAction::Allocate:
+			AllocateCapture();
+			break;
+
+		case FVRTPCaptureLifetime::EAction::Release:
+			ReleaseCapture();
+			break;
+
+		default:
+			break;
+	}
+}
+
+void UVRTunnellingProMobile::AllocateCapture()
+{
+	UVRTPCaptureSubsystem* CaptureSubsystem = UVRTPCaptureSubsystem::GetShared(GetWorld());
+	if (CaptureSubsystem != NULL && SkyboxBlueprint.Get() != NULL && !CaptureSettings.bLiveCapture)
+	{
+		// Captured once and shared with every other component using the same skybox
+		TC = CaptureSubsystem->AcquireCapture(SkyboxBlueprint.Get(), CaptureSettings);
+		bSharedCapture = TC != NULL;
+	}
+	else
+	{
+		SceneCaptureCube = NewObject<USceneCaptureComponentCube>(GetOwner());
+
+		TC = CaptureSettings.CreateRenderTarget();
+
+		SceneCaptureCube->TextureTarget = TC;
+		FVRTPCaptureSettings::InitCaptureComponent(SceneCaptureCube);
+
+		UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
+		if (PlayerCamera != NULL)
+		{
+			SceneCaptureCube->AttachToComponent(PlayerCamera, FAttachmentTransformRules::KeepRelativeTransform);
+		}
+		InitSkybox();
+	}
+	BindCapture();
+}
+
+void UVRTunnellingProMobile::ReleaseCapture()
+{
+	CaptureLifetime.Reset();
+	LiveCapture.Release();
+
+	// Stop the materials sampling the capture before it is released
+	UTextureRenderTargetCube* Target = TC;
+	TC = NULL;
+	BindCapture();
+
+	if (bSharedCapture)
+	{
+		if (UVRTPCaptureSubsystem* CaptureSubsystem = GetWorld()->GetSubsystem<UVRTPCaptureSubsystem>())
+		{
+			CaptureSubsystem->ReleaseCapture(Target);
+		}
+		bSharedCapture = false;
+	}
+	else
+	{
+		FVRTPCaptureSettings::ReleaseRenderTarget(Target);
+	}
+
+	if (SceneCaptureCube != NULL)
+	{
+		SceneCaptureCube->DestroyComponent();
+		SceneCaptureCube = NULL;
+	}
+	if (Skybox != NULL)
+	{
+		Skybox->Destroy();
+		Skybox = NULL;
+		bSkyboxParked = false;
+	}
+}
+
+void UVRTunnellingProMobile::BindCapture()
+{
+	if (PostProcessMID) PostProcessMID->SetTextureParameterValue(FName("TC"), TC);
+	if (TC == NULL)
+	{
+		// Unused permutations are bound again when swapped in, but must not hold on to a released capture
+		for (const TPair<UMaterialInterface*, UMaterialInstanceDynamic*>& Entry : PostProcessMIDs)
+		{
+			if (Entry.Value) Entry.Value->SetTextureParameterValue(FName("TC"), NULL);
+		}
+	}
+	if (IrisOuterMID) IrisOuterMID->SetTextureParameterValue(FName("TC"), TC);
+	if (IrisInnerMID) IrisInnerMID->SetTextureParameterValue(FName("TC"), TC);
+}
+
 void UVRTunnellingProMobile::InitSkybox()
 {
-	if (SkyboxBlueprint != NULL)
+	if (SkyboxBlueprint.Get() != NULL && SceneCaptureCube != NULL)
+	{
+		CaptureSkybox();
+	}
+
+	if (CaptureSettings.bLiveCapture && SceneCaptureCube != NULL)
+	{
+		LiveCapture.Init(GetOwner(), SceneCaptureCube->GetAttachParent(), TC, CaptureSettings, Skybox);
+	}
+}
+
+void UVRTunnellingProMobile::SpawnSkybox()
+{
+	FVector Location = GetOwner()->GetActorLocation();
+	FRotator Rotation = GetOwner()->GetActorRotation();
+	FActorSpawnParameters SpawnInfo;
+	SpawnInfo.Owner = GetOwner();
+	Skybox = GetWorld()->SpawnActor(SkyboxBlueprint.Get(), &Location, &Rotation, SpawnInfo);
+
+	if (Skybox != NULL)
 	{
-		FVector Location = GetOwner()->GetActorLocation();
-		FRotator Rotation = GetOwner()->GetActorRotation();
-		FActorSpawnParameters SpawnInfo;
-		SpawnInfo.Owner = GetOwner();
-		Skybox = GetWorld()->SpawnActor(SkyboxBlueprint, &Location, &Rotation, SpawnInfo);
+		// Spawned on the owner, so it keeps no offset from it and shares its frame
+		Skybox->GetRootComponent()->AttachToComponent(GetOwner()->GetRootComponent(), FAttachmentTransformRules::KeepWorldTransform);
+		TInlineComponentArray<UActorComponent*> MeshComponents(Skybox);
+		for (int32 i = 0; i < MeshComponents.Num(); ++i)
+		{
+			UStaticMeshComponent* Mesh = Cast<UStaticMeshComponent>(MeshComponents[i]);
+			Mesh->SetOwnerNoSee(true);
+		}
+	}
+}
 
-		if (Skybox != NULL)
+void UVRTunnellingProMobile::CaptureSkybox()
+{
+	// A parked or destroyed skybox is brought back for the capture
+	if (Skybox == NULL)
+	{
+		SpawnSkybox();
+	}
+	else if (bSkyboxParked)
+	{
+		FVRTPCaptureSettings::UnparkSkybox(Skybox, GetOwner()->GetRootComponent(), bSkyboxCollision);
+		bSkyboxParked = false;
+	}
+
+	SceneCaptureCube->ClearShowOnlyComponents();
+	SceneCaptureCube->ShowOnlyActorComponents(Skybox);
+
+	// The skybox is spawned on the owner, so this is its frame even when it could not be spawned
+	FVRTPCaptureSettings::CaptureCube(SceneCaptureCube, GetOwner()->GetActorTransform());
+
+	// A static snapshot no longer needs the skybox in the scene. The capture is already queued ahead of its removal.
+	if (Skybox != NULL && !CaptureSettings.bLiveCapture)
+	{
+		switch (CaptureSettings.SkyboxAfterCapture)
 		{
-			Skybox->GetRootComponent()->AttachToComponent(GetOwner()->GetRootComponent(), FAttachmentTransformRules::KeepRelativeTransform);
-			TInlineComponentArray<UActorComponent*> MeshComponents(Skybox);
-			for (int32 i = 0; i < MeshComponents.Num(); ++i)
-			{
-				UStaticMeshComponent* Mesh = Cast<UStaticMeshComponent>(MeshComponents[i]);
-				Mesh->SetOwnerNoSee(true);
-			}
+			case EVRTPSkyboxRetention::SR_PARK:
+				FVRTPCaptureSettings::ParkSkybox(Skybox, bSkyboxCollision);
+				bSkyboxParked = true;
+				break;
+
+			case EVRTPSkyboxRetention::SR_DESTROY:
+				Skybox->Destroy();
+				Skybox = NULL;
+				break;
+
+			default:
+				break;
 		}
+	}
+}
 
-		SceneCaptureCube->ShowOnlyActorComponents(Skybox);
-		SceneCaptureCube->CaptureScene();
+void UVRTunnellingProMobile::RequestRecapture()
+{
+	if (bSharedCapture)
+	{
+		if (UVRTPCaptureSubsystem* CaptureSubsystem = GetWorld()->GetSubsystem<UVRTPCaptureSubsystem>())
+		{
+			CaptureSubsystem->RecaptureShared(TC);
+		}
+	}
+	else if (SkyboxBlueprint.Get() != NULL && SceneCaptureCube != NULL)
+	{
+		CaptureSkybox();
 	}
 }
 
 void UVRTunnellingProMobile::InitIris()
 {
 	UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
-	if (PlayerCamera != NULL && IrisMesh != NULL)
+	if (PlayerCamera != NULL && IrisMesh.Get() != NULL)
 	{
 		Iris = NewObject<UStaticMeshComponent>(GetOwner());
 		Iris->RegisterComponent();
-		Iris->SetStaticMesh(IrisMesh);
+		Iris->SetStaticMesh(IrisMesh.Get());
 		IrisOuterMID = Iris->CreateDynamicMaterialInstance(0, Iris->GetMaterial(0));
 		IrisInnerMID = Iris->CreateDynamicMaterialInstance(1, Iris->GetMaterial(1));
+		ParameterBlock.AddTarget(IrisOuterMID);
+		ParameterBlock.AddTarget(IrisInnerMID);
 		Iris->SetWorldTransform(FTransform(FRotator(90, 0, 0), FVector(30, 0, 0), FVector(1.5, 1.5, 1.5)));
 		Iris->AttachToComponent(PlayerCamera, FAttachmentTransformRules::KeepRelativeTransform);
-		IrisInnerMID->SetScalarParameterValue(FName("CubeMapOverride"), (CubeMapOverride ? 1.0f : 0.0f));
-		IrisOuterMID->SetScalarParameterValue(FName("CubeMapOverride"), (CubeMapOverride ? 1.0f : 0.0f));
-		if (CubeMapOverride != NULL)
+		IrisInnerMID->SetScalarParameterValue(FName("CubeMapOverride"), (GetSkyboxCubeMap() ? 1.0f : 0.0f));
+		IrisOuterMID->SetScalarParameterValue(FName("CubeMapOverride"), (GetSkyboxCubeMap() ? 1.0f : 0.0f));
+		if (GetSkyboxCubeMap() != NULL)
 		{
-			IrisOuterMID->SetTextureParameterValue(FName("CustomCubeMap"), CubeMapOverride);
-			IrisInnerMID->SetTextureParameterValue(FName("CustomCubeMap"), CubeMapOverride);
+			IrisOuterMID->SetTextureParameterValue(FName("CustomCubeMap"), GetSkyboxCubeMap());
+			IrisInnerMID->SetTextureParameterValue(FName("CustomCubeMap"), GetSkyboxCubeMap());
 		}
 		else
 		{
@@ -311,25 +730,51 @@ void UVRTunnellingProMobile::InitIris()
 			IrisOuterMID->SetTextureParameterValue(FName("TC"), TC);
 		}
 		Iris->SetHiddenInGame(true);
+
+#if UE_WITH_PSO_PRECACHING
+		// The iris is hidden until the vignette first closes; have its pipeline states ready by then
+		if (UVRTPWarmupSubsystem::IsEnabled())
+		{
+			Iris->PrecachePSOs();
+		}
+#endif
 	}
 	
 }
 
+UTextureCube* UVRTunnellingProMobile::GetSkyboxCubeMap() const
+{
+	// Null until the soft references have streamed in
+	return CubeMapOverride.Get() != NULL ? CubeMapOverride.Get() : BakedSkybox.Get();
+}
+
+int64 UVRTunnellingProMobile::GetCaptureMemory() const
+{
+	return FVRTPCaptureSettings::GetMemoryBytes(TC);
+}
+
 void UVRTunnellingProMobile::SetBackgroundMode(EVRTPMBackgroundMode NewBackgroundMode)
 {
 	BackgroundMode = NewBackgroundMode;
+	if (IsTunnellingReady())
+	{
+		UpdateCaptureResources(0.0f);
+	}
+	UpdatePermutation();
 	ApplyBackgroundMode();
 }
 
 void UVRTunnellingProMobile::SetMaskMode(EVRTPMMaskMode NewMaskMode)
 {
 	MaskMode = NewMaskMode;
+	IdleGate.Reset();
+	UpdatePermutation();
 	ApplyMaskMode();
 }
 
 void UVRTunnellingProMobile::ApplyBackgroundMode()
 {
-	switch (BackgroundMode)
+	switch (GetActiveBackgroundMode())
 	{
 		case EVRTPMBackgroundMode::MM_COLOR:
 			if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("BackgroundColor"), 1.0f);
@@ -349,22 +794,22 @@ void UVRTunnellingProMobile::ApplyBackgroundMode()
 			if (IrisInnerMID) IrisInnerMID->SetScalarParameterValue(FName("BackgroundColor"), 0.0f);
 			if (IrisInnerMID) IrisInnerMID->SetScalarParameterValue(FName("BackgroundSkybox"), 1.0f);
 			
-			if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("CubeMapOverride"), (CubeMapOverride ? 1.0f : 0.0f));
-			if (IrisOuterMID) IrisOuterMID->SetScalarParameterValue(FName("CubeMapOverride"), (CubeMapOverride ? 1.0f : 0.0f));
-			if (IrisInnerMID) IrisInnerMID->SetScalarParameterValue(FName("CubeMapOverride"), (CubeMapOverride ? 1.0f : 0.0f));
-			if (CubeMapOverride != NULL)
+			if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("CubeMapOverride"), (GetSkyboxCubeMap() ? 1.0f : 0.0f));
+			if (IrisOuterMID) IrisOuterMID->SetScalarParameterValue(FName("CubeMapOverride"), (GetSkyboxCubeMap() ? 1.0f : 0.0f));
+			if (IrisInnerMID) IrisInnerMID->SetScalarParameterValue(FName("CubeMapOverride"), (GetSkyboxCubeMap() ? 1.0f : 0.0f));
+			if (GetSkyboxCubeMap() != NULL)
 			{
-				PostProcessMID->SetTextureParameterValue(FName("CustomCubeMap"), CubeMapOverride);
-				IrisOuterMID->SetTextureParameterValue(FName("CustomCubeMap"), CubeMapOverride);
-				IrisInnerMID->SetTextureParameterValue(FName("CustomCubeMap"), CubeMapOverride);
+				if (PostProcessMID) PostProcessMID->SetTextureParameterValue(FName("CustomCubeMap"), GetSkyboxCubeMap());
+				if (IrisOuterMID) IrisOuterMID->SetTextureParameterValue(FName("CustomCubeMap"), GetSkyboxCubeMap());
+				if (IrisInnerMID) IrisInnerMID->SetTextureParameterValue(FName("CustomCubeMap"), GetSkyboxCubeMap());
 			}
 			else
 			{
-				IrisInnerMID->SetTextureParameterValue(FName("TC"), TC);
-				IrisOuterMID->SetTextureParameterValue(FName("TC"), TC);
+				if (IrisInnerMID) IrisInnerMID->SetTextureParameterValue(FName("TC"), TC);
+				if (IrisOuterMID) IrisOuterMID->SetTextureParameterValue(FName("TC"), TC);
 			}
 
-			if (Skybox != NULL) Skybox->SetActorHiddenInGame(false);
+			if (Skybox != NULL && !bSkyboxParked) Skybox->SetActorHiddenInGame(false);
 			break;
 	}
 }
@@ -373,7 +818,7 @@ void UVRTunnellingProMobile::ApplyMaskMode()
 {
 	if (PostProcessMID) 
 	{
-		switch (MaskMode)
+		switch (GetActiveMaskMode())
 		{
 			case EVRTPMMaskMode::MM_OFF:
 				PostProcessMID->SetScalarParameterValue(FName("MaskOn"), 0.0f);
@@ -408,27 +853,39 @@ void UVRTunnellingProMobile::ApplyMaskMode()
 				break;
 		}
 	}
+	ApplyIdleState();
+}
+
+void UVRTunnellingProMobile::ApplyIdleState()
+{
+	// An idle vignette draws neither the iris (Off) nor the post process (mask modes); a zero weight blendable is skipped by the renderer
+	if (Iris) Iris->SetHiddenInGame(GetActiveMaskMode() != EVRTPMMaskMode::MM_OFF || IdleGate.bIdle);
+
+	UCameraComponent* PlayerCamera = GetOwner()->FindComponentByClass<UCameraComponent>();
+	if (PlayerCamera != NULL && PostProcessMID != NULL)
+	{
+		PlayerCamera->PostProcessSettings.AddBlendable(PostProcessMID, IdleGate.bIdle ? 0.0f : 1.0f);
+	}
 }
 
 void UVRTunnellingProMobile::SetEffectColor(FLinearColor NewColor)
 {
 	EffectColor = NewColor;
-	if (PostProcessMID) PostProcessMID->SetVectorParameterValue(FName("EffectColor"), FVector(EffectColor.R, EffectColor.G, EffectColor.B));
-	if (IrisOuterMID) IrisOuterMID->SetVectorParameterValue(FName("EffectColor"), FVector(EffectColor.R, EffectColor.G, EffectColor.B));
-	if (IrisInnerMID) IrisInnerMID->SetVectorParameterValue(FName("EffectColor"), FVector(EffectColor.R, EffectColor.G, EffectColor.B));
+	ParameterBlock.SetVector(EVRTPVectorParameter::EffectColor, FVector(EffectColor.R, EffectColor.G, EffectColor.B));
 }
 
 void UVRTunnellingProMobile::SetFeather(float NewFeather)
 {
 	EffectFeather = NewFeather;
-	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("Feather"), EffectFeather);
-	if (IrisInnerMID) IrisInnerMID->SetScalarParameterValue(FName("Feather"), EffectFeather);
+	ParameterBlock.SetScalar(EVRTPScalarParameter::Feather, EffectFeather);
 }
 
 void UVRTunnellingProMobile::SetStencilMask(int32 NewStencilIndex, bool UpdateMaskedObjects)
 {
 	StencilIndex = NewStencilIndex;
-	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilIndex);
+	StencilMatch = FVRTPStencilMatch();
+	StencilMatch.MaterialStencil = StencilIndex;
+	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilMatch.MaterialStencil);
 	if (UpdateMaskedObjects) ApplyStencilMasks();
 }
 
@@ -440,109 +897,160 @@ void UVRTunnellingProMobile::UpdateMaskedObjects()
 void UVRTunnellingProMobile::ApplyStencilMasks()
 {
 	// Apply Custom Depth Stencil Index to all primitives within actors containing VRTPMask Component
-	TArray<AActor*> AllActors;
-	UGameplayStatics::GetAllActorsOfClass(GetWorld(), AActor::StaticClass(), AllActors);
-	for (AActor* Actor : AllActors)
+	if (UVRTPMaskSubsystem* MaskSubsystem = GetWorld()->GetSubsystem<UVRTPMaskSubsystem>())
 	{
-		if (Actor->FindComponentByClass(UVRTPMask::StaticClass()))
+		// Other components' settings and the masks' layers change which masks are shared
+		if (!MasksChangedHandle.IsValid())
 		{
-			TInlineComponentArray<UActorComponent*> Components(Actor);
-			for (UActorComponent* Component : Components)
-			{
-				UPrimitiveComponent* Primitive = Cast<UPrimitiveComponent>(Component);
-				if (Primitive)
-				{
-					if (Primitive->IsValidLowLevel()) {
-						Primitive->SetCustomDepthStencilValue(StencilIndex);
-						if (MaskMode != EVRTPMMaskMode::MM_OFF) Primitive->SetRenderCustomDepth(true);
-						else Primitive->SetRenderCustomDepth(false);
-					}
-				}
-			}
+			MasksChangedHandle = MaskSubsystem->OnMasksChanged.AddUObject(this, &UVRTunnellingProMobile::OnMasksChanged);
 		}
+		MaskSubsystem->ApplyStencil(this, StencilIndex, MaskLayers, GetActiveMaskMode() != EVRTPMMaskMode::MM_OFF);
 	}
 }
 
+void UVRTunnellingProMobile::OnMasksChanged()
+{
+	StencilMatch = GetWorld()->GetSubsystem<UVRTPMaskSubsystem>()->GetStencilMatch(this);
+	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("MaskStencil"), (float)StencilMatch.MaterialStencil);
+}
+
 void UVRTunnellingProMobile::ApplyColor(bool Enabled)
 {
 	ApplyEffectColor = Enabled;
+	UpdatePermutation();
 	SetEffectColor(EffectColor);
 	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("ApplyEffectColor"), (float)ApplyEffectColor);
 	if (IrisOuterMID) IrisOuterMID->SetScalarParameterValue(FName("ApplyEffectColor"), (float)ApplyEffectColor);
 	if (IrisInnerMID) IrisInnerMID->SetScalarParameterValue(FName("ApplyEffectColor"), (float)ApplyEffectColor);
 }
 
-void UVRTunnellingProMobile::CalculateMotion(float DeltaTime)
+int32 UVRTunnellingProMobile::GetLocalPlayerIndex() const
 {
-	float Radius = 0;
-	float RadiusTarget = 0;
-	float VelocityFinal = 0;
-	if (!ForceEffect)
-	{
-		if (bUseAngularVelocity)
-		{
-			float AngleDelta = FMath::RadiansToDegrees(FMath::Acos(FVector::DotProduct(GetOwner()->GetActorForwardVector(), LastForward))) / DeltaTime;
-			// Check for divide by zero
-			if (FMath::IsNearlyEqual(AngularMin, AngularMax, 0.001f)) AngleDelta = 0;
-			else AngleDelta = (AngleDelta - AngularMin) / (AngularMax - AngularMin);
-			float InterpSpeed = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1, 20), AngularSmoothing);
-			AngleSmoothed = FMath::FInterpTo(AngleSmoothed, AngleDelta, DeltaTime, InterpSpeed);
-			RadiusTarget += AngleSmoothed * (AngularStrength * 0.5);
-			LastForward = GetOwner()->GetActorForwardVector();
-		}
+	const APawn* Pawn = Cast<APawn>(GetOwner());
+	APlayerController* PlayerController = Pawn ? Pawn->GetController<APlayerController>() : nullptr;
+	return PlayerController ? FMath::Max(UGameplayStatics::GetPlayerControllerID(PlayerController), 0) : 0;
+}
 
-		if (bUseVelocity || bUseAcceleration)
-		{
-			float VelocityDelta = FVector::Distance(GetOwner()->GetActorLocation(), LastPosition) / DeltaTime;
-			LastPosition = GetOwner()->GetActorLocation();
+FVRTPMotionSample UVRTunnellingProMobile::GatherMotionSample()
+{
+	// Read the owner transform once per tick; the pose history and the basis vectors both use it
+	const AActor* Owner = GetOwner();
+	const FTransform& ActorTransform = Owner->GetActorTransform();
 
-			if (bUseVelocity)
-			{
-				float InterpSpeed = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1, 20), VelocitySmoothing);
-				VelocitySmoothed = FMath::FInterpTo(VelocitySmoothed, VelocityDelta, DeltaTime, InterpSpeed);
+	FVRTPPose Pose;
+	Pose.Time = GetWorld()->GetTimeSeconds();
+	Pose.Position = ActorTransform.GetLocation();
+	Pose.Orientation = ActorTransform.GetRotation();
+	const bool bNewPose = PoseHistory.Push(Pose);
 
-				// Check for divide by zero
-				if (!FMath::IsNearlyEqual(VelocityMin, VelocityMax, 0.001f))
-				{
-					VelocityFinal = FMath::Clamp((VelocitySmoothed - VelocityMin) / (VelocityMax - VelocityMin), 0.0f, 1.0f);
-				}
-				RadiusTarget += VelocityFinal * VelocityStrength;
-			}
+	FVRTPMotionSample Sample;
+	Sample.Forward = ActorTransform.GetUnitAxis(EAxis::X);
+	Sample.Right = ActorTransform.GetUnitAxis(EAxis::Y);
+	Sample.Up = ActorTransform.GetUnitAxis(EAxis::Z);
+	// World time stops while paused, so no pose is new and the pawn is treated as still rather than keeping its last fitted motion
+	if (bNewPose)
+	{
+		Sample.Kinematics = PoseHistory.Estimate();
+	}
+	return Sample;
+}
 
-			if (bUseAcceleration)
-			{
-				float AccelerationDelta = FMath::Abs(GetOwner()->GetVelocity().Size() - LastSpeed) / DeltaTime;
-				LastSpeed = GetOwner()->GetVelocity().Size();
+// Explicit, so the UENUM and the motion model's filter enum can be reordered independently
+static EVRTPMotionFilter ToMotionFilter(EVRTPMSmoothingMode Mode)
+{
+	switch (Mode)
+	{
+		case EVRTPMSmoothingMode::SM_INTERP:				return EVRTPMotionFilter::Interp;
+		case EVRTPMSmoothingMode::SM_ONE_EURO:			return EVRTPMotionFilter::OneEuro;
+		case EVRTPMSmoothingMode::SM_CRITICALLY_DAMPED:	return EVRTPMotionFilter::CriticallyDamped;
+	}
+	return EVRTPMotionFilter::Interp;
+}
 
-				// Check for divide by zero
-				if (!FMath::IsNearlyEqual(AccelerationMin, AccelerationMax, 0.001f))
-				{
-					AccelerationDelta = FMath::Clamp((AccelerationDelta - AccelerationMin) / (AccelerationMax - AccelerationMin), 0.0f, 1.0f);
-				}
+void UVRTunnellingProMobile::UpdateMotionSettings()
+{
+	FVRTPMotionSettings& Settings = MotionModel.Settings;
+	Settings.bForceEffect			= ForceEffect;
+	Settings.EffectCoverage			= EffectCoverage;
+	Settings.bUseAngularVelocity	= bUseAngularVelocity;
+	Settings.AngularStrength		= AngularStrength;
+	Settings.AngularMin				= AngularMin;
+	Settings.AngularMax				= AngularMax;
+	Settings.AngularSmoothing		= AngularSmoothing;
+	Settings.bUseVelocity			= bUseVelocity;
+	Settings.VelocityStrength		= VelocityStrength;
+	Settings.VelocityMin			= VelocityMin;
+	Settings.VelocityMax			= VelocityMax;
+	Settings.VelocitySmoothing		= VelocitySmoothing;
+	Settings.bUseAcceleration		= bUseAcceleration;
+	Settings.AccelerationStrength	= AccelerationStrength;
+	Settings.AccelerationMin		= AccelerationMin;
+	Settings.AccelerationMax		= AccelerationMax;
+	Settings.AccelerationSmoothing	= AccelerationSmoothing;
+	Settings.Filter					= ToMotionFilter(SmoothingMode);
+	Settings.FilterBeta				= SmoothingBeta;
+}
 
-				float InterpSpeed = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1, 20), AccelerationSmoothing);
-				AccelerationSmoothed = FMath::FInterpTo(AccelerationSmoothed, AccelerationDelta, DeltaTime, InterpSpeed);
-				RadiusTarget += AccelerationSmoothed * AccelerationStrength;
-			}
-		}
+void UVRTunnellingProMobile::CalculateMotion(const FVRTPMotionSample& Sample, float DeltaTime)
+{
+	UpdateMotionSettings();
 
-		if (bUseAngularVelocity || bUseAcceleration || bUseVelocity)
+	// Batched: the result arrives through ApplyMotionResult once the world's batch has been evaluated
+	if (UVRTPMotionSubsystem* MotionSubsystem = UVRTPMotionSubsystem::GetBatched(GetWorld()))
+	{
+		if (MotionInstance == INDEX_NONE)
 		{
-			Radius = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1.5, 1 - EffectCoverage), RadiusTarget);
+			// Switching paths; the scalar model's filters would be stale by the time it is used again
+			MotionModel.Reset();
+			MotionInstance = MotionSubsystem->RegisterInstance(FVRTPOnMotionEvaluated::CreateUObject(this, &UVRTunnellingProMobile::ApplyMotionResult));
 		}
-		else
+		// A rejected sample gets no result, so nothing would clear a pending flush
+		bMotionPending = MotionSubsystem->SubmitSample(MotionInstance, MotionModel.Settings, Sample, DeltaTime);
+		return;
+	}
+
+	// Batching was turned off; drop the lane and restart the scalar model from rest rather than from its state before batching
+	if (MotionInstance != INDEX_NONE)
+	{
+		ReleaseMotionInstance();
+		MotionModel.Reset();
+	}
+
+	ApplyMotionResult(MotionModel.Evaluate(Sample, DeltaTime));
+}
+
+void UVRTunnellingProMobile::ReleaseMotionInstance()
+{
+	if (MotionInstance != INDEX_NONE)
+	{
+		if (UVRTPMotionSubsystem* MotionSubsystem = GetWorld()->GetSubsystem<UVRTPMotionSubsystem>())
 		{
-			Radius = 1.5f;
+			MotionSubsystem->UnregisterInstance(MotionInstance);
 		}
+		MotionInstance = INDEX_NONE;
 	}
-	else
+}
+
+void UVRTunnellingProMobile::ApplyMotionResult(const FVRTPMotionResult& Result)
+{
+	// Batched results arrive after the tick, so the delay is reported with the result it belongs to
+	MotionModel.FilterDelay = Result.FilterDelay;
+	MotionModel.ReportFilterDelay();
+
+	// Window and portal masks show the background even while the vignette is open
+	const EVRTPMMaskMode ActiveMaskMode = GetActiveMaskMode();
+	const bool bCanIdle = ActiveMaskMode == EVRTPMMaskMode::MM_OFF || ActiveMaskMode == EVRTPMMaskMode::MM_MASK;
+	if (IdleGate.Update(Result, GetWorld()->GetDeltaSeconds(), bCanIdle))
 	{
-		Radius = 0.3f;
+		ApplyIdleState();
 	}
 
-	if (PostProcessMID) PostProcessMID->SetScalarParameterValue(FName("Radius"), Radius);
-	if (IrisOuterMID) IrisOuterMID->SetScalarParameterValue(FName("Radius"), Radius);
-	if (IrisInnerMID) IrisInnerMID->SetScalarParameterValue(FName("Radius"), Radius);
+	ParameterBlock.SetScalar(EVRTPScalarParameter::Radius, Result.Radius);
 
-	
+	// Batched results arrive after the tick, so flush here instead
+	if (bMotionPending)
+	{
+		bMotionPending = false;
+		ParameterBlock.Flush();
+	}
 }
@@ -7,7 +7,16 @@
 #include "Components/SceneCaptureComponentCube.h"
 #include "Engine/TextureRenderTargetCube.h"
 #include "Engine/DataAsset.h"
+#include "Materials/MaterialParameterCollection.h"
 #include "Engine/TextureCube.h"
+#include "VRTPMotionModel.h"
+#include "VRTPIdleGate.h"
+#include "VRTPParameterBlock.h"
+#include "VRTPCapture.h"
+#include "VRTPInit.h"
+#include "VRTPWarmup.h"
+#include "VRTPPermutations.h"
+#include "VRTPMaskSubsystem.h"
 #include "VRTPMobile.generated.h"
 
 /// Mobile Background Mode Enumerator (Color || Skybox || Blur)
@@ -28,6 +37,15 @@ enum class EVRTPMMaskMode : uint8
 	MM_PORTAL		UMETA(DisplayName = "Portal"),
 };
 
+/// Mobile Motion Smoothing Mode Enumerator (Interp || One Euro || Critically Damped)
+UENUM(BlueprintType)
+enum class EVRTPMSmoothingMode : uint8
+{
+	SM_INTERP 		UMETA(DisplayName = "Interp (Legacy)"),
+	SM_ONE_EURO		UMETA(DisplayName = "One Euro"),
+	SM_CRITICALLY_DAMPED	UMETA(DisplayName = "Critically Damped")
+};
+
 /// VRTP Mobile Preset Definition (Applied to mobile version only)
 USTRUCT(BlueprintType)
 struct FVRTPMPreset
@@ -36,19 +54,36 @@ struct FVRTPMPreset
 
 	/// Skybox blueprint to use
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
-	TSubclassOf<class AActor> SkyboxBlueprint;
+	TSoftClassPtr<AActor> SkyboxBlueprint;
 
 	/// Cubemap texture cube to use as an override for skybox-only modes
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
-	UTextureCube* CubeMapOverride;
+	TSoftObjectPtr<UTextureCube> CubeMapOverride;
+
+	/// Skybox capture resolution and format
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	FVRTPCaptureSettings CaptureSettings;
+
+	/// Snapshot of the skybox blueprint baked by the VRTPBakeSkybox commandlet; used like a cube map override, so nothing is captured at runtime
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Capture")
+	TSoftObjectPtr<UTextureCube> BakedSkybox;
 
 	/// Effect material to use for post process effect
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Post Process")
-	UMaterial* PostProcessMaterial;
+	TSoftObjectPtr<UMaterial> PostProcessMaterial;
+
+	/// Static-switch instances of the effect material, generated by the VRTPMaterialPermutations commandlet. The instance matching the
+	/// current background and mask modes is used in place of the effect material, so the shader only contains the active features.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Post Process")
+	TSoftObjectPtr<UVRTPMaterialPermutations> MaterialPermutations;
+
+	/// Optional parameter collection the effect materials read from; when set, per-frame parameters are published here once instead of to each material instance
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Post Process")
+	UMaterialParameterCollection* ParameterCollection;
 
 	/// Iris mesh to use
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Iris")
-	UStaticMesh* IrisMesh;
+	TSoftObjectPtr<UStaticMesh> IrisMesh;
 
 	/// Effect vignette color
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Effect Settings")
@@ -142,12 +177,17 @@ struct FVRTPMPreset
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Motion Settings|Acceleration", meta = (ClampMin = "0.0", ClampMax = "1.0"))
 	float AccelerationSmoothing;
 
+	/// Smoothing filter. Interp lags more at low frame rates; One Euro and Critically Damped lag by the same time at any frame rate
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Motion Settings|Smoothing")
+	EVRTPMSmoothingMode SmoothingMode;
+
+	/// One Euro speed coefficient; higher values reduce lag during fast motion at the cost of more jitter
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Motion Settings|Smoothing", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float SmoothingBeta;
+
 	FVRTPMPreset()
 	{
-		SkyboxBlueprint = NULL;
-		CubeMapOverride = NULL;
-		PostProcessMaterial = NULL;
-		IrisMesh = NULL;
+		ParameterCollection = NULL;
 		EffectColor = FLinearColor::Black;
 		EffectCoverage = 0;
 		EffectFeather = 0;
@@ -171,6 +211,8 @@ struct FVRTPMPreset
 		AccelerationMin = 0;
 		AccelerationMax = 0;
 		AccelerationSmoothing = 0;
+		SmoothingMode = EVRTPMSmoothingMode::SM_INTERP;
+		SmoothingBeta = 0;
 	}
 };
 
@@ -210,29 +252,58 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "VR Tunnelling|Effect Preset")
 	bool bEnablePreset;
 
+	/// Presets this component may apply during gameplay. Their effect materials are loaded with the component and drawn once while it initialises, so applying them later does not hitch.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "VR Tunnelling|Effect Preset")
+	TArray<UVRTPMPresetData*> WarmupPresets;
+
 	/// Skybox blueprint to use
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
-	TSubclassOf<class AActor> SkyboxBlueprint;
+	TSoftClassPtr<AActor> SkyboxBlueprint;
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
-	TSubclassOf<class AActor> SkyboxBlueprintSwap;
+	TSoftClassPtr<AActor> SkyboxBlueprintSwap;
 
 	/// Cubemap texture cube to use as an override for skybox-only modes
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
-	UTextureCube* CubeMapOverride;
+	TSoftObjectPtr<UTextureCube> CubeMapOverride;
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
-	UTextureCube* CubeMapOverrideSwap;
+	TSoftObjectPtr<UTextureCube> CubeMapOverrideSwap;
+
+	/// Skybox capture resolution and format
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	FVRTPCaptureSettings CaptureSettings;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	FVRTPCaptureSettings CaptureSettingsSwap;
+
+	/// Snapshot of the skybox blueprint baked by the VRTPBakeSkybox commandlet; used like a cube map override, so nothing is captured at runtime
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	TSoftObjectPtr<UTextureCube> BakedSkybox;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	TSoftObjectPtr<UTextureCube> BakedSkyboxSwap;
 
 	/// Effect material to use for post process effect
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
-	UMaterial* PostProcessMaterial;
+	TSoftObjectPtr<UMaterial> PostProcessMaterial;
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
-	UMaterial* PostProcessMaterialSwap;
+	TSoftObjectPtr<UMaterial> PostProcessMaterialSwap;
+
+	/// Static-switch instances of the effect material, generated by the VRTPMaterialPermutations commandlet. The instance matching the
+	/// current background and mask modes is used in place of the effect material, so the shader only contains the active features.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	TSoftObjectPtr<UVRTPMaterialPermutations> MaterialPermutations;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	TSoftObjectPtr<UVRTPMaterialPermutations> MaterialPermutationsSwap;
+
+	/// Optional parameter collection the effect materials read from; when set, per-frame parameters are published here once instead of to each material instance
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
+	UMaterialParameterCollection* ParameterCollection;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
+	UMaterialParameterCollection* ParameterCollectionSwap;
 
 	/// Iris mesh to use
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling")
-	UStaticMesh* IrisMesh;
+	TSoftObjectPtr<UStaticMesh> IrisMesh;
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling")
-	UStaticMesh* IrisMeshSwap;
+	TSoftObjectPtr<UStaticMesh> IrisMeshSwap;
 
 	/// Effect vignette color
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Effect Settings")
@@ -282,6 +353,11 @@ public:
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Effect Settings|Mask Settings")
 	int32 StencilIndexSwap;
 
+	/// Mask layers this component applies its stencil index to. A VRTPMask is only affected if its Layers share one of these.
+	/// Components sharing masks should use stencil indices with different bits (1, 2, 4...), as masks combine them bitwise.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "VR Tunnelling|Effect Settings|Mask Settings", meta = (Bitmask, BitmaskEnum = "/Script/VRTunnellingPro.EVRTPMaskLayer"))
+	int32 MaskLayers;
+
 	/// Enable effect for angular velocity
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Motion Settings|Angular Velocity")
 	bool bUseAngularVelocity;
@@ -372,21 +448,75 @@ public:
 	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Motion Settings|Acceleration")
 	float AccelerationSmoothingSwap;
 
+	/// Smoothing filter. Interp lags more at low frame rates; One Euro and Critically Damped lag by the same time at any frame rate
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Motion Settings|Smoothing")
+	EVRTPMSmoothingMode SmoothingMode;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Motion Settings|Smoothing")
+	EVRTPMSmoothingMode SmoothingModeSwap;
+
+	/// One Euro speed coefficient; higher values reduce lag during fast motion at the cost of more jitter
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, SimpleDisplay, Category = "VR Tunnelling|Motion Settings|Smoothing", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float SmoothingBeta;
+	UPROPERTY(EditAnywhere, Category = "VR Tunnelling|Motion Settings|Smoothing")
+	float SmoothingBetaSwap;
+
 	USceneCaptureComponentCube* SceneCaptureCube;
 	UTextureRenderTargetCube* TC;
+	UPROPERTY(Transient)
+	FVRTPLiveCapture LiveCapture;
+	bool bSharedCapture;
+	FVRTPCaptureLifetime CaptureLifetime;
+	bool bSkyboxParked;
+	/// Whether the parked skybox had collision, restored when it is unparked
+	bool bSkyboxCollision;
 	float HFov;
 	float VFov;
 	UMaterialInstanceDynamic* PostProcessMID;
+
+	/// Effect MIDs by source material (the effect material or one of its permutations), kept for when the modes switch back
+	UPROPERTY()
+	TMap<UMaterialInterface*, UMaterialInstanceDynamic*> PostProcessMIDs;
+
 	AActor* Skybox;
 	UStaticMeshComponent* Iris;
 	UMaterialInstanceDynamic* IrisOuterMID;
 	UMaterialInstanceDynamic* IrisInnerMID;
-	bool CaptureInit;
+	EVRTPInitStage InitStage;
+	FVRTPAssetLoader AssetLoader;
+	bool bSettingsPending;
+
+	/// Preset applied while its assets are still streaming in; it replaces the current settings once they have arrived
+	UPROPERTY()
+	UVRTPMPresetData* PendingPreset;
 
-	/// Load and apply a new VRTP mobile preset, from a VRTP preset data asset
+	/// FVRTPScalability::GetGeneration when the settings were last applied
+	uint32 ScalabilityGeneration;
+
+	/// How this component's masks are recognised in the custom stencil (UVRTPMaskSubsystem::GetStencilMatch)
+	FVRTPStencilMatch StencilMatch;
+	FDelegateHandle MasksChangedHandle;
+
+	/// Broadcast once the effect's assets have streamed in and its materials, iris and capture exist. Until then the vignette uses a colour background.
+	UPROPERTY(BlueprintAssignable, Category = "VR Tunnelling")
+	FVRTPOnTunnellingReady OnTunnellingReady;
+
+	/// Whether initialisation has finished and OnTunnellingReady has been broadcast
+	UFUNCTION(BlueprintPure, Category = "VR Tunnelling")
+	bool IsTunnellingReady() const;
+
+	/// Load and apply a new VRTP mobile preset, from a VRTP preset data asset. Assets the preset references are streamed in first.
 	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
 	void ApplyPreset(UVRTPMPresetData* NewPreset);
 
+	/// Capture the skybox blueprint again, e.g. after changing it at runtime. A parked or destroyed skybox is brought back for the capture;
+	/// a snapshot shared with other components is recaptured for all of them. Does nothing while no snapshot is allocated.
+	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
+	void RequestRecapture();
+
+	/// GPU memory used by the skybox capture render target, in bytes (0 when not capturing, e.g. with a cubemap override)
+	UFUNCTION(BlueprintPure, Category = "VR Tunnelling")
+	int64 GetCaptureMemory() const;
+
 	/// Change the background mode
 	UFUNCTION(BlueprintCallable, Category = "VR Tunnelling")
 	void SetBackgroundMode(EVRTPMBackgroundMode NewBackgroundMode);
@@ -417,29 +547,63 @@ public:
 
 protected:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 public:	
 	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 
 private:
-	FVector LastForward;
-	FVector LastPosition;
-	float LastSpeed;
+	// Shared motion model, fed once per tick from GatherMotionSample. Only used when batched evaluation is disabled, and reset whenever it is toggled.
+	FVRTPMotionModel MotionModel;
+
+	// Lane in the world's motion batch, or INDEX_NONE when not registered
+	int32 MotionInstance = INDEX_NONE;
+
+	// True while a batched motion result is outstanding; the parameter block is then flushed when it arrives
+	bool bMotionPending = false;
+
+	// Per-frame material parameters, flushed to every effect MID once per frame
+	FVRTPParameterBlock ParameterBlock;
+
+	// Whether the vignette is open and its iris and post process skipped
+	FVRTPIdleGate IdleGate;
 
-	float AngleSmoothed;
-	float VelocitySmoothed;
-	float AccelerationSmoothed;
+	// Owner poses, pushed and fitted once per tick by GatherMotionSample
+	FVRTPPoseHistory PoseHistory;
 
 	void CacheSettings();
+	void AdvanceInit();
+	void RequestAssets();
+	void GatherWarmup(FVRTPWarmupSet& OutWarmup) const;
+	void StartWarmup();
+	EVRTPMBackgroundMode GetActiveBackgroundMode() const;
+	EVRTPMMaskMode GetActiveMaskMode() const;
+	void ApplyScalability();
 	void InitCapture();
+	bool SelectPermutation();
+	void UpdatePermutation();
 	void InitSkybox();
+	void SpawnSkybox();
+	void CaptureSkybox();
+	void UpdateCaptureResources(float DeltaTime);
+	void AllocateCapture();
+	void ReleaseCapture();
+	void BindCapture();
+	UTextureCube* GetSkyboxCubeMap() const;
 	void InitIris();
 	void InitFromPreset();
 	void SetPresetData(UVRTPMPresetData* NewPreset);
 	void UpdateEffectSettings();
 
-	void CalculateMotion(float DeltaTime);
+	int32 GetLocalPlayerIndex() const;
+	FVRTPMotionSample GatherMotionSample();
+	void UpdateMotionSettings();
+	void CalculateMotion(const FVRTPMotionSample& Sample, float DeltaTime);
+	void ApplyMotionResult(const FVRTPMotionResult& Result);
+	void ReleaseMotionInstance();
 	void ApplyBackgroundMode();
 	void ApplyMaskMode();
+	void ApplyIdleState();
 	void ApplyStencilMasks();
+	void OnMasksChanged();
 };
@@ -0,0 +1,472 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPMotionModel.h"
+#include "VRTPStats.h"
+
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Filter Group Delay, all instances (ms)"), STAT_VRTP_FilterGroupDelay, STATGROUP_VRTunnelling);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Filter Instances"), STAT_VRTP_FilterInstances, STATGROUP_VRTunnelling);
+
+namespace
+{
+	/// One-Euro derivative cutoff, in Hz
+	constexpr float OneEuroRateCutoff = 1.0f;
+
+	/// Streams cleared at the end of every frame
+	TArray<float> FVRTPMotionBatch::* const FrameStreams[] =
+	{
+		&FVRTPMotionBatch::Active, &FVRTPMotionBatch::DeltaTime, &FVRTPMotionBatch::InvDeltaTime, &FVRTPMotionBatch::AngularRate,
+		&FVRTPMotionBatch::VelocityX, &FVRTPMotionBatch::VelocityY, &FVRTPMotionBatch::VelocityZ, &FVRTPMotionBatch::AccelerationRate,
+		&FVRTPMotionBatch::CameraRightX, &FVRTPMotionBatch::CameraRightY, &FVRTPMotionBatch::CameraRightZ, &FVRTPMotionBatch::CameraForwardZ,
+	};
+
+	/// Every other float stream (settings, state and outputs)
+	TArray<float> FVRTPMotionBatch::* const PersistentStreams[] =
+	{
+		&FVRTPMotionBatch::ForceEffect, &FVRTPMotionBatch::UseAny, &FVRTPMotionBatch::UseAngular, &FVRTPMotionBatch::UseVelocity,
+		&FVRTPMotionBatch::UseAcceleration, &FVRTPMotionBatch::Direction, &FVRTPMotionBatch::Coverage,
+		&FVRTPMotionBatch::AngularStrength, &FVRTPMotionBatch::AngularMin, &FVRTPMotionBatch::AngularInvRange, &FVRTPMotionBatch::AngularSpeed,
+		&FVRTPMotionBatch::VelocityStrength, &FVRTPMotionBatch::VelocityMin, &FVRTPMotionBatch::VelocityInvRange, &FVRTPMotionBatch::VelocitySpeed,
+		&FVRTPMotionBatch::AccelerationStrength, &FVRTPMotionBatch::AccelerationMin, &FVRTPMotionBatch::AccelerationInvRange,
+		&FVRTPMotionBatch::AccelerationHasRange, &FVRTPMotionBatch::AccelerationSpeed,
+		&FVRTPMotionBatch::VerticalStrength, &FVRTPMotionBatch::HorizontalStrength,
+		&FVRTPMotionBatch::FilterOneEuro, &FVRTPMotionBatch::FilterSpring, &FVRTPMotionBatch::FilterBeta,
+		&FVRTPMotionBatch::AngleSmoothed, &FVRTPMotionBatch::AngleVelocity, &FVRTPMotionBatch::AngleLastInput, &FVRTPMotionBatch::AngleInputRate,
+		&FVRTPMotionBatch::VelocitySmoothed, &FVRTPMotionBatch::VelocityVelocity, &FVRTPMotionBatch::VelocityLastInput, &FVRTPMotionBatch::VelocityInputRate,
+		&FVRTPMotionBatch::AccelerationSmoothed, &FVRTPMotionBatch::AccelerationVelocity, &FVRTPMotionBatch::AccelerationLastInput, &FVRTPMotionBatch::AccelerationInputRate,
+		&FVRTPMotionBatch::Radius, &FVRTPMotionBatch::XShift, &FVRTPMotionBatch::YShift, &FVRTPMotionBatch::FilterDelay,
+	};
+
+	FORCEINLINE VectorRegister4Float VectorClamp01(const VectorRegister4Float& X)
+	{
+		return VectorMin(VectorMax(X, VectorZeroFloat()), VectorOneFloat());
+	}
+
+	FORCEINLINE VectorRegister4Float VectorMaskOf(const VectorRegister4Float& Flag)
+	{
+		return VectorCompareGT(Flag, VectorZeroFloat());
+	}
+
+	/// Four lanes of FVRTPFilterState
+	struct FVectorFilterState
+	{
+		VectorRegister4Float Value;
+		VectorRegister4Float Velocity;
+		VectorRegister4Float LastInput;
+		VectorRegister4Float InputRate;
+	};
+
+	/// Lane-wise FVRTPMotionModel::Filter; every mode is evaluated and the lane's mode selected
+	FORCEINLINE VectorRegister4Float VectorFilter(FVectorFilterState& FilterState, const VectorRegister4Float& Input, const VectorRegister4Float& Dt, const VectorRegister4Float& InvDt,
+		const VectorRegister4Float& Speed, const VectorRegister4Float& Beta, const VectorRegister4Float& OneEuroMask, const VectorRegister4Float& SpringMask, VectorRegister4Float& OutDelay)
+	{
+		const VectorRegister4Float Zero = VectorZeroFloat();
+		const VectorRegister4Float One = VectorOneFloat();
+		const VectorRegister4Float TwoPi = VectorSetFloat1(2.0f * PI);
+		const VectorRegister4Float InvSpeed = VectorReciprocalAccurate(Speed);
+
+		// FInterpTo (speeds are always positive here, so its zero-speed early out is not needed)
+		const VectorRegister4Float Alpha = VectorClamp01(VectorMultiply(Dt, Speed));
+		const VectorRegister4Float Interp = VectorMultiplyAdd(VectorSubtract(Input, FilterState.Value), Alpha, FilterState.Value);
+		const VectorRegister4Float InterpDelay = VectorMultiply(Dt, VectorDivide(VectorSubtract(One, Alpha), VectorMax(Alpha, VectorSetFloat1(KINDA_SMALL_NUMBER))));
+
+		// Critically damped spring
+		const VectorRegister4Float Omega = VectorAdd(Speed, Speed);
+		const VectorRegister4Float Offset = VectorSubtract(FilterState.Value, Input);
+		const VectorRegister4Float J = VectorMultiplyAdd(Omega, Offset, FilterState.Velocity);
+		const VectorRegister4Float Decay = VectorExp(VectorNegate(VectorMultiply(Omega, Dt)));
+		const VectorRegister4Float Spring = VectorMultiplyAdd(VectorMultiplyAdd(J, Dt, Offset), Decay, Input);
+		const VectorRegister4Float SpringVelocity = VectorMultiply(VectorSubtract(FilterState.Velocity, VectorMultiply(J, VectorMultiply(Omega, Dt))), Decay);
+
+		// One-Euro
+		const VectorRegister4Float Rate = VectorMultiply(VectorSubtract(Input, FilterState.LastInput), InvDt);
+		const VectorRegister4Float RateAlpha = VectorSubtract(One, VectorExp(VectorNegate(VectorMultiply(Dt, VectorSetFloat1(2.0f * PI * OneEuroRateCutoff)))));
+		const VectorRegister4Float InputRate = VectorMultiplyAdd(VectorSubtract(Rate, FilterState.InputRate), RateAlpha, FilterState.InputRate);
+		const VectorRegister4Float Cutoff = VectorMultiplyAdd(Beta, VectorAbs(InputRate), VectorDivide(Speed, TwoPi));
+		const VectorRegister4Float EuroAlpha = VectorSubtract(One, VectorExp(VectorNegate(VectorMultiply(Dt, VectorMultiply(TwoPi, Cutoff)))));
+		const VectorRegister4Float Euro = VectorMultiplyAdd(VectorSubtract(Input, FilterState.Value), EuroAlpha, FilterState.Value);
+		const VectorRegister4Float EuroDelay = VectorReciprocalAccurate(VectorMultiply(TwoPi, Cutoff));
+
+		OutDelay = VectorSelect(OneEuroMask, EuroDelay, VectorSelect(SpringMask, InvSpeed, InterpDelay));
+		FilterState.Value = VectorSelect(OneEuroMask, Euro, VectorSelect(SpringMask, Spring, Interp));
+		FilterState.Velocity = VectorSelect(SpringMask, SpringVelocity, Zero);
+		FilterState.LastInput = Input;
+		FilterState.InputRate = VectorSelect(OneEuroMask, InputRate, Zero);
+		return FilterState.Value;
+	}
+}
+
+namespace
+{
+	FORCEINLINE FVectorFilterState LoadFilter(const TArray<float>& Value, const TArray<float>& Velocity, const TArray<float>& LastInput, const TArray<float>& InputRate, int32 Lane)
+	{
+		FVectorFilterState FilterState;
+		FilterState.Value = VectorLoad(&Value[Lane]);
+		FilterState.Velocity = VectorLoad(&Velocity[Lane]);
+		FilterState.LastInput = VectorLoad(&LastInput[Lane]);
+		FilterState.InputRate = VectorLoad(&InputRate[Lane]);
+		return FilterState;
+	}
+
+	FORCEINLINE void StoreFilter(const VectorRegister4Float& Mask, const FVectorFilterState& NewState, const FVectorFilterState& OldState,
+		TArray<float>& Value, TArray<float>& Velocity, TArray<float>& LastInput, TArray<float>& InputRate, int32 Lane)
+	{
+		VectorStore(VectorSelect(Mask, NewState.Value, OldState.Value), &Value[Lane]);
+		VectorStore(VectorSelect(Mask, NewState.Velocity, OldState.Velocity), &Velocity[Lane]);
+		VectorStore(VectorSelect(Mask, NewState.LastInput, OldState.LastInput), &LastInput[Lane]);
+		VectorStore(VectorSelect(Mask, NewState.InputRate, OldState.InputRate), &InputRate[Lane]);
+	}
+}
+
+float FVRTPMotionModel::SmoothingToSpeed(float Smoothing)
+{
+	return FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(1, 20), Smoothing);
+}
+
+float FVRTPMotionModel::Filter(FVRTPFilterState& FilterState, float Input, float Dt, EVRTPMotionFilter Mode, float Speed, float Beta, float& OutDelay)
+{
+	switch (Mode)
+	{
+		case EVRTPMotionFilter::CriticallyDamped:
+		{
+			// Exact critically damped spring; its group delay is 2 / Omega whatever the frame rate
+			const float Omega = 2.0f * Speed;
+			const float Offset = FilterState.Value - Input;
+			const float J = FilterState.Velocity + Omega * Offset;
+			const float Decay = FMath::Exp(-Omega * Dt);
+			FilterState.Value = Input + (Offset + J * Dt) * Decay;
+			FilterState.Velocity = (FilterState.Velocity - J * Omega * Dt) * Decay;
+			FilterState.InputRate = 0.0f;
+			OutDelay = 1.0f / Speed;
+			break;
+		}
+
+		case EVRTPMotionFilter::OneEuro:
+		{
+			// Cutoff rises with the filtered input rate, so fast changes are tracked with less lag; the lag never exceeds 1 / Speed
+			const float Rate = (Input - FilterState.LastInput) / Dt;
+			FilterState.InputRate += (Rate - FilterState.InputRate) * (1.0f - FMath::Exp(-Dt * 2.0f * PI * OneEuroRateCutoff));
+			const float Cutoff = Speed / (2.0f * PI) + Beta * FMath::Abs(FilterState.InputRate);
+			FilterState.Value += (Input - FilterState.Value) * (1.0f - FMath::Exp(-Dt * 2.0f * PI * Cutoff));
+			FilterState.Velocity = 0.0f;
+			OutDelay = 1.0f / (2.0f * PI * Cutoff);
+			break;
+		}
+
+		default:
+		{
+			const float Alpha = FMath::Clamp(Dt * Speed, 0.0f, 1.0f);
+			FilterState.Value = FMath::FInterpTo(FilterState.Value, Input, Dt, Speed);
+			FilterState.Velocity = 0.0f;
+			FilterState.InputRate = 0.0f;
+			OutDelay = Dt * (1.0f - Alpha) / FMath::Max(Alpha, KINDA_SMALL_NUMBER);
+			break;
+		}
+	}
+
+	FilterState.LastInput = Input;
+	return FilterState.Value;
+}
+
+void FVRTPMotionModel::Reset()
+{
+	State = FVRTPMotionState();
+}
+
+void FVRTPMotionModel::GetRates(const FVRTPKinematics& Kinematics, float& OutAngularSpeed, FVector& OutVelocity, float& OutAccelerationRate)
+{
+	OutAngularSpeed = FMath::RadiansToDegrees((float)Kinematics.AngularVelocity.Size());
+	OutVelocity = Kinematics.Velocity;
+
+	// Only the acceleration along the direction of travel changes speed
+	const double Speed = OutVelocity.Size();
+	OutAccelerationRate = Speed > KINDA_SMALL_NUMBER
+		? FMath::Abs((float)FVector::DotProduct(Kinematics.Acceleration, OutVelocity / Speed))
+		: (float)Kinematics.Acceleration.Size();
+}
+
+void FVRTPMotionModel::ReportFilterDelay() const
+{
+	INC_FLOAT_STAT_BY(STAT_VRTP_FilterGroupDelay, FilterDelay * 1000.0f);
+	INC_DWORD_STAT(STAT_VRTP_FilterInstances);
+}
+
+FVRTPMotionResult FVRTPMotionModel::Evaluate(const FVRTPMotionSample& Sample, float Dt)
+{
+	// Paused or zero-length frames carry no motion information
+	if (Dt <= 0.0f)
+	{
+		return State.LastResult;
+	}
+
+	float AngularSpeed;
+	FVector Velocity;
+	float AccelerationRate;
+	GetRates(Sample.Kinematics, AngularSpeed, Velocity, AccelerationRate);
+
+	FVRTPMotionResult Result;
+	float RadiusTarget = 0;
+	float Delay = 0;
+
+	if (!Settings.bForceEffect)
+	{
+		if (Settings.bUseAngularVelocity)
+		{
+			float AngleDelta = AngularSpeed;
+			// Check for divide by zero
+			if (FMath::IsNearlyEqual(Settings.AngularMin, Settings.AngularMax, 0.001f)) AngleDelta = 0;
+			else AngleDelta = (AngleDelta - Settings.AngularMin) / (Settings.AngularMax - Settings.AngularMin);
+			const float AngleSmoothed = Filter(State.AngleFilter, AngleDelta, Dt, Settings.Filter, SmoothingToSpeed(Settings.AngularSmoothing), Settings.FilterBeta, Delay);
+			RadiusTarget += AngleSmoothed * (Settings.AngularStrength * 0.5f);
+			Result.FilterDelay = FMath::Max(Result.FilterDelay, Delay);
+		}
+
+		if (Settings.bUseVelocity)
+		{
+			// Filtered in the same units as the angular input, so FilterBeta scales the rate of change alike for both; clamped afterwards
+			float VelocityDelta = 0;
+			// Check for divide by zero
+			if (!FMath::IsNearlyEqual(Settings.VelocityMin, Settings.VelocityMax, 0.001f))
+			{
+				VelocityDelta = (Velocity.Size() - Settings.VelocityMin) / (Settings.VelocityMax - Settings.VelocityMin);
+			}
+			const float VelocitySmoothed = Filter(State.VelocityFilter, VelocityDelta, Dt, Settings.Filter, SmoothingToSpeed(Settings.VelocitySmoothing), Settings.FilterBeta, Delay);
+			RadiusTarget += FMath::Clamp(VelocitySmoothed, 0.0f, 1.0f) * Settings.VelocityStrength;
+			Result.FilterDelay = FMath::Max(Result.FilterDelay, Delay);
+		}
+
+		if (Settings.bUseAcceleration)
+		{
+			float AccelerationDelta = AccelerationRate;
+
+			// Check for divide by zero
+			if (!FMath::IsNearlyEqual(Settings.AccelerationMin, Settings.AccelerationMax, 0.001f))
+			{
+				AccelerationDelta = FMath::Clamp((AccelerationDelta - Settings.AccelerationMin) / (Settings.AccelerationMax - Settings.AccelerationMin), 0.0f, 1.0f);
+			}
+
+			const float AccelerationSmoothed = Filter(State.AccelerationFilter, AccelerationDelta, Dt, Settings.Filter, SmoothingToSpeed(Settings.AccelerationSmoothing), Settings.FilterBeta, Delay);
+			RadiusTarget += AccelerationSmoothed * Settings.AccelerationStrength;
+			Result.FilterDelay = FMath::Max(Result.FilterDelay, Delay);
+		}
+
+		if (Settings.bUseAngularVelocity || Settings.bUseAcceleration || Settings.bUseVelocity)
+		{
+			Result.Radius = FMath::GetMappedRangeValueClamped(FVector2D(0, 1), FVector2D(OpenRadius, 1 - Settings.EffectCoverage), RadiusTarget);
+		}
+		else
+		{
+			Result.Radius = OpenRadius;
+		}
+	}
+	else
+	{
+		Result.Radius = ForcedRadius;
+	}
+
+	if (Settings.bDirectionSpecific && Sample.bHasCamera)
+	{
+		const float StrafeFactor = FVector::DotProduct(Velocity.GetSafeNormal(), Sample.CameraRight);
+		Result.XShift = StrafeFactor * Settings.DirectionalHorizontalStrength;
+		Result.YShift = Sample.CameraForward.Z * ((OpenRadius - Result.Radius) / OpenRadius) * Settings.DirectionalVerticalStrength;
+	}
+
+	State.LastResult = Result;
+	return Result;
+}
+
+void FVRTPMotionModel::EvaluateBatch(FVRTPMotionBatch& Batch, int32 First, int32 Count)
+{
+	check(First % 4 == 0 && Count % 4 == 0 && First + Count <= Batch.Num());
+
+	const VectorRegister4Float Zero = VectorZeroFloat();
+	const VectorRegister4Float One = VectorOneFloat();
+	const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+	const VectorRegister4Float Open = VectorSetFloat1(OpenRadius);
+	const VectorRegister4Float InvOpen = VectorSetFloat1(1.0f / OpenRadius);
+	const VectorRegister4Float Forced = VectorSetFloat1(ForcedRadius);
+	const VectorRegister4Float MinLength = VectorSetFloat1(KINDA_SMALL_NUMBER);
+
+	for (int32 Lane = First; Lane < First + Count; Lane += 4)
+	{
+		const VectorRegister4Float Active = VectorMaskOf(VectorLoad(&Batch.Active[Lane]));
+		const VectorRegister4Float Dt = VectorLoad(&Batch.DeltaTime[Lane]);
+		const VectorRegister4Float InvDt = VectorLoad(&Batch.InvDeltaTime[Lane]);
+		const VectorRegister4Float OneEuro = VectorMaskOf(VectorLoad(&Batch.FilterOneEuro[Lane]));
+		const VectorRegister4Float Spring = VectorMaskOf(VectorLoad(&Batch.FilterSpring[Lane]));
+		const VectorRegister4Float Beta = VectorLoad(&Batch.FilterBeta[Lane]);
+
+		// Angular velocity
+		const VectorRegister4Float UseAngular = VectorLoad(&Batch.UseAngular[Lane]);
+		const VectorRegister4Float AngleDelta = VectorMultiply(VectorSubtract(VectorLoad(&Batch.AngularRate[Lane]), VectorLoad(&Batch.AngularMin[Lane])), VectorLoad(&Batch.AngularInvRange[Lane]));
+		const FVectorFilterState OldAngle = LoadFilter(Batch.AngleSmoothed, Batch.AngleVelocity, Batch.AngleLastInput, Batch.AngleInputRate, Lane);
+		FVectorFilterState NewAngleState = OldAngle;
+		VectorRegister4Float AngleDelay;
+		const VectorRegister4Float NewAngle = VectorFilter(NewAngleState, AngleDelta, Dt, InvDt, VectorLoad(&Batch.AngularSpeed[Lane]), Beta, OneEuro, Spring, AngleDelay);
+		VectorRegister4Float RadiusTarget = VectorMultiply(VectorMultiply(NewAngle, VectorMultiply(VectorLoad(&Batch.AngularStrength[Lane]), Half)), UseAngular);
+
+		// Velocity
+		const VectorRegister4Float UseVelocity = VectorLoad(&Batch.UseVelocity[Lane]);
+		const VectorRegister4Float VX = VectorLoad(&Batch.VelocityX[Lane]);
+		const VectorRegister4Float VY = VectorLoad(&Batch.VelocityY[Lane]);
+		const VectorRegister4Float VZ = VectorLoad(&Batch.VelocityZ[Lane]);
+		const VectorRegister4Float Speed = VectorSqrt(VectorMultiplyAdd(VX, VX, VectorMultiplyAdd(VY, VY, VectorMultiply(VZ, VZ))));
+		const VectorRegister4Float VelocityDelta = VectorMultiply(VectorSubtract(Speed, VectorLoad(&Batch.VelocityMin[Lane])), VectorLoad(&Batch.VelocityInvRange[Lane]));
+		const FVectorFilterState OldVelocity = LoadFilter(Batch.VelocitySmoothed, Batch.VelocityVelocity, Batch.VelocityLastInput, Batch.VelocityInputRate, Lane);
+		FVectorFilterState NewVelocityState = OldVelocity;
+		VectorRegister4Float VelocityDelay;
+		const VectorRegister4Float NewVelocity = VectorFilter(NewVelocityState, VelocityDelta, Dt, InvDt, VectorLoad(&Batch.VelocitySpeed[Lane]), Beta, OneEuro, Spring, VelocityDelay);
+		const VectorRegister4Float VelocityFinal = VectorClamp01(NewVelocity);
+		RadiusTarget = VectorMultiplyAdd(VectorMultiply(VectorLoad(&Batch.VelocityStrength[Lane]), VelocityFinal), UseVelocity, RadiusTarget);
+
+		// Acceleration
+		const VectorRegister4Float UseAcceleration = VectorLoad(&Batch.UseAcceleration[Lane]);
+		VectorRegister4Float AccelerationDelta = VectorLoad(&Batch.AccelerationRate[Lane]);
+		const VectorRegister4Float AccelerationNormalised = VectorClamp01(VectorMultiply(VectorSubtract(AccelerationDelta, VectorLoad(&Batch.AccelerationMin[Lane])), VectorLoad(&Batch.AccelerationInvRange[Lane])));
+		AccelerationDelta = VectorSelect(VectorMaskOf(VectorLoad(&Batch.AccelerationHasRange[Lane])), AccelerationNormalised, AccelerationDelta);
+		const FVectorFilterState OldAcceleration = LoadFilter(Batch.AccelerationSmoothed, Batch.AccelerationVelocity, Batch.AccelerationLastInput, Batch.AccelerationInputRate, Lane);
+		FVectorFilterState NewAccelerationState = OldAcceleration;
+		VectorRegister4Float AccelerationDelay;
+		const VectorRegister4Float NewAcceleration = VectorFilter(NewAccelerationState, AccelerationDelta, Dt, InvDt, VectorLoad(&Batch.AccelerationSpeed[Lane]), Beta, OneEuro, Spring, AccelerationDelay);
+		RadiusTarget = VectorMultiplyAdd(VectorMultiply(NewAcceleration, VectorLoad(&Batch.AccelerationStrength[Lane])), UseAcceleration, RadiusTarget);
+
+		// Radius
+		const VectorRegister4Float Closed = VectorSubtract(One, VectorLoad(&Batch.Coverage[Lane]));
+		VectorRegister4Float Radius = VectorMultiplyAdd(VectorSubtract(Closed, Open), VectorClamp01(RadiusTarget), Open);
+		Radius = VectorSelect(VectorMaskOf(VectorLoad(&Batch.UseAny[Lane])), Radius, Open);
+		Radius = VectorSelect(VectorMaskOf(VectorLoad(&Batch.ForceEffect[Lane])), Forced, Radius);
+
+		// Direction-specific shift
+		const VectorRegister4Float Direction = VectorLoad(&Batch.Direction[Lane]);
+		const VectorRegister4Float InvSpeed = VectorSelect(VectorCompareGT(Speed, MinLength), VectorReciprocalAccurate(VectorMax(Speed, MinLength)), Zero);
+		const VectorRegister4Float StrafeDot = VectorMultiplyAdd(VX, VectorLoad(&Batch.CameraRightX[Lane]), VectorMultiplyAdd(VY, VectorLoad(&Batch.CameraRightY[Lane]), VectorMultiply(VZ, VectorLoad(&Batch.CameraRightZ[Lane]))));
+		const VectorRegister4Float XShift = VectorMultiply(VectorMultiply(VectorMultiply(StrafeDot, InvSpeed), VectorLoad(&Batch.HorizontalStrength[Lane])), Direction);
+		const VectorRegister4Float Closure = VectorMultiply(VectorSubtract(Open, Radius), InvOpen);
+		const VectorRegister4Float YShift = VectorMultiply(VectorMultiply(VectorMultiply(VectorLoad(&Batch.CameraForwardZ[Lane]), Closure), VectorLoad(&Batch.VerticalStrength[Lane])), Direction);
+
+		// Only active lanes advance their state; smoothed values only advance while their motion type is enabled
+		const VectorRegister4Float NotForced = VectorBitwiseAnd(Active, VectorCompareEQ(VectorLoad(&Batch.ForceEffect[Lane]), Zero));
+		const VectorRegister4Float AngleMask = VectorBitwiseAnd(NotForced, VectorMaskOf(UseAngular));
+		const VectorRegister4Float VelocityMask = VectorBitwiseAnd(NotForced, VectorMaskOf(UseVelocity));
+		const VectorRegister4Float AccelerationMask = VectorBitwiseAnd(NotForced, VectorMaskOf(UseAcceleration));
+		StoreFilter(AngleMask, NewAngleState, OldAngle, Batch.AngleSmoothed, Batch.AngleVelocity, Batch.AngleLastInput, Batch.AngleInputRate, Lane);
+		StoreFilter(VelocityMask, NewVelocityState, OldVelocity, Batch.VelocitySmoothed, Batch.VelocityVelocity, Batch.VelocityLastInput, Batch.VelocityInputRate, Lane);
+		StoreFilter(AccelerationMask, NewAccelerationState, OldAcceleration, Batch.AccelerationSmoothed, Batch.AccelerationVelocity, Batch.AccelerationLastInput, Batch.AccelerationInputRate, Lane);
+
+		VectorRegister4Float FilterDelay = VectorSelect(AngleMask, AngleDelay, Zero);
+		FilterDelay = VectorMax(FilterDelay, VectorSelect(VelocityMask, VelocityDelay, Zero));
+		FilterDelay = VectorMax(FilterDelay, VectorSelect(AccelerationMask, AccelerationDelay, Zero));
+		VectorStore(FilterDelay, &Batch.FilterDelay[Lane]);
+
+		VectorStore(Radius, &Batch.Radius[Lane]);
+		VectorStore(XShift, &Batch.XShift[Lane]);
+		VectorStore(YShift, &Batch.YShift[Lane]);
+	}
+}
+
+void FVRTPMotionBatch::Reserve(int32 NumInstances)
+{
+	const int32 NumLanes = Align(NumInstances, 4);
+	if (NumLanes <= Num())
+	{
+		return;
+	}
+
+	for (TArray<float> FVRTPMotionBatch::* Stream : FrameStreams)
+	{
+		(this->*Stream).SetNumZeroed(NumLanes);
+	}
+	for (TArray<float> FVRTPMotionBatch::* Stream : PersistentStreams)
+	{
+		(this->*Stream).SetNumZeroed(NumLanes);
+	}
+}
+
+void FVRTPMotionBatch::ResetLane(int32 Lane)
+{
+	for (TArray<float> FVRTPMotionBatch::* Stream : FrameStreams)
+	{
+		(this->*Stream)[Lane] = 0.0f;
+	}
+	for (TArray<float> FVRTPMotionBatch::* Stream : PersistentStreams)
+	{
+		(this->*Stream)[Lane] = 0.0f;
+	}
+	Radius[Lane] = FVRTPMotionModel::OpenRadius;
+}
+
+void FVRTPMotionBatch::Write(int32 Lane, const FVRTPMotionSettings& Settings, const FVRTPMotionSample& Sample, float Dt)
+{
+	check(Dt > 0.0f);
+
+	float SampleAngularRate;
+	FVector SampleVelocity;
+	float SampleAccelerationRate;
+	FVRTPMotionModel::GetRates(Sample.Kinematics, SampleAngularRate, SampleVelocity, SampleAccelerationRate);
+
+	// Inputs
+	Active[Lane] = 1.0f;
+	DeltaTime[Lane] = Dt;
+	InvDeltaTime[Lane] = 1.0f / Dt;
+	AngularRate[Lane] = SampleAngularRate;
+	VelocityX[Lane] = SampleVelocity.X;
+	VelocityY[Lane] = SampleVelocity.Y;
+	VelocityZ[Lane] = SampleVelocity.Z;
+	AccelerationRate[Lane] = SampleAccelerationRate;
+	CameraRightX[Lane] = Sample.CameraRight.X;
+	CameraRightY[Lane] = Sample.CameraRight.Y;
+	CameraRightZ[Lane] = Sample.CameraRight.Z;
+	CameraForwardZ[Lane] = Sample.CameraForward.Z;
+
+	// Settings, with the divide-by-zero checks of Evaluate folded into the reciprocal ranges
+	const bool bAngularRange = !FMath::IsNearlyEqual(Settings.AngularMin, Settings.AngularMax, 0.001f);
+	const bool bVelocityRange = !FMath::IsNearlyEqual(Settings.VelocityMin, Settings.VelocityMax, 0.001f);
+	const bool bAccelerationRange = !FMath::IsNearlyEqual(Settings.AccelerationMin, Settings.AccelerationMax, 0.001f);
+
+	ForceEffect[Lane] = Settings.bForceEffect ? 1.0f : 0.0f;
+	UseAny[Lane] = (Settings.bUseAngularVelocity || Settings.bUseVelocity || Settings.bUseAcceleration) ? 1.0f : 0.0f;
+	UseAngular[Lane] = Settings.bUseAngularVelocity ? 1.0f : 0.0f;
+	UseVelocity[Lane] = Settings.bUseVelocity ? 1.0f : 0.0f;
+	UseAcceleration[Lane] = Settings.bUseAcceleration ? 1.0f : 0.0f;
+	Direction[Lane] = (Settings.bDirectionSpecific && Sample.bHasCamera) ? 1.0f : 0.0f;
+	Coverage[Lane] = Settings.EffectCoverage;
+
+	AngularStrength[Lane] = Settings.AngularStrength;
+	AngularMin[Lane] = bAngularRange ? Settings.AngularMin : 0.0f;
+	AngularInvRange[Lane] = bAngularRange ? 1.0f / (Settings.AngularMax - Settings.AngularMin) : 0.0f;
+	AngularSpeed[Lane] = FVRTPMotionModel::SmoothingToSpeed(Settings.AngularSmoothing);
+
+	VelocityStrength[Lane] = Settings.VelocityStrength;
+	VelocityMin[Lane] = Settings.VelocityMin;
+	VelocityInvRange[Lane] = bVelocityRange ? 1.0f / (Settings.VelocityMax - Settings.VelocityMin) : 0.0f;
+	VelocitySpeed[Lane] = FVRTPMotionModel::SmoothingToSpeed(Settings.VelocitySmoothing);
+
+	AccelerationStrength[Lane] = Settings.AccelerationStrength;
+	AccelerationMin[Lane] = Settings.AccelerationMin;
+	AccelerationInvRange[Lane] = bAccelerationRange ? 1.0f / (Settings.AccelerationMax - Settings.AccelerationMin) : 0.0f;
+	AccelerationHasRange[Lane] = bAccelerationRange ? 1.0f : 0.0f;
+	AccelerationSpeed[Lane] = FVRTPMotionModel::SmoothingToSpeed(Settings.AccelerationSmoothing);
+
+	VerticalStrength[Lane] = Settings.DirectionalVerticalStrength;
+	HorizontalStrength[Lane] = Settings.DirectionalHorizontalStrength;
+
+	FilterOneEuro[Lane] = (Settings.Filter == EVRTPMotionFilter::OneEuro) ? 1.0f : 0.0f;
+	FilterSpring[Lane] = (Settings.Filter == EVRTPMotionFilter::CriticallyDamped) ? 1.0f : 0.0f;
+	FilterBeta[Lane] = Settings.FilterBeta;
+}
+
+FVRTPMotionResult FVRTPMotionBatch::Read(int32 Lane) const
+{
+	FVRTPMotionResult Result;
+	Result.Radius = Radius[Lane];
+	Result.XShift = XShift[Lane];
+	Result.YShift = YShift[Lane];
+	Result.FilterDelay = FilterDelay[Lane];
+	return Result;
+}
+
+void FVRTPMotionBatch::EndFrame()
+{
+	for (TArray<float> FVRTPMotionBatch::* Stream : FrameStreams)
+	{
+		FMemory::Memzero((this->*Stream).GetData(), (this->*Stream).Num() * sizeof(float));
+	}
+}
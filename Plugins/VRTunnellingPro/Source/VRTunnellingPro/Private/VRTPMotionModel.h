@@ -0,0 +1,223 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VRTPPoseHistory.h"
+
+/// Smoothing filter applied to each motion type
+enum class EVRTPMotionFilter : uint8
+{
+	/// FMath::FInterpTo; effective lag depends on frame rate
+	Interp,
+	/// One-Euro filter; lag shrinks as the input changes faster
+	OneEuro,
+	/// Critically damped spring; fixed lag at any frame rate
+	CriticallyDamped
+};
+
+/// Motion settings used by the motion model, mirrored from the component (or preset) properties
+struct FVRTPMotionSettings
+{
+	bool bForceEffect = false;
+	float EffectCoverage = 0.0f;
+
+	EVRTPMotionFilter Filter = EVRTPMotionFilter::Interp;
+	float FilterBeta = 0.0f;
+
+	bool bDirectionSpecific = false;
+	float DirectionalVerticalStrength = 0.0f;
+	float DirectionalHorizontalStrength = 0.0f;
+
+	bool bUseAngularVelocity = false;
+	float AngularStrength = 0.0f;
+	float AngularMin = 0.0f;
+	float AngularMax = 0.0f;
+	float AngularSmoothing = 0.0f;
+
+	bool bUseVelocity = false;
+	float VelocityStrength = 0.0f;
+	float VelocityMin = 0.0f;
+	float VelocityMax = 0.0f;
+	float VelocitySmoothing = 0.0f;
+
+	bool bUseAcceleration = false;
+	float AccelerationStrength = 0.0f;
+	float AccelerationMin = 0.0f;
+	float AccelerationMax = 0.0f;
+	float AccelerationSmoothing = 0.0f;
+};
+
+/// A single frame of input for the motion model, gathered once per tick from the owning actor and camera
+struct FVRTPMotionSample
+{
+	FVector Forward = FVector::ForwardVector;
+	FVector Right = FVector::RightVector;
+	FVector Up = FVector::UpVector;
+
+	/// Owner motion, fitted from its pose history
+	FVRTPKinematics Kinematics;
+
+	/// Camera basis, only required for direction-specific tunnelling
+	FVector CameraForward = FVector::ForwardVector;
+	FVector CameraRight = FVector::RightVector;
+	bool bHasCamera = false;
+};
+
+/// Motion model output
+struct FVRTPMotionResult
+{
+	float Radius = 1.5f;
+	float XShift = 0.0f;
+	float YShift = 0.0f;
+
+	/// Estimated group delay of the smoothing filters in seconds (largest of the enabled motion types)
+	float FilterDelay = 0.0f;
+};
+
+/// State of one smoothing filter
+struct FVRTPFilterState
+{
+	float Value = 0.0f;
+
+	/// Critically damped spring velocity
+	float Velocity = 0.0f;
+
+	/// One-Euro previous input and filtered input rate
+	float LastInput = 0.0f;
+	float InputRate = 0.0f;
+};
+
+/// State carried between frames by the motion model
+struct FVRTPMotionState
+{
+	FVRTPFilterState AngleFilter;
+	FVRTPFilterState VelocityFilter;
+	FVRTPFilterState AccelerationFilter;
+
+	FVRTPMotionResult LastResult;
+};
+
+/// Engine-free tunnelling motion model, shared by the desktop and mobile components.
+/// Only depends on Core, so it can be evaluated without a world, component or RHI.
+class FVRTPMotionModel
+{
+public:
+	/// Radius at which the vignette is fully open
+	static constexpr float OpenRadius = 1.5f;
+
+	/// Radius used when the effect is forced on
+	static constexpr float ForcedRadius = 0.3f;
+
+	FVRTPMotionSettings Settings;
+	FVRTPMotionState State;
+
+	/// Group delay of the latest result, whichever path evaluated it; reported by ReportFilterDelay as each result is applied
+	float FilterDelay = 0.0f;
+
+	/// Advance the model by Dt seconds and return the new vignette radius and shift
+	FVRTPMotionResult Evaluate(const FVRTPMotionSample& Sample, float Dt);
+
+	/// Forget all filter history
+	void Reset();
+
+	/// Rates the model responds to: angular speed in degrees per second, velocity, and the rate of change of speed
+	static void GetRates(const FVRTPKinematics& Kinematics, float& OutAngularSpeed, FVector& OutVelocity, float& OutAccelerationRate);
+
+	/// Add FilterDelay to the stats system. The counter sums every model reported this frame, alongside the number of models.
+	void ReportFilterDelay() const;
+
+	/// Map a 0..1 smoothing value to a filter speed (the inverse of the filter's time constant)
+	static float SmoothingToSpeed(float Smoothing);
+
+	/// Advance one smoothing filter towards Input. All modes share the time constant 1 / Speed when the input is steady;
+	/// OutDelay receives the filter's current group delay in seconds.
+	static float Filter(FVRTPFilterState& FilterState, float Input, float Dt, EVRTPMotionFilter Mode, float Speed, float Beta, float& OutDelay);
+
+	/// Vectorised equivalent of Evaluate for lanes [First, First + Count) of a batch. First and Count must be multiples of four.
+	static void EvaluateBatch(struct FVRTPMotionBatch& Batch, int32 First, int32 Count);
+};
+
+/// Structure-of-arrays motion data for many instances, evaluated four lanes at a time by FVRTPMotionModel::EvaluateBatch.
+/// Stream lengths are always a multiple of four; lanes without a submitted sample are evaluated but keep their state.
+/// Rates are computed per lane by Write, since each instance fits its own pose history.
+struct FVRTPMotionBatch
+{
+	// Per-frame inputs, cleared by EndFrame
+	TArray<float> Active;
+	TArray<float> DeltaTime;
+	TArray<float> InvDeltaTime;
+	TArray<float> AngularRate;
+	TArray<float> VelocityX;
+	TArray<float> VelocityY;
+	TArray<float> VelocityZ;
+	TArray<float> AccelerationRate;
+	TArray<float> CameraRightX;
+	TArray<float> CameraRightY;
+	TArray<float> CameraRightZ;
+	TArray<float> CameraForwardZ;
+
+	// Settings, folded into lane masks (0 or 1) and reciprocal ranges
+	TArray<float> ForceEffect;
+	TArray<float> UseAny;
+	TArray<float> UseAngular;
+	TArray<float> UseVelocity;
+	TArray<float> UseAcceleration;
+	TArray<float> Direction;
+	TArray<float> Coverage;
+	TArray<float> AngularStrength;
+	TArray<float> AngularMin;
+	TArray<float> AngularInvRange;
+	TArray<float> AngularSpeed;
+	TArray<float> VelocityStrength;
+	TArray<float> VelocityMin;
+	TArray<float> VelocityInvRange;
+	TArray<float> VelocitySpeed;
+	TArray<float> AccelerationStrength;
+	TArray<float> AccelerationMin;
+	TArray<float> AccelerationInvRange;
+	TArray<float> AccelerationHasRange;
+	TArray<float> AccelerationSpeed;
+	TArray<float> VerticalStrength;
+	TArray<float> HorizontalStrength;
+	TArray<float> FilterOneEuro;
+	TArray<float> FilterSpring;
+	TArray<float> FilterBeta;
+
+	// State carried between frames
+	TArray<float> AngleSmoothed;
+	TArray<float> AngleVelocity;
+	TArray<float> AngleLastInput;
+	TArray<float> AngleInputRate;
+	TArray<float> VelocitySmoothed;
+	TArray<float> VelocityVelocity;
+	TArray<float> VelocityLastInput;
+	TArray<float> VelocityInputRate;
+	TArray<float> AccelerationSmoothed;
+	TArray<float> AccelerationVelocity;
+	TArray<float> AccelerationLastInput;
+	TArray<float> AccelerationInputRate;
+
+	// Outputs
+	TArray<float> Radius;
+	TArray<float> XShift;
+	TArray<float> YShift;
+	TArray<float> FilterDelay;
+
+	/// Number of lanes (a multiple of four)
+	int32 Num() const { return Active.Num(); }
+
+	/// Grow every stream to hold at least NumInstances lanes, rounded up to a multiple of four
+	void Reserve(int32 NumInstances);
+
+	/// Clear the state of a lane
+	void ResetLane(int32 Lane);
+
+	/// Fold settings and a new sample into a lane and mark it active for this frame
+	void Write(int32 Lane, const FVRTPMotionSettings& Settings, const FVRTPMotionSample& Sample, float Dt);
+
+	/// Read a lane's output
+	FVRTPMotionResult Read(int32 Lane) const;
+
+	/// Clear the per-frame inputs of every lane
+	void EndFrame();
+};
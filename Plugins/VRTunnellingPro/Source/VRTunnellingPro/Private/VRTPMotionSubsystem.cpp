@@ -0,0 +1,130 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPMotionSubsystem.h"
+#include "Engine/World.h"
+#include "Async/ParallelFor.h"
+#include "HAL/IConsoleManager.h"
+#include "VRTPStats.h"
+
+DECLARE_CYCLE_STAT(TEXT("Motion Batch"), STAT_VRTP_MotionBatch, STATGROUP_VRTunnelling);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Motion Instances"), STAT_VRTP_MotionInstances, STATGROUP_VRTunnelling);
+
+namespace {
+	TAutoConsoleVariable<int32> CVarBatchMotion(
+		TEXT("vr.Tunnelling.BatchMotion"),
+		1,
+		TEXT("Whether tunnelling motion is evaluated in one batch per world instead of per component.\n")
+		TEXT(" 0: evaluate per component\n")
+		TEXT(" 1: evaluate in a batch (default)"),
+		ECVF_Default);
+
+	TAutoConsoleVariable<int32> CVarBatchParallelThreshold(
+		TEXT("vr.Tunnelling.BatchParallelThreshold"),
+		256,
+		TEXT("Number of tunnelling instances above which the motion batch is split across worker threads."),
+		ECVF_Default);
+
+	/// Lanes per ParallelFor task; a multiple of four
+	constexpr int32 LanesPerTask = 128;
+} // anonymous namespace
+
+UVRTPMotionSubsystem* UVRTPMotionSubsystem::GetBatched(const UWorld* World)
+{
+	if (World && CVarBatchMotion.GetValueOnGameThread() != 0)
+	{
+		return World->GetSubsystem<UVRTPMotionSubsystem>();
+	}
+	return nullptr;
+}
+
+bool UVRTPMotionSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+int32 UVRTPMotionSubsystem::RegisterInstance(FVRTPOnMotionEvaluated&& OnEvaluated)
+{
+	int32 Instance;
+	if (FreeLanes.Num() > 0)
+	{
+		Instance = FreeLanes.Pop();
+		Listeners[Instance] = MoveTemp(OnEvaluated);
+	}
+	else
+	{
+		Instance = Listeners.Add(MoveTemp(OnEvaluated));
+		Batch.Reserve(Listeners.Num());
+	}
+
+	Batch.ResetLane(Instance);
+	return Instance;
+}
+
+void UVRTPMotionSubsystem::UnregisterInstance(int32 Instance)
+{
+	if (Listeners.IsValidIndex(Instance) && Listeners[Instance].IsBound())
+	{
+		Listeners[Instance].Unbind();
+		Batch.ResetLane(Instance);
+		Submitted.Remove(Instance);
+		FreeLanes.Add(Instance);
+	}
+}
+
+bool UVRTPMotionSubsystem::SubmitSample(int32 Instance, const FVRTPMotionSettings& Settings, const FVRTPMotionSample& Sample, float DeltaTime)
+{
+	if (DeltaTime <= 0.0f || !Listeners.IsValidIndex(Instance) || !Listeners[Instance].IsBound())
+	{
+		return false;
+	}
+
+	if (Batch.Active[Instance] == 0.0f)
+	{
+		Submitted.Add(Instance);
+	}
+	Batch.Write(Instance, Settings, Sample, DeltaTime);
+	return true;
+}
+
+void UVRTPMotionSubsystem::Tick(float DeltaTime)
+{
+	if (Submitted.Num() == 0)
+	{
+		return;
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_VRTP_MotionBatch);
+		SET_DWORD_STAT(STAT_VRTP_MotionInstances, Submitted.Num());
+
+		const int32 NumLanes = Batch.Num();
+		if (NumLanes > CVarBatchParallelThreshold.GetValueOnGameThread())
+		{
+			const int32 NumTasks = FMath::DivideAndRoundUp(NumLanes, LanesPerTask);
+			ParallelFor(NumTasks, [this, NumLanes](int32 Task)
+			{
+				const int32 First = Task * LanesPerTask;
+				FVRTPMotionModel::EvaluateBatch(Batch, First, FMath::Min(LanesPerTask, NumLanes - First));
+			});
+		}
+		else
+		{
+			FVRTPMotionModel::EvaluateBatch(Batch, 0, NumLanes);
+		}
+	}
+
+	// Scatter; callbacks may register or unregister instances, so work from a copy of this frame's lanes
+	TArray<int32> Evaluated = MoveTemp(Submitted);
+	Batch.EndFrame();
+	for (int32 Instance : Evaluated)
+	{
+		if (Listeners.IsValidIndex(Instance))
+		{
+			Listeners[Instance].ExecuteIfBound(Batch.Read(Instance));
+		}
+	}
+}
+
+TStatId UVRTPMotionSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UVRTPMotionSubsystem, STATGROUP_Tickables);
+}
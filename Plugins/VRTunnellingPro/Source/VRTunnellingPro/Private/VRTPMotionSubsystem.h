@@ -0,0 +1,50 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "VRTPMotionModel.h"
+#include "VRTPMotionSubsystem.generated.h"
+
+/// Called with an instance's motion result once the batch has been evaluated
+DECLARE_DELEGATE_OneParam(FVRTPOnMotionEvaluated, const FVRTPMotionResult&);
+
+/// World-level tunnelling manager. Components submit one motion sample per tick; after all tick groups have run,
+/// every submitted sample is evaluated in a single vectorised pass and the results are handed back to the components.
+UCLASS()
+class UVRTPMotionSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/// Returns the subsystem for World if batched evaluation is enabled (vr.Tunnelling.BatchMotion), otherwise null
+	static UVRTPMotionSubsystem* GetBatched(const UWorld* World);
+
+	/// Allocate a lane for a new instance; OnEvaluated is called every frame the instance submits a sample
+	int32 RegisterInstance(FVRTPOnMotionEvaluated&& OnEvaluated);
+
+	/// Release a lane allocated by RegisterInstance
+	void UnregisterInstance(int32 Instance);
+
+	/// Queue a sample for this frame's batch. Frames with a non-positive DeltaTime are ignored.
+	/// Returns true if the sample was queued, in which case OnEvaluated is called once the batch has been evaluated.
+	bool SubmitSample(int32 Instance, const FVRTPMotionSettings& Settings, const FVRTPMotionSample& Sample, float DeltaTime);
+
+	//~ FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	virtual bool IsTickableWhenPaused() const override { return true; }
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+private:
+	FVRTPMotionBatch Batch;
+
+	// Per-lane result callbacks; unbound for free lanes
+	TArray<FVRTPOnMotionEvaluated> Listeners;
+	TArray<int32> FreeLanes;
+
+	// Lanes that submitted a sample this frame
+	TArray<int32> Submitted;
+};
@@ -0,0 +1,185 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPParameterBlock.h"
+#include "Materials/MaterialInstanceDynamic.h"
+#include "Materials/MaterialParameterCollectionInstance.h"
+
+namespace {
+	const FName ScalarNames[] = { TEXT("Radius"), TEXT("XShift"), TEXT("YShift"), TEXT("Feather") };
+	const FName VectorNames[] = { TEXT("Up"), TEXT("Right"), TEXT("Forward"), TEXT("EffectColor") };
+
+	FName CollectionName(const FName& Name, int32 PlayerIndex)
+	{
+		return PlayerIndex == 0 ? Name : FName(*FString::Printf(TEXT("%s_%d"), *Name.ToString(), PlayerIndex));
+	}
+
+	static_assert(UE_ARRAY_COUNT(ScalarNames) == (int32)EVRTPScalarParameter::Num, "Missing scalar parameter name");
+	static_assert(UE_ARRAY_COUNT(VectorNames) == (int32)EVRTPVectorParameter::Num, "Missing vector parameter name");
+
+	const FLinearColor UnsetVector(FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX);
+} // anonymous namespace
+
+FVRTPParameterBlock::FVRTPParameterBlock()
+{
+	for (int32 Index = 0; Index < NumScalars; ++Index)
+	{
+		Scalars[Index] = FlushedScalars[Index] = FLT_MAX;
+	}
+	for (int32 Index = 0; Index < NumVectors; ++Index)
+	{
+		Vectors[Index] = FlushedVectors[Index] = UnsetVector;
+	}
+}
+
+void FVRTPParameterBlock::AddTarget(UMaterialInstanceDynamic* MID)
+{
+	if (!MID)
+	{
+		return;
+	}
+
+	FTarget& Target = Targets.AddDefaulted_GetRef();
+	Target.MID = MID;
+	const bool bWriteNow = !Collection.IsValid();
+	for (int32 Index = 0; Index < NumScalars; ++Index)
+	{
+		Target.ScalarIndices[Index] = Unresolved;
+		if (bWriteNow && FlushedScalars[Index] != FLT_MAX)
+		{
+			WriteScalar(Target, Index);
+		}
+	}
+	for (int32 Index = 0; Index < NumVectors; ++Index)
+	{
+		Target.VectorIndices[Index] = Unresolved;
+		if (bWriteNow && FlushedVectors[Index] != UnsetVector)
+		{
+			WriteVector(Target, Index);
+		}
+	}
+}
+
+void FVRTPParameterBlock::RemoveTarget(UMaterialInstanceDynamic* MID)
+{
+	Targets.RemoveAllSwap([MID](const FTarget& Target) { return Target.MID == MID; });
+}
+
+void FVRTPParameterBlock::ClearTargets()
+{
+	Targets.Reset();
+}
+
+void FVRTPParameterBlock::SetCollection(UMaterialParameterCollectionInstance* Instance, int32 PlayerIndex)
+{
+	const FName FirstName = CollectionName(ScalarNames[0], PlayerIndex);
+	if (Collection.Get() == Instance && (!Instance || CollectionScalarNames[0] == FirstName))
+	{
+		return;
+	}
+
+	// The flushed values describe the previous destination; the MIDs in particular missed every change made while publishing to a collection
+	Collection = Instance;
+	InvalidateFlushed();
+	for (int32 Index = 0; Index < NumScalars; ++Index)
+	{
+		CollectionScalarNames[Index] = CollectionName(ScalarNames[Index], PlayerIndex);
+	}
+	for (int32 Index = 0; Index < NumVectors; ++Index)
+	{
+		CollectionVectorNames[Index] = CollectionName(VectorNames[Index], PlayerIndex);
+	}
+}
+
+void FVRTPParameterBlock::InvalidateFlushed()
+{
+	for (int32 Index = 0; Index < NumScalars; ++Index)
+	{
+		FlushedScalars[Index] = FLT_MAX;
+	}
+	for (int32 Index = 0; Index < NumVectors; ++Index)
+	{
+		FlushedVectors[Index] = UnsetVector;
+	}
+}
+
+void FVRTPParameterBlock::SetScalar(EVRTPScalarParameter Parameter, float Value)
+{
+	Scalars[(int32)Parameter] = Value;
+}
+
+void FVRTPParameterBlock::SetVector(EVRTPVectorParameter Parameter, const FVector& Value)
+{
+	Vectors[(int32)Parameter] = FLinearColor(Value);
+}
+
+void FVRTPParameterBlock::Flush()
+{
+	// Targets whose MID has been garbage collected are dropped
+	Targets.RemoveAllSwap([](const FTarget& Target) { return !Target.MID.IsValid(); });
+
+	// The collection instance batches its changes into a single uniform buffer update per frame
+	UMaterialParameterCollectionInstance* CollectionInstance = Collection.Get();
+
+	for (int32 Index = 0; Index < NumScalars; ++Index)
+	{
+		if (Scalars[Index] == FLT_MAX || FMath::IsNearlyEqual(Scalars[Index], FlushedScalars[Index], Tolerance))
+		{
+			continue;
+		}
+
+		FlushedScalars[Index] = Scalars[Index];
+		if (CollectionInstance)
+		{
+			CollectionInstance->SetScalarParameterValue(CollectionScalarNames[Index], FlushedScalars[Index]);
+			continue;
+		}
+		for (FTarget& Target : Targets)
+		{
+			WriteScalar(Target, Index);
+		}
+	}
+
+	for (int32 Index = 0; Index < NumVectors; ++Index)
+	{
+		if (Vectors[Index] == UnsetVector || Vectors[Index].Equals(FlushedVectors[Index], Tolerance))
+		{
+			continue;
+		}
+
+		FlushedVectors[Index] = Vectors[Index];
+		if (CollectionInstance)
+		{
+			CollectionInstance->SetVectorParameterValue(CollectionVectorNames[Index], FlushedVectors[Index]);
+			continue;
+		}
+		for (FTarget& Target : Targets)
+		{
+			WriteVector(Target, Index);
+		}
+	}
+}
+
+void FVRTPParameterBlock::WriteScalar(FTarget& Target, int32 Parameter)
+{
+	int32& ParameterIndex = Target.ScalarIndices[Parameter];
+	if (ParameterIndex == Unresolved)
+	{
+		Target.MID->InitializeScalarParameterAndGetIndex(ScalarNames[Parameter], FlushedScalars[Parameter], ParameterIndex);
+	}
+	else if (ParameterIndex != INDEX_NONE)
+	{
+		Target.MID->SetScalarParameterByIndex(ParameterIndex, FlushedScalars[Parameter]);
+	}
+}
+
+void FVRTPParameterBlock::WriteVector(FTarget& Target, int32 Parameter)
+{
+	int32& ParameterIndex = Target.VectorIndices[Parameter];
+	if (ParameterIndex == Unresolved)
+	{
+		Target.MID->InitializeVectorParameterAndGetIndex(VectorNames[Parameter], FlushedVectors[Parameter], ParameterIndex);
+	}
+	else if (ParameterIndex != INDEX_NONE)
+	{
+		Target.MID->SetVectorParameterByIndex(ParameterIndex, FlushedVectors[Parameter]);
+	}
+}
@@ -0,0 +1,93 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/WeakObjectPtr.h"
+
+class UMaterialInstanceDynamic;
+class UMaterialParameterCollectionInstance;
+
+/// Scalar material parameters written every frame
+enum class EVRTPScalarParameter : uint8
+{
+	Radius,
+	XShift,
+	YShift,
+	Feather,
+	Num
+};
+
+/// Vector material parameters written every frame
+enum class EVRTPVectorParameter : uint8
+{
+	Up,
+	Right,
+	Forward,
+	EffectColor,
+	Num
+};
+
+/// Effect parameters shared by all of a component's material instances.
+/// Values are staged with SetScalar / SetVector; Flush then writes only the values that moved by more than a small tolerance
+/// since the last flush, either to every target MID by cached parameter index, or once to a material parameter collection.
+class FVRTPParameterBlock
+{
+public:
+	/// Changes smaller than this are not worth a uniform buffer update
+	static constexpr float Tolerance = 1.e-4f;
+
+	FVRTPParameterBlock();
+
+	/// Write the flushed values to a new MID (unless publishing to a collection). Parameter indices are cached per MID the first time each parameter is written to it;
+	/// parameters that have never been set are left at the material's defaults.
+	void AddTarget(UMaterialInstanceDynamic* MID);
+
+	/// Stop writing to a MID, e.g. one that is swapped out but kept for later
+	void RemoveTarget(UMaterialInstanceDynamic* MID);
+
+	/// Forget every target
+	void ClearTargets();
+
+	/// Publish to a parameter collection instead of the target MIDs, whose materials are then expected to read the collection.
+	/// Player 0 uses the plain parameter names (e.g. "Radius"); other players append their index (e.g. "Radius_1").
+	/// Pass null to go back to writing the MIDs. Whenever the destination changes, the next Flush rewrites every staged value to it.
+	void SetCollection(UMaterialParameterCollectionInstance* Instance, int32 PlayerIndex);
+
+	void SetScalar(EVRTPScalarParameter Parameter, float Value);
+	void SetVector(EVRTPVectorParameter Parameter, const FVector& Value);
+
+	/// Push the changed values to every target. Called once per frame by the owning component; setters only stage.
+	void Flush();
+
+private:
+	static constexpr int32 NumScalars = (int32)EVRTPScalarParameter::Num;
+	static constexpr int32 NumVectors = (int32)EVRTPVectorParameter::Num;
+
+	/// Parameter index of a target that has not been looked up yet
+	static constexpr int32 Unresolved = INDEX_NONE - 1;
+
+	struct FTarget
+	{
+		TWeakObjectPtr<UMaterialInstanceDynamic> MID;
+		int32 ScalarIndices[NumScalars];
+		int32 VectorIndices[NumVectors];
+	};
+
+	/// Forget what was flushed, so the next Flush writes every staged value
+	void InvalidateFlushed();
+
+	void WriteScalar(FTarget& Target, int32 Parameter);
+	void WriteVector(FTarget& Target, int32 Parameter);
+
+	TArray<FTarget, TInlineAllocator<3>> Targets;
+
+	TWeakObjectPtr<UMaterialParameterCollectionInstance> Collection;
+	FName CollectionScalarNames[NumScalars];
+	FName CollectionVectorNames[NumVectors];
+
+	/// Staged values, and the values last written to the targets (FLT_MAX until first set)
+	float Scalars[NumScalars];
+	float FlushedScalars[NumScalars];
+	FLinearColor Vectors[NumVectors];
+	FLinearColor FlushedVectors[NumVectors];
+};
@@ -0,0 +1,65 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPPermutations.h"
+#include "Materials/Material.h"
+
+namespace {
+	constexpr int32 MaskShift = 2;
+	constexpr int32 ColorBit = 1 << 4;
+	constexpr int32 OverrideBit = 1 << 5;
+
+	/// Skybox background, in both the desktop and mobile enums
+	constexpr uint8 BackgroundSkybox = 1;
+
+	const FName BackgroundSwitches[] = { TEXT("StaticBackgroundColor"), TEXT("StaticBackgroundSkybox"), TEXT("StaticBackgroundBlur") };
+	const TCHAR* BackgroundNames[] = { TEXT("Color"), TEXT("Skybox"), TEXT("Blur") };
+
+	/// Off has no switch of its own
+	const FName MaskSwitches[] = { NAME_None, TEXT("StaticMaskOn"), TEXT("StaticMaskWindow"), TEXT("StaticMaskPortal") };
+	const TCHAR* MaskNames[] = { TEXT("Off"), TEXT("Mask"), TEXT("Window"), TEXT("Portal") };
+} // anonymous namespace
+
+int32 FVRTPMaterialPermutation::MakeKey(uint8 BackgroundMode, uint8 MaskMode, bool bApplyEffectColor, bool bCubeMapOverride)
+{
+	int32 Key = (BackgroundMode & 3) | ((MaskMode & 3) << MaskShift);
+	if (bApplyEffectColor)
+	{
+		Key |= ColorBit;
+	}
+	if (bCubeMapOverride && BackgroundMode == BackgroundSkybox)
+	{
+		Key |= OverrideBit;
+	}
+	return Key;
+}
+
+void FVRTPMaterialPermutation::GetStaticSwitches(int32 Key, TArray<TPair<FName, bool>>& OutSwitches)
+{
+	const int32 BackgroundMode = FMath::Min<int32>(Key & 3, UE_ARRAY_COUNT(BackgroundSwitches) - 1);
+	const int32 MaskMode = (Key >> MaskShift) & 3;
+
+	for (int32 Index = 0; Index < UE_ARRAY_COUNT(BackgroundSwitches); ++Index)
+	{
+		OutSwitches.Emplace(BackgroundSwitches[Index], Index == BackgroundMode);
+	}
+	for (int32 Index = 1; Index < UE_ARRAY_COUNT(MaskSwitches); ++Index)
+	{
+		OutSwitches.Emplace(MaskSwitches[Index], Index == MaskMode);
+	}
+	OutSwitches.Emplace(TEXT("StaticApplyEffectColor"), (Key & ColorBit) != 0);
+	OutSwitches.Emplace(TEXT("StaticCubeMapOverride"), (Key & OverrideBit) != 0);
+}
+
+FString FVRTPMaterialPermutation::GetKeyName(int32 Key)
+{
+	const int32 BackgroundMode = FMath::Min<int32>(Key & 3, UE_ARRAY_COUNT(BackgroundNames) - 1);
+	const int32 MaskMode = (Key >> MaskShift) & 3;
+	return FString::Printf(TEXT("%s_%s_%s_%s"), BackgroundNames[BackgroundMode], MaskNames[MaskMode],
+		(Key & ColorBit) != 0 ? TEXT("Color") : TEXT("NoColor"),
+		(Key & OverrideBit) != 0 ? TEXT("Override") : TEXT("Capture"));
+}
+
+UMaterialInterface* UVRTPMaterialPermutations::Find(int32 Key) const
+{
+	const FVRTPMaterialPermutation* Permutation = Permutations.FindByPredicate([Key](const FVRTPMaterialPermutation& Entry) { return Entry.Key == Key; });
+	return Permutation != nullptr ? Permutation->Material : nullptr;
+}
@@ -0,0 +1,55 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "Engine/DataAsset.h"
+#include "VRTPPermutations.generated.h"
+
+class UMaterial;
+class UMaterialInterface;
+
+/// One static-switch instance of an effect material, compiled for a single combination of background mode, mask mode,
+/// effect colour and cube map override
+USTRUCT()
+struct FVRTPMaterialPermutation
+{
+	GENERATED_BODY()
+
+	/// Combination this instance was compiled for, see MakeKey
+	UPROPERTY(VisibleAnywhere, Category = "Permutation")
+	int32 Key = 0;
+
+	UPROPERTY(VisibleAnywhere, Category = "Permutation")
+	UMaterialInterface* Material = nullptr;
+
+	/// Pack a combination into a key. Background and mask modes are the desktop or mobile enum values, which share their numbering.
+	/// The cube map override only matters to the skybox background and is ignored for the others.
+	static int32 MakeKey(uint8 BackgroundMode, uint8 MaskMode, bool bApplyEffectColor, bool bCubeMapOverride);
+
+	/// Static switch parameters of a key and their values, e.g. StaticBackgroundSkybox = true
+	static void GetStaticSwitches(int32 Key, TArray<TPair<FName, bool>>& OutSwitches);
+
+	/// Readable name of a key, e.g. Skybox_Window_Color_Override
+	static FString GetKeyName(int32 Key);
+};
+
+/// Static-switch instances of an effect material, one per combination in use, so the vignette shader only contains the active features
+/// instead of branching over all of them per pixel. Generated by the VRTPMaterialPermutations commandlet; combinations without an instance
+/// use the effect material itself.
+UCLASS(BlueprintType)
+class UVRTPMaterialPermutations : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	/// Effect material the instances are parented to
+	UPROPERTY(VisibleAnywhere, Category = "Permutations")
+	TSoftObjectPtr<UMaterial> BaseMaterial;
+
+	UPROPERTY(VisibleAnywhere, Category = "Permutations")
+	TArray<FVRTPMaterialPermutation> Permutations;
+
+	/// The instance compiled for Key, or null if there is none
+	UMaterialInterface* Find(int32 Key) const;
+};
@@ -0,0 +1,214 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPPoseHistory.h"
+#include "HAL/IConsoleManager.h"
+#include "Algo/Reverse.h"
+
+namespace {
+	TAutoConsoleVariable<float> CVarMotionFitWindow(
+		TEXT("vr.Tunnelling.MotionFitWindow"),
+		0.1f,
+		TEXT("Length in seconds of the pose history fitted to estimate tunnelling motion. The newest three poses are always used,\n")
+		TEXT("so 0 fits over the last two frames only."),
+		ECVF_Default);
+
+	/// Poses always used by a fit, whatever the window; three is the least a quadratic needs
+	constexpr int32 MinFitPoses = 3;
+
+	/// Rotation vector (axis scaled by angle, in radians) of a quaternion. Uses atan2 rather than acos so small angles stay accurate.
+	FVector RotationVector(FQuat Q)
+	{
+		// Take the shortest arc
+		if (Q.W < 0.0f)
+		{
+			Q = FQuat(-Q.X, -Q.Y, -Q.Z, -Q.W);
+		}
+
+		const FVector Axis(Q.X, Q.Y, Q.Z);
+		const double SinHalfAngle = Axis.Size();
+		if (SinHalfAngle < SMALL_NUMBER)
+		{
+			return Axis * 2.0;
+		}
+		return Axis * (2.0 * FMath::Atan2(SinHalfAngle, (double)Q.W) / SinHalfAngle);
+	}
+} // anonymous namespace
+
+void FVRTPPoseHistory::FSlot::Store(const FVRTPPose& Pose)
+{
+	const double Source[8] = { Pose.Time, Pose.Position.X, Pose.Position.Y, Pose.Position.Z, Pose.Orientation.X, Pose.Orientation.Y, Pose.Orientation.Z, Pose.Orientation.W };
+	for (int32 Index = 0; Index < 8; ++Index)
+	{
+		Values[Index].store(Source[Index], std::memory_order_relaxed);
+	}
+}
+
+FVRTPPose FVRTPPoseHistory::FSlot::Load() const
+{
+	double Loaded[8];
+	for (int32 Index = 0; Index < 8; ++Index)
+	{
+		Loaded[Index] = Values[Index].load(std::memory_order_relaxed);
+	}
+
+	FVRTPPose Pose;
+	Pose.Time = Loaded[0];
+	Pose.Position = FVector(Loaded[1], Loaded[2], Loaded[3]);
+	Pose.Orientation = FQuat(Loaded[4], Loaded[5], Loaded[6], Loaded[7]);
+	return Pose;
+}
+
+bool FVRTPPoseHistory::Push(const FVRTPPose& Pose)
+{
+	const uint32 Index = NumPushed.load(std::memory_order_relaxed);
+	if (Index > 0 && Pose.Time <= Poses[(Index - 1) % Capacity].LoadTime())
+	{
+		return false;
+	}
+
+	// Announce the overwrite before touching the slot, so a reader copying it can tell
+	NumClaimed.store(Index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Poses[Index % Capacity].Store(Pose);
+	NumPushed.store(Index + 1, std::memory_order_release);
+	return true;
+}
+
+int32 FVRTPPoseHistory::CopyRecent(double Window, FVRTPPose* OutPoses) const
+{
+	const uint32 End = NumPushed.load(std::memory_order_acquire);
+	const int32 Available = (int32)FMath::Min<uint32>(End, Capacity);
+
+	// Copy newest first, stopping at the first pose outside the window
+	int32 Count = 0;
+	double MinTime = 0.0;
+	while (Count < Available)
+	{
+		OutPoses[Count] = Poses[(End - 1 - Count) % Capacity].Load();
+		if (Count == 0)
+		{
+			MinTime = OutPoses[0].Time - Window;
+		}
+		else if (Count >= MinFitPoses && OutPoses[Count].Time < MinTime)
+		{
+			break;
+		}
+		++Count;
+	}
+
+	// Drop the copies the writer may have overwritten meanwhile; pose I survives while I + Capacity >= NumClaimed
+	std::atomic_thread_fence(std::memory_order_acquire);
+	const int64 Claimed = NumClaimed.load(std::memory_order_relaxed);
+	Count = (int32)FMath::Clamp<int64>((int64)End + Capacity - Claimed, 0, Count);
+
+	Algo::Reverse(OutPoses, Count);
+	return Count;
+}
+
+void FVRTPPoseHistory::Reset()
+{
+	NumPushed.store(0, std::memory_order_relaxed);
+	NumClaimed.store(0, std::memory_order_relaxed);
+}
+
+FVRTPKinematics FVRTPPoseHistory::Estimate() const
+{
+	FVRTPPose Recent[Capacity];
+	const int32 Num = CopyRecent(CVarMotionFitWindow.GetValueOnAnyThread(), Recent);
+	return Fit(Recent, Num);
+}
+
+FVRTPKinematics FVRTPPoseHistory::Estimate(const FVRTPPoseHistory& A, const FVRTPPoseHistory& B)
+{
+	const double Window = CVarMotionFitWindow.GetValueOnAnyThread();
+	FVRTPPose RecentA[Capacity];
+	FVRTPPose RecentB[Capacity];
+	const int32 NumA = A.CopyRecent(Window, RecentA);
+	const int32 NumB = B.CopyRecent(Window, RecentB);
+
+	// Merge by time, dropping poses outside the window of the newest pose overall
+	FVRTPPose Merged[Capacity * 2];
+	int32 Num = 0;
+	int32 IndexA = 0;
+	int32 IndexB = 0;
+	while (IndexA < NumA || IndexB < NumB)
+	{
+		const bool bTakeA = IndexB >= NumB || (IndexA < NumA && RecentA[IndexA].Time <= RecentB[IndexB].Time);
+		const FVRTPPose& Pose = bTakeA ? RecentA[IndexA++] : RecentB[IndexB++];
+		if (Num == 0 || Pose.Time > Merged[Num - 1].Time)
+		{
+			Merged[Num++] = Pose;
+		}
+	}
+
+	const double MinTime = Num > 0 ? Merged[Num - 1].Time - Window : 0.0;
+	int32 First = 0;
+	while (Num - First > MinFitPoses && Merged[First].Time < MinTime)
+	{
+		++First;
+	}
+	return Fit(Merged + First, Num - First);
+}
+
+FVRTPKinematics FVRTPPoseHistory::Fit(const FVRTPPose* Poses, int32 Num)
+{
+	FVRTPKinematics Kinematics;
+	if (Num < 2)
+	{
+		return Kinematics;
+	}
+
+	// Fit against normalised time U = (Time - Newest) / Span, in [-1, 0], to keep the normal equations well conditioned
+	const FVRTPPose& Newest = Poses[Num - 1];
+	const double Span = Newest.Time - Poses[0].Time;
+	if (Span <= 0.0)
+	{
+		return Kinematics;
+	}
+	const double InvSpan = 1.0 / Span;
+	const FQuat InvNewestOrientation = Newest.Orientation.Inverse();
+
+	double S0 = 0, S1 = 0, S2 = 0, S3 = 0, S4 = 0;
+	FVector T0 = FVector::ZeroVector, T1 = FVector::ZeroVector, T2 = FVector::ZeroVector;
+	FVector R0 = FVector::ZeroVector, R1 = FVector::ZeroVector;
+	for (int32 Index = 0; Index < Num; ++Index)
+	{
+		const double U = (Poses[Index].Time - Newest.Time) * InvSpan;
+		const double U2 = U * U;
+		const FVector Offset = Poses[Index].Position - Newest.Position;
+		const FVector Rotation = RotationVector(Poses[Index].Orientation * InvNewestOrientation);
+
+		S0 += 1.0;
+		S1 += U;
+		S2 += U2;
+		S3 += U2 * U;
+		S4 += U2 * U2;
+		T0 += Offset;
+		T1 += Offset * U;
+		T2 += Offset * U2;
+		R0 += Rotation;
+		R1 += Rotation * U;
+	}
+
+	// Angular velocity: slope of a line through the rotation vectors
+	const double LinearDet = S0 * S2 - S1 * S1;
+	if (LinearDet <= SMALL_NUMBER)
+	{
+		return Kinematics;
+	}
+	Kinematics.AngularVelocity = (R1 * S0 - R0 * S1) * (InvSpan / LinearDet);
+
+	// Position: quadratic by Cramer's rule when three or more poses are available, otherwise a line
+	const double QuadraticDet = S0 * (S2 * S4 - S3 * S3) - S1 * (S1 * S4 - S3 * S2) + S2 * (S1 * S3 - S2 * S2);
+	if (Num >= 3 && QuadraticDet > SMALL_NUMBER)
+	{
+		const FVector B = (T1 * (S0 * S4 - S2 * S2) - T0 * (S1 * S4 - S3 * S2) + T2 * (S1 * S2 - S0 * S3)) / QuadraticDet;
+		const FVector C = (T2 * (S0 * S2 - S1 * S1) - T1 * (S0 * S3 - S1 * S2) + T0 * (S1 * S3 - S2 * S2)) / QuadraticDet;
+		Kinematics.Velocity = B * InvSpan;
+		Kinematics.Acceleration = C * (2.0 * InvSpan * InvSpan);
+	}
+	else
+	{
+		Kinematics.Velocity = (T1 * S0 - T0 * S1) * (InvSpan / LinearDet);
+	}
+	return Kinematics;
+}
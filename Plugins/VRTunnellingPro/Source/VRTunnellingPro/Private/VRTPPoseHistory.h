@@ -0,0 +1,74 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+/// A timestamped pose
+struct FVRTPPose
+{
+	double Time = 0.0;
+	FVector Position = FVector::ZeroVector;
+	FQuat Orientation = FQuat::Identity;
+};
+
+/// Motion derivatives at the newest pose of a history
+struct FVRTPKinematics
+{
+	/// Linear velocity, in units per second
+	FVector Velocity = FVector::ZeroVector;
+
+	/// Linear acceleration, in units per second squared
+	FVector Acceleration = FVector::ZeroVector;
+
+	/// Angular velocity; the rotation axis scaled by radians per second
+	FVector AngularVelocity = FVector::ZeroVector;
+};
+
+/// Fixed-capacity ring of timestamped poses. One writer thread may Push while one reader thread copies recent poses out;
+/// neither side locks or allocates, and the reader discards any pose the writer overwrote while it was being copied.
+/// Slots are copied field by field through relaxed atomics, so even a discarded copy is not a data race.
+class FVRTPPoseHistory
+{
+public:
+	static constexpr int32 Capacity = 32;
+
+	/// Writer only. Poses must be pushed in increasing time order; a pose no newer than the last one is ignored, returning false.
+	bool Push(const FVRTPPose& Pose);
+
+	/// Reader only. Copy the poses within Window seconds of the newest one (but never fewer than the newest three), oldest first.
+	/// OutPoses must hold Capacity poses. Returns the number of poses copied.
+	int32 CopyRecent(double Window, FVRTPPose* OutPoses) const;
+
+	/// Drop every pose. Must not run concurrently with Push or CopyRecent.
+	void Reset();
+
+	/// Reader only. Fit the poses within the configured window (vr.Tunnelling.MotionFitWindow).
+	FVRTPKinematics Estimate() const;
+
+	/// Reader only. Fit the poses of two histories of the same device, e.g. one fed by the game thread and one by the render thread.
+	static FVRTPKinematics Estimate(const FVRTPPoseHistory& A, const FVRTPPoseHistory& B);
+
+	/// Least-squares derivatives at the newest of Num poses, sorted oldest first. Position is fitted with a quadratic once three poses
+	/// are available, and orientation with a line through the rotation vectors (quaternion logs) relative to the newest pose.
+	static FVRTPKinematics Fit(const FVRTPPose* Poses, int32 Num);
+
+private:
+	/// One pose, stored as relaxed atomics: time, position, then orientation
+	struct FSlot
+	{
+		std::atomic<double> Values[8];
+
+		void Store(const FVRTPPose& Pose);
+		FVRTPPose Load() const;
+		double LoadTime() const { return Values[0].load(std::memory_order_relaxed); }
+	};
+
+	FSlot Poses[Capacity];
+
+	/// Number of poses published so far
+	std::atomic<uint32> NumPushed{ 0 };
+
+	/// Number of poses the writer has started to write; the pose being written replaces pose NumClaimed - 1 - Capacity
+	std::atomic<uint32> NumClaimed{ 0 };
+};
@@ -0,0 +1,361 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPRendering.h"
+#include "VRTPShaders.h"
+#include "PixelShaderUtils.h"
+#include "RenderGraphUtils.h"
+#include "SceneView.h"
+#include "TextureResource.h"
+#include "PostProcess/PostProcessMaterialInputs.h"
+#include "PipelineStateCache.h"
+#include "CommonRenderResources.h"
+#include "HAL/IConsoleManager.h"
+#include "VRTPStats.h"
+
+DECLARE_GPU_STAT_NAMED(VRTPVignette, TEXT("VRTP Vignette"));
+DECLARE_GPU_STAT_NAMED(VRTPBlur, TEXT("VRTP Blur"));
+
+namespace {
+	TAutoConsoleVariable<int32> CVarBlurQuality(
+		TEXT("vr.Tunnelling.BlurQuality"),
+		2,
+		TEXT("Depth of the native blur pyramid below quarter resolution; higher values blur more widely at a small extra cost.\n")
+		TEXT(" 0: quarter resolution only\n")
+		TEXT(" 3: down to 1/32 resolution (max)\n")
+		TEXT("Set by sg.VRTunnellingQuality."),
+		ECVF_Scalability | ECVF_RenderThreadSafe);
+
+	constexpr int32 NumBackgroundModes = FVRTPVignettePS::NumBackgroundModes;
+	constexpr int32 NumMaskModes = FVRTPVignettePS::NumMaskModes;
+
+	/// Blur levels: half and quarter resolution, then up to three more halvings
+	constexpr int32 MaxBlurLevels = 5;
+
+	/// Segments in the annulus ring; the inner edge is inscribed in the clear radius, so more segments only tighten the fit
+	constexpr int32 AnnulusSegments = 64;
+
+	/// Native permutations drawn so far, whether by a warm-up or for real. Render thread only.
+	uint32 DrawnPermutations = 0;
+} // anonymous namespace
+
+namespace {
+	/// Filter Input's viewport Rect into the whole of Output, halving or doubling its resolution
+	void AddBlurLevelPass(FRDGBuilder& GraphBuilder, FGlobalShaderMap* ShaderMap, FRDGTextureRef Input, const FIntRect& Rect, FRDGTextureRef Output, bool bUpsample)
+	{
+		const FVector2f Extent(Input->Desc.Extent);
+		const FIntPoint OutputSize = Output->Desc.Extent;
+
+		FVRTPBlurCS::FParameters* Parameters = GraphBuilder.AllocParameters<FVRTPBlurCS::FParameters>();
+		Parameters->InputTexture = Input;
+		Parameters->InputSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+		Parameters->InputUVMin = FVector2f(Rect.Min) / Extent;
+		Parameters->InputUVSize = FVector2f(Rect.Size()) / Extent;
+		Parameters->InputTexelSize = FVector2f(1.0f, 1.0f) / Extent;
+		Parameters->InputUVClampMin = (FVector2f(Rect.Min) + 0.5f) / Extent;
+		Parameters->InputUVClampMax = (FVector2f(Rect.Max) - 0.5f) / Extent;
+		Parameters->OutputSize = OutputSize;
+		Parameters->OutputTexelSize = FVector2f(1.0f, 1.0f) / FVector2f(OutputSize);
+		Parameters->OutputTexture = GraphBuilder.CreateUAV(Output);
+
+		FVRTPBlurCS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FVRTPBlurCS::FUpsampleDim>(bUpsample);
+		TShaderMapRef<FVRTPBlurCS> ComputeShader(ShaderMap, PermutationVector);
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("%s %dx%d", bUpsample ? TEXT("Upsample") : TEXT("Downsample"), OutputSize.X, OutputSize.Y),
+			ComputeShader,
+			Parameters,
+			FComputeShaderUtils::GetGroupCount(OutputSize, FVRTPBlurCS::ThreadGroupSize));
+	}
+
+	/// Blur the scene colour viewport down a dual-Kawase pyramid and back up to quarter resolution; returns the quarter resolution result
+	FRDGTextureRef AddBlurPasses(FRDGBuilder& GraphBuilder, FGlobalShaderMap* ShaderMap, const FScreenPassTexture& SceneColor)
+	{
+		RDG_EVENT_SCOPE(GraphBuilder, "Blur");
+		RDG_GPU_STAT_SCOPE(GraphBuilder, VRTPBlur);
+
+		const int32 NumLevels = FMath::Clamp(2 + CVarBlurQuality.GetValueOnRenderThread(), 2, MaxBlurLevels);
+
+		FRDGTextureRef Levels[MaxBlurLevels];
+		FRDGTextureRef Input = SceneColor.Texture;
+		FIntRect InputRect = SceneColor.ViewRect;
+		for (int32 Level = 0; Level < NumLevels; ++Level)
+		{
+			const FIntPoint Size(FMath::Max(InputRect.Width() / 2, 1), FMath::Max(InputRect.Height() / 2, 1));
+			const FRDGTextureDesc Desc = FRDGTextureDesc::Create2D(Size, PF_FloatRGBA, FClearValueBinding::None, TexCreate_ShaderResource | TexCreate_UAV);
+			Levels[Level] = GraphBuilder.CreateTexture(Desc, TEXT("VRTP.BlurDown"));
+			AddBlurLevelPass(GraphBuilder, ShaderMap, Input, InputRect, Levels[Level], false);
+
+			Input = Levels[Level];
+			InputRect = FIntRect(FIntPoint::ZeroValue, Size);
+		}
+
+		// Back up to quarter resolution (level 1)
+		for (int32 Level = NumLevels - 2; Level >= 1; --Level)
+		{
+			FRDGTextureRef Upsampled = GraphBuilder.CreateTexture(Levels[Level]->Desc, TEXT("VRTP.BlurUp"));
+			AddBlurLevelPass(GraphBuilder, ShaderMap, Input, InputRect, Upsampled, true);
+
+			Input = Upsampled;
+			InputRect = FIntRect(FIntPoint::ZeroValue, Upsampled->Desc.Extent);
+		}
+		return Input;
+	}
+
+	/// Draw one vignette permutation with Parameters into Output: over the whole viewport, or with bRing only over the annulus around the clear radius
+	void AddVignetteDraw(FRDGBuilder& GraphBuilder, FGlobalShaderMap* ShaderMap, FVRTPVignetteParameters* Parameters, const FScreenPassRenderTarget& Output, uint8 BackgroundMode, uint8 MaskMode, bool bBlend, bool bRing)
+	{
+		FVRTPVignettePS::FPermutationDomain PermutationVector;
+		PermutationVector.Set<FVRTPVignettePS::FBackgroundDim>(BackgroundMode);
+		PermutationVector.Set<FVRTPVignettePS::FMaskModeDim>(MaskMode);
+		PermutationVector.Set<FVRTPVignettePS::FBlendDim>(bBlend);
+
+		TShaderMapRef<FVRTPVignettePS> PixelShader(ShaderMap, PermutationVector);
+
+		FRHIBlendState* BlendState = bBlend ? TStaticBlendState<CW_RGB, BO_Add, BF_SourceAlpha, BF_InverseSourceAlpha>::GetRHI() : nullptr;
+
+		if (!bRing)
+		{
+			FPixelShaderUtils::AddFullscreenPass(GraphBuilder, ShaderMap, RDG_EVENT_NAME("Vignette %dx%d", Output.ViewRect.Width(), Output.ViewRect.Height()), PixelShader, Parameters, Output.ViewRect, BlendState);
+		}
+		else if (Parameters->Radius < Parameters->OuterRadius)
+		{
+			TShaderMapRef<FVRTPAnnulusVS> VertexShader(ShaderMap);
+			const FIntRect ViewRect = Output.ViewRect;
+
+			GraphBuilder.AddPass(
+				RDG_EVENT_NAME("Annulus %dx%d", ViewRect.Width(), ViewRect.Height()),
+				Parameters,
+				ERDGPassFlags::Raster,
+				[VertexShader, PixelShader, Parameters, ViewRect, BlendState](FRHICommandList& RHICmdList)
+				{
+					RHICmdList.SetViewport(ViewRect.Min.X, ViewRect.Min.Y, 0.0f, ViewRect.Max.X, ViewRect.Max.Y, 1.0f);
+
+					FGraphicsPipelineStateInitializer GraphicsPSOInit;
+					RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+					GraphicsPSOInit.BlendState = BlendState;
+					GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
+					GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+					GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GEmptyVertexDeclaration.VertexDeclarationRHI;
+					GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+					GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+					GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+					SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
+
+					SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *Parameters);
+					SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *Parameters);
+
+					// Two triangles per segment
+					RHICmdList.DrawPrimitive(0, AnnulusSegments * 2, 1);
+				});
+		}
+	}
+} // anonymous namespace
+
+FScreenPassTexture AddVRTPVignettePass(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs, const FVRTPRenderState& State)
+{
+	const FScreenPassTexture SceneColor = Inputs.GetInput(EPostProcessMaterialInput::SceneColor);
+	const bool bApply = State.bEnabled && View.Family->Scene == State.Scene && View.PlayerIndex == State.PlayerIndex;
+
+	// Nothing to draw; but a pass that has been asked to write the final output must still fill it, so pass the scene through
+	if (!bApply && !Inputs.OverrideOutput.IsValid())
+	{
+		return SceneColor;
+	}
+
+	// Blend straight onto the scene colour when allowed, so untouched pixels are neither shaded nor copied.
+	// Writing the final output needs the full screen copy, since the override target starts out empty.
+	const bool bBlend = bApply && State.bAnnulus && !Inputs.OverrideOutput.IsValid();
+	const uint8 MaskMode = bApply ? FMath::Min<uint8>(State.MaskMode, NumMaskModes - 1) : 0;
+
+	// Window and portal masks can reach anywhere on screen, so only the other modes fit inside the ring
+	const bool bRing = bBlend && MaskMode <= 1;
+
+	FScreenPassRenderTarget Output = Inputs.OverrideOutput;
+	if (bBlend)
+	{
+		Output = FScreenPassRenderTarget(SceneColor, ERenderTargetLoadAction::ELoad);
+	}
+	else if (!Output.IsValid())
+	{
+		Output = FScreenPassRenderTarget::CreateFromInput(GraphBuilder, SceneColor, View.GetOverwriteLoadAction(), TEXT("VRTP.Vignette"));
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "VRTunnelling");
+	RDG_GPU_STAT_SCOPE(GraphBuilder, VRTPVignette);
+
+	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(View.GetFeatureLevel());
+
+	// A skybox without a cubemap yet falls back to the colour background
+	uint8 BackgroundMode = bApply ? FMath::Min<uint8>(State.BackgroundMode, NumBackgroundModes - 1) : 0;
+	const bool bSkybox = BackgroundMode == 1 && State.Cubemap.IsValid();
+	const bool bBlur = BackgroundMode == 2;
+	if (BackgroundMode == 1 && !bSkybox)
+	{
+		BackgroundMode = 0;
+	}
+
+	// The blur reads the scene before the vignette writes it, so it also suits blending in place
+	FRDGTextureRef BlurTexture = bBlur ? AddBlurPasses(GraphBuilder, ShaderMap, SceneColor) : nullptr;
+
+	// The first draw of a permutation the warm-up did not cover compiles its pipeline state now
+	const uint32 PermutationBit = GetVRTPNativePermutationBit(BackgroundMode, MaskMode, bBlend);
+	if ((DrawnPermutations & PermutationBit) == 0)
+	{
+		DrawnPermutations |= PermutationBit;
+		INC_DWORD_STAT(STAT_VRTP_GameplayPSOCompiles);
+	}
+
+	// A radius beyond the screen corners leaves the scene untouched
+	const float Radius = bApply ? State.Radius : 2.0f;
+	const FVector2f Shift = bApply ? State.Shift : FVector2f::ZeroVector;
+
+	FVRTPVignetteParameters* Parameters = GraphBuilder.AllocParameters<FVRTPVignetteParameters>();
+	Parameters->View = View.ViewUniformBuffer;
+	Parameters->SceneTextures = Inputs.SceneTextures;
+	Parameters->Input = GetScreenPassTextureViewportParameters(FScreenPassTextureViewport(SceneColor));
+	Parameters->Output = GetScreenPassTextureViewportParameters(FScreenPassTextureViewport(Output));
+	// Blending reads the scene through the render target instead, which must not also be bound for reading
+	Parameters->InputTexture = bBlend ? nullptr : SceneColor.Texture;
+	Parameters->InputSampler = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	Parameters->Cubemap = bSkybox ? State.Cubemap.GetReference() : GBlackTextureCube->TextureRHI.GetReference();
+	Parameters->CubemapSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	Parameters->BlurTexture = BlurTexture;
+	Parameters->BlurSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	Parameters->Radius = Radius;
+	// Circumscribe the farthest screen corner, measured in the same -1..1 viewport space as the radius
+	Parameters->OuterRadius = FVector2f(1.0f + FMath::Abs(Shift.X), 1.0f + FMath::Abs(Shift.Y)).Size() / FMath::Cos(PI / AnnulusSegments);
+	Parameters->NumSegments = AnnulusSegments;
+	Parameters->Shift = Shift;
+	Parameters->Feather = State.Feather;
+	Parameters->EffectColor = FVector3f(State.EffectColor.R, State.EffectColor.G, State.EffectColor.B);
+	Parameters->ApplyEffectColor = State.bApplyEffectColor ? 1.0f : 0.0f;
+	Parameters->Forward = State.Forward;
+	Parameters->Right = State.Right;
+	Parameters->Up = State.Up;
+	Parameters->StencilIndex = State.StencilIndex;
+	Parameters->StencilBits = State.bStencilBits ? 1 : 0;
+	// The capture's matrix takes absolute world positions; the shader reconstructs them relative to this view's origin
+	const bool bMaskTexture = State.MaskTexture.IsValid();
+	Parameters->MaskTexture = bMaskTexture ? State.MaskTexture.GetReference() : GBlackTexture->TextureRHI.GetReference();
+	Parameters->MaskSampler = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	Parameters->MaskTranslatedWorldToClip = FMatrix44f(FTranslationMatrix(-View.ViewMatrices.GetPreViewTranslation()) * State.MaskWorldToClip);
+	Parameters->UseMaskTexture = bMaskTexture ? 1 : 0;
+	Parameters->RenderTargets[0] = Output.GetRenderTargetBinding();
+
+	AddVignetteDraw(GraphBuilder, ShaderMap, Parameters, Output, BackgroundMode, MaskMode, bBlend, bRing);
+
+	return MoveTemp(Output);
+}
+
+uint32 GetVRTPNativePermutationBit(uint8 BackgroundMode, uint8 MaskMode, bool bBlend)
+{
+	const uint32 Index = (FMath::Min<uint32>(BackgroundMode, NumBackgroundModes - 1) * NumMaskModes + FMath::Min<uint32>(MaskMode, NumMaskModes - 1)) * 2 + (bBlend ? 1 : 0);
+	return 1u << Index;
+}
+
+uint32 GetVRTPNativePermutationMask(bool bBlend)
+{
+	uint32 Mask = 0;
+	for (uint8 BackgroundMode = 0; BackgroundMode < NumBackgroundModes; ++BackgroundMode)
+	{
+		for (uint8 MaskMode = 0; MaskMode < NumMaskModes; ++MaskMode)
+		{
+			Mask |= GetVRTPNativePermutationBit(BackgroundMode, MaskMode, bBlend);
+		}
+	}
+	return Mask;
+}
+
+void AddVRTPWarmupPasses(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs, uint32 Permutations)
+{
+	Permutations &= ~DrawnPermutations;
+	if (Permutations == 0)
+	{
+		return;
+	}
+
+	RDG_EVENT_SCOPE(GraphBuilder, "VRTunnelling Warmup");
+
+	FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(View.GetFeatureLevel());
+	const FScreenPassTexture SceneColor = Inputs.GetInput(EPostProcessMaterialInput::SceneColor);
+
+	// The pipeline state depends on the target's format and flags, not its size. Large enough for two blur levels.
+	FRDGTextureDesc Desc = SceneColor.Texture->Desc;
+	Desc.Extent = FIntPoint(VRTPWarmupTargetSize, VRTPWarmupTargetSize);
+	Desc.NumMips = 1;
+	Desc.Flags |= TexCreate_ShaderResource | TexCreate_RenderTargetable;
+
+	// Copying permutations write the final output when the pass has been asked to, as AddVRTPVignettePass does; blending ones never do
+	FRDGTextureDesc CopyDesc = Desc;
+	if (Inputs.OverrideOutput.IsValid())
+	{
+		CopyDesc = Inputs.OverrideOutput.Texture->Desc;
+		CopyDesc.Extent = Desc.Extent;
+		CopyDesc.NumMips = 1;
+		CopyDesc.Flags |= TexCreate_RenderTargetable;
+	}
+
+	FRDGTextureRef Source = GraphBuilder.CreateTexture(Desc, TEXT("VRTP.WarmupSource"));
+	AddClearRenderTargetPass(GraphBuilder, Source, FLinearColor::Black);
+	const FScreenPassTexture SourceTexture(Source);
+
+	// One level down and one back up covers both blur shaders, whatever vr.Tunnelling.BlurQuality is
+	uint32 BlurPermutations = 0;
+	for (uint8 MaskMode = 0; MaskMode < NumMaskModes; ++MaskMode)
+	{
+		BlurPermutations |= GetVRTPNativePermutationBit(2, MaskMode, false) | GetVRTPNativePermutationBit(2, MaskMode, true);
+	}
+
+	FRDGTextureRef BlurTexture = nullptr;
+	if ((Permutations & BlurPermutations) != 0)
+	{
+		const FIntRect SourceRect(FIntPoint::ZeroValue, Desc.Extent);
+		const FRDGTextureDesc BlurDesc = FRDGTextureDesc::Create2D(Desc.Extent / 2, PF_FloatRGBA, FClearValueBinding::None, TexCreate_ShaderResource | TexCreate_UAV);
+		FRDGTextureRef Downsampled = GraphBuilder.CreateTexture(BlurDesc, TEXT("VRTP.BlurDown"));
+		AddBlurLevelPass(GraphBuilder, ShaderMap, Source, SourceRect, Downsampled, false);
+
+		BlurTexture = GraphBuilder.CreateTexture(FRDGTextureDesc::Create2D(Desc.Extent, PF_FloatRGBA, FClearValueBinding::None, TexCreate_ShaderResource | TexCreate_UAV), TEXT("VRTP.BlurUp"));
+		AddBlurLevelPass(GraphBuilder, ShaderMap, Downsampled, FIntRect(FIntPoint::ZeroValue, BlurDesc.Extent), BlurTexture, true);
+	}
+
+	for (uint8 BackgroundMode = 0; BackgroundMode < NumBackgroundModes; ++BackgroundMode)
+	{
+		for (uint8 MaskMode = 0; MaskMode < NumMaskModes; ++MaskMode)
+		{
+			for (const bool bBlend : { false, true })
+			{
+				if ((Permutations & GetVRTPNativePermutationBit(BackgroundMode, MaskMode, bBlend)) == 0)
+				{
+					continue;
+				}
+
+				const FScreenPassRenderTarget Output(GraphBuilder.CreateTexture(bBlend ? Desc : CopyDesc, TEXT("VRTP.Warmup")), ERenderTargetLoadAction::ENoAction);
+
+				// A closed vignette, so every pixel runs the background and mask
+				FVRTPVignetteParameters* Parameters = GraphBuilder.AllocParameters<FVRTPVignetteParameters>();
+				Parameters->View = View.ViewUniformBuffer;
+				Parameters->SceneTextures = Inputs.SceneTextures;
+				Parameters->Input = GetScreenPassTextureViewportParameters(FScreenPassTextureViewport(SourceTexture));
+				Parameters->Output = GetScreenPassTextureViewportParameters(FScreenPassTextureViewport(Output));
+				Parameters->InputTexture = bBlend ? nullptr : Source;
+				Parameters->InputSampler = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+				Parameters->Cubemap = GBlackTextureCube->TextureRHI.GetReference();
+				Parameters->CubemapSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+				Parameters->BlurTexture = BackgroundMode == 2 ? BlurTexture : nullptr;
+				Parameters->BlurSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+				Parameters->Radius = 0.0f;
+				Parameters->OuterRadius = 2.0f;
+				Parameters->NumSegments = AnnulusSegments;
+				Parameters->MaskTexture = GBlackTexture->TextureRHI.GetReference();
+				Parameters->MaskSampler = TStaticSamplerState<SF_Point, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+				Parameters->RenderTargets[0] = Output.GetRenderTargetBinding();
+
+				AddVignetteDraw(GraphBuilder, ShaderMap, Parameters, Output, BackgroundMode, MaskMode, bBlend, bBlend && MaskMode <= 1);
+			}
+		}
+	}
+
+	DrawnPermutations |= Permutations;
+	INC_DWORD_STAT_BY(STAT_VRTP_WarmedPSOs, FMath::CountBits(Permutations));
+}
@@ -0,0 +1,72 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ScreenPass.h"
+#include "RHIResources.h"
+
+class FRDGBuilder;
+class FSceneInterface;
+class FSceneView;
+struct FPostProcessMaterialInputs;
+
+/// Everything the native vignette pass needs for one frame, copied from the component on the game thread and read on the render thread
+struct FVRTPRenderState
+{
+	/// Whether the native pass should run at all
+	bool bEnabled = false;
+
+	/// Shade only a ring around the clear radius, blended over the scene, instead of copying the whole screen
+	bool bAnnulus = false;
+
+	/// Only views of this scene and player are vignetted
+	const FSceneInterface* Scene = nullptr;
+	int32 PlayerIndex = 0;
+
+	float Radius = 1.5f;
+	FVector2f Shift = FVector2f::ZeroVector;
+	float Feather = 0.0f;
+	FLinearColor EffectColor = FLinearColor::Black;
+	bool bApplyEffectColor = false;
+
+	/// EVRTPBackgroundMode. The skybox is sampled along the view ray in the owner's basis; the blur is computed from the scene each frame
+	uint8 BackgroundMode = 0;
+	FTextureRHIRef Cubemap;
+	FVector3f Forward = FVector3f::ForwardVector;
+	FVector3f Right = FVector3f::RightVector;
+	FVector3f Up = FVector3f::UpVector;
+
+	/// EVRTPMaskMode, and the custom stencil bits of masked objects. Masks shared with other components hold their bits too,
+	/// so with bStencilBits only these bits are tested; otherwise the stencil must match exactly, as in the material.
+	uint8 MaskMode = 0;
+	uint32 StencilIndex = 0;
+	bool bStencilBits = false;
+
+	/// With vr.Tunnelling.MaskPass, the device depth of the masked objects alone, captured from the camera, and its world to clip
+	/// matrix. Each pixel is reprojected into it instead of reading the custom stencil.
+	FTextureRHIRef MaskTexture;
+	FMatrix MaskWorldToClip = FMatrix::Identity;
+};
+
+/// Whether the native pass's global shaders exist at FeatureLevel; they are only compiled for SM5 and above
+inline bool IsVRTPNativePassSupported(ERHIFeatureLevel::Type FeatureLevel)
+{
+	return FeatureLevel >= ERHIFeatureLevel::SM5;
+}
+
+/// Draw the vignette over the scene colour in Inputs, returning the vignetted texture. Render thread only.
+FScreenPassTexture AddVRTPVignettePass(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs, const FVRTPRenderState& State);
+
+/// Bit of one native pass permutation in a warm-up mask: its background mode, mask mode and whether it blends in place
+uint32 GetVRTPNativePermutationBit(uint8 BackgroundMode, uint8 MaskMode, bool bBlend);
+
+/// Edge of the offscreen warm-up targets, for materials and native permutations alike; only the pipeline state matters, not what is drawn
+constexpr int32 VRTPWarmupTargetSize = 16;
+
+/// Every background and mask permutation of the native pass that copies the scene (or, with bBlend, blends in place)
+uint32 GetVRTPNativePermutationMask(bool bBlend);
+
+/// Draw each native pass permutation in Permutations once into a small target with the format the real pass would write for Inputs
+/// (the override output when there is one, otherwise the scene colour), so its pipeline state is compiled before the vignette first
+/// uses it. Call it from the same post-processing pass as AddVRTPVignettePass. Render thread only.
+void AddVRTPWarmupPasses(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs, uint32 Permutations);
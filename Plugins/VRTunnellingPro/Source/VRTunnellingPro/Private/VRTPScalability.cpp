@@ -0,0 +1,117 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPScalability.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/ConfigCacheIni.h"
+
+namespace {
+	/// The variables each tier of sg.VRTunnellingQuality sets
+	struct FQualityLevel
+	{
+		int32 MaxCaptureResolution;
+		int32 BlurQuality;
+		int32 SkyboxFallback;
+		int32 Masks;
+		float IdleSkipDelay;
+	};
+
+	/// Epic matches the defaults of the individual variables
+	const FQualityLevel QualityLevels[] = {
+		{ 256, 0, 1, 0, 0.1f },		// Low: colour instead of skybox, no masks
+		{ 512, 1, 0, 1, 0.25f },	// Medium
+		{ 1024, 2, 0, 1, 0.5f },	// High
+		{ 0, 2, 0, 1, 0.5f }		// Epic
+	};
+
+	uint32 Generation = 0;
+
+	void SetByScalability(const TCHAR* Name, int32 Value)
+	{
+		if (IConsoleVariable* Variable = IConsoleManager::Get().FindConsoleVariable(Name))
+		{
+			Variable->Set(Value, ECVF_SetByScalability);
+		}
+	}
+
+	void SetByScalability(const TCHAR* Name, float Value)
+	{
+		if (IConsoleVariable* Variable = IConsoleManager::Get().FindConsoleVariable(Name))
+		{
+			Variable->Set(Value, ECVF_SetByScalability);
+		}
+	}
+
+	void OnQualityChanged(IConsoleVariable* Variable)
+	{
+		const int32 Level = FMath::Clamp(Variable->GetInt(), 0, (int32)UE_ARRAY_COUNT(QualityLevels) - 1);
+		const FQualityLevel& Quality = QualityLevels[Level];
+		SetByScalability(TEXT("vr.Tunnelling.MaxCaptureResolution"), Quality.MaxCaptureResolution);
+		SetByScalability(TEXT("vr.Tunnelling.BlurQuality"), Quality.BlurQuality);
+		SetByScalability(TEXT("vr.Tunnelling.SkyboxFallback"), Quality.SkyboxFallback);
+		SetByScalability(TEXT("vr.Tunnelling.Masks"), Quality.Masks);
+		SetByScalability(TEXT("vr.Tunnelling.IdleSkipDelay"), Quality.IdleSkipDelay);
+
+		// Project overrides, in the same ini and section format as the engine's groups
+		ApplyCVarSettingsGroupFromIni(TEXT("VRTunnellingQuality"), Level, *GScalabilityIni, ECVF_SetByScalability);
+	}
+
+	void OnSettingChanged(IConsoleVariable* Variable)
+	{
+		++Generation;
+	}
+
+	TAutoConsoleVariable<int32> CVarQuality(
+		TEXT("sg.VRTunnellingQuality"),
+		3,
+		TEXT("Scalability group for tunnelling effects.\n")
+		TEXT(" 0: low (256 capture, narrow blur, colour instead of skybox, no masks, idle skip after 0.1s)\n")
+		TEXT(" 1: medium (512 capture, idle skip after 0.25s)\n")
+		TEXT(" 2: high (1024 capture)\n")
+		TEXT(" 3: epic (default; configured capture resolution)"),
+		FConsoleVariableDelegate::CreateStatic(&OnQualityChanged),
+		ECVF_ScalabilityGroup);
+
+	TAutoConsoleVariable<int32> CVarMaxCaptureResolution(
+		TEXT("vr.Tunnelling.MaxCaptureResolution"),
+		0,
+		TEXT("Largest skybox capture face, in pixels; captures configured larger are made at this size. 0 leaves them as configured.\n")
+		TEXT("Set by sg.VRTunnellingQuality."),
+		FConsoleVariableDelegate::CreateStatic(&OnSettingChanged),
+		ECVF_Scalability);
+
+	TAutoConsoleVariable<int32> CVarSkyboxFallback(
+		TEXT("vr.Tunnelling.SkyboxFallback"),
+		0,
+		TEXT("Whether the skybox background is drawn as the colour background instead, with no capture.\n")
+		TEXT("Set by sg.VRTunnellingQuality."),
+		FConsoleVariableDelegate::CreateStatic(&OnSettingChanged),
+		ECVF_Scalability);
+
+	TAutoConsoleVariable<int32> CVarMasks(
+		TEXT("vr.Tunnelling.Masks"),
+		1,
+		TEXT("Whether mask modes are honoured. When 0 every mask mode acts as Off, and masked objects stop rendering custom depth.\n")
+		TEXT("Set by sg.VRTunnellingQuality."),
+		FConsoleVariableDelegate::CreateStatic(&OnSettingChanged),
+		ECVF_Scalability);
+} // anonymous namespace
+
+int32 FVRTPScalability::ClampCaptureResolution(int32 Resolution)
+{
+	const int32 MaxResolution = CVarMaxCaptureResolution.GetValueOnGameThread();
+	return MaxResolution > 0 ? FMath::Min(Resolution, MaxResolution) : Resolution;
+}
+
+bool FVRTPScalability::UseSkyboxFallback()
+{
+	return CVarSkyboxFallback.GetValueOnGameThread() != 0;
+}
+
+bool FVRTPScalability::AllowMasks()
+{
+	return CVarMasks.GetValueOnGameThread() != 0;
+}
+
+uint32 FVRTPScalability::GetGeneration()
+{
+	return Generation;
+}
@@ -0,0 +1,28 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+
+/// The VRTunnelling scalability group. Setting sg.VRTunnellingQuality (0 low to 3 epic) sets the console variables below, the same
+/// way the engine's own groups work, so device profiles can pick a tier or override any single variable:
+///   vr.Tunnelling.MaxCaptureResolution  largest skybox capture face (0: as configured)
+///   vr.Tunnelling.BlurQuality           depth of the native blur pyramid
+///   vr.Tunnelling.SkyboxFallback        draw the skybox background as a colour background
+///   vr.Tunnelling.Masks                 honour mask modes (otherwise they act as Off)
+///   vr.Tunnelling.IdleSkipDelay         open time before the vignette pass is skipped
+/// A [VRTunnellingQuality@N] section in the project's Scalability ini overrides the built-in values of tier N.
+class FVRTPScalability
+{
+public:
+	/// Resolution clamped to vr.Tunnelling.MaxCaptureResolution
+	static int32 ClampCaptureResolution(int32 Resolution);
+
+	/// Whether the skybox background is replaced by the colour background
+	static bool UseSkyboxFallback();
+
+	/// Whether mask modes are honoured
+	static bool AllowMasks();
+
+	/// Changes whenever a setting that components apply themselves changes, so they can compare it each tick
+	static uint32 GetGeneration();
+};
@@ -0,0 +1,20 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+
+/// Stat group for all tunnelling counters and timers ("stat VRTunnelling")
+DECLARE_STATS_GROUP(TEXT("VRTunnelling"), STATGROUP_VRTunnelling, STATCAT_Advanced);
+
+/// Native pass permutations drawn once while components initialise, into targets matching those of the real pass, so their
+/// pipeline states never compile mid-game
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Warmed PSOs"), STAT_VRTP_WarmedPSOs, STATGROUP_VRTunnelling, );
+
+/// Effect materials drawn once offscreen while components initialise. Their shaders are compiled and loaded, but the offscreen
+/// capture's targets differ from the player's view, so their pipeline states may still compile on first use.
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Warmed Materials"), STAT_VRTP_WarmedMaterials, STATGROUP_VRTunnelling, );
+
+/// Native pass permutations first drawn during gameplay without a warm-up, and effect materials first switched to during gameplay
+/// (warmed up or not, as their on-screen pipeline states are not precached); any count here is a potential hitch
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Gameplay PSO Compiles"), STAT_VRTP_GameplayPSOCompiles, STATGROUP_VRTunnelling, );
@@ -0,0 +1,224 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPWarmup.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "Materials/Material.h"
+#include "Misc/EngineVersionComparison.h"
+#include "VRTPPermutations.h"
+#include "VRTPRendering.h"
+#include "VRTPStats.h"
+
+DEFINE_STAT(STAT_VRTP_WarmedPSOs);
+DEFINE_STAT(STAT_VRTP_WarmedMaterials);
+DEFINE_STAT(STAT_VRTP_GameplayPSOCompiles);
+
+DEFINE_LOG_CATEGORY_STATIC(LogVRTPWarmup, Log, All);
+
+namespace {
+	TAutoConsoleVariable<int32> CVarWarmup(
+		TEXT("vr.Tunnelling.Warmup"),
+		1,
+		TEXT("Whether tunnelling components draw every effect material and native permutation they may use once while they initialise,\n")
+		TEXT("so switching background or mask mode during gameplay never compiles a pipeline state.\n")
+		TEXT(" 0: off; permutations are compiled the first time they are drawn\n")
+		TEXT(" 1: on (default)"),
+		ECVF_Default);
+} // anonymous namespace
+
+void FVRTPWarmupSet::AddMaterial(const TSoftObjectPtr<UMaterial>& Material, const TSoftObjectPtr<UVRTPMaterialPermutations>& Permutations)
+{
+	if (!Material.IsNull())
+	{
+		Materials.AddUnique(Material);
+	}
+	if (!Permutations.IsNull())
+	{
+		Tables.AddUnique(Permutations);
+	}
+}
+
+void FVRTPWarmupSet::AddNative(bool bBlend)
+{
+	// A pass that has to write the final output never blends, so blending also needs the copying permutations
+	NativePermutations |= GetVRTPNativePermutationMask(false);
+	if (bBlend)
+	{
+		NativePermutations |= GetVRTPNativePermutationMask(true);
+	}
+}
+
+void FVRTPWarmupSet::GetAssetPaths(TArray<FSoftObjectPath>& OutPaths) const
+{
+	for (const TSoftObjectPtr<UMaterial>& Material : Materials)
+	{
+		OutPaths.Add(Material.ToSoftObjectPath());
+	}
+	for (const TSoftObjectPtr<UVRTPMaterialPermutations>& Table : Tables)
+	{
+		OutPaths.Add(Table.ToSoftObjectPath());
+	}
+}
+
+void FVRTPWarmupSet::GetMaterials(TArray<UMaterialInterface*>& OutMaterials) const
+{
+	for (const TSoftObjectPtr<UMaterial>& Material : Materials)
+	{
+		if (Material.Get() != nullptr)
+		{
+			OutMaterials.AddUnique(Material.Get());
+		}
+	}
+	for (const TSoftObjectPtr<UVRTPMaterialPermutations>& Table : Tables)
+	{
+		if (const UVRTPMaterialPermutations* Permutations = Table.Get())
+		{
+			for (const FVRTPMaterialPermutation& Permutation : Permutations->Permutations)
+			{
+				if (Permutation.Material != nullptr)
+				{
+					OutMaterials.AddUnique(Permutation.Material);
+				}
+			}
+		}
+	}
+}
+
+//*************************************************************
+
+bool UVRTPWarmupSubsystem::IsEnabled()
+{
+	return CVarWarmup.GetValueOnGameThread() != 0;
+}
+
+bool UVRTPWarmupSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+void UVRTPWarmupSubsystem::Warm(const TArray<UMaterialInterface*>& Materials, bool bImmediate)
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	for (UMaterialInterface* Material : Materials)
+	{
+		if (Material != nullptr && !Warmed.Contains(Material))
+		{
+			Pending.AddUnique(Material);
+		}
+	}
+
+	if (bImmediate)
+	{
+		while (!IsIdle())
+		{
+			DrawNext();
+		}
+	}
+}
+
+void UVRTPWarmupSubsystem::NoteGameplayUse(UMaterialInterface* Material)
+{
+	if (Material == nullptr || UsedInGameplay.Contains(Material))
+	{
+		return;
+	}
+
+	// Counted once per material. The offscreen draw only compiled its shaders, so a warmed material still compiles the view's pipeline state now.
+	UsedInGameplay.Add(Material);
+	INC_DWORD_STAT(STAT_VRTP_GameplayPSOCompiles);
+	if (Warmed.Contains(Material))
+	{
+		UE_LOG(LogVRTPWarmup, Verbose, TEXT("%s compiles its on-screen pipeline state on first use"), *Material->GetPathName());
+		return;
+	}
+
+	// From now on it is as warm as if it had been drawn offscreen
+	Warmed.Add(Material);
+	Pending.Remove(Material);
+	UE_LOG(LogVRTPWarmup, Log, TEXT("%s was not warmed up and may hitch on its first frame; add its preset to Warmup Presets"), *Material->GetPathName());
+}
+
+void UVRTPWarmupSubsystem::Tick(float DeltaTime)
+{
+	if (!IsIdle())
+	{
+		DrawNext();
+	}
+	else if (Capture != nullptr)
+	{
+		// A frame after the last draw, which was already queued on the render thread
+		ReleaseCapture();
+	}
+}
+
+TStatId UVRTPWarmupSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UVRTPWarmupSubsystem, STATGROUP_Tickables);
+}
+
+void UVRTPWarmupSubsystem::DrawNext()
+{
+#if UE_VERSION_OLDER_THAN(5, 4, 0)
+	UMaterialInterface* Material = Pending.Pop(false);
+#else
+	UMaterialInterface* Material = Pending.Pop(EAllowShrinking::No);
+#endif
+	if (Material == nullptr || Warmed.Contains(Material))
+	{
+		return;
+	}
+
+	if (Capture == nullptr)
+	{
+		Target = NewObject<UTextureRenderTarget2D>(this);
+		Target->RenderTargetFormat = RTF_RGBA8;
+		Target->InitAutoFormat(VRTPWarmupTargetSize, VRTPWarmupTargetSize);
+		Target->UpdateResourceImmediate(true);
+
+		// Nothing is on the show-only list, so the capture runs post processing over an empty scene
+		Capture = NewObject<USceneCaptureComponent2D>(this);
+		Capture->bCaptureEveryFrame = false;
+		Capture->bCaptureOnMovement = false;
+		Capture->CaptureSource = ESceneCaptureSource::SCS_FinalColorLDR;
+		Capture->PrimitiveRenderMode = ESceneCapturePrimitiveRenderMode::PRM_UseShowOnlyList;
+		Capture->TextureTarget = Target;
+		Capture->RegisterComponentWithWorld(GetWorld());
+	}
+
+	Capture->PostProcessSettings.WeightedBlendables.Array.Reset();
+	Capture->PostProcessSettings.AddBlendable(Material, 1.0f);
+	Capture->CaptureScene();
+
+	// The capture's targets are not the view's, so this compiles and loads the material's shaders but not the view's pipeline state
+	Warmed.Add(Material);
+	INC_DWORD_STAT(STAT_VRTP_WarmedMaterials);
+}
+
+void UVRTPWarmupSubsystem::ReleaseCapture()
+{
+	if (Capture != nullptr)
+	{
+		Capture->DestroyComponent();
+		Capture = nullptr;
+	}
+	if (Target != nullptr)
+	{
+		Target->ReleaseResource();
+		Target = nullptr;
+	}
+}
+
+void UVRTPWarmupSubsystem::Deinitialize()
+{
+	ReleaseCapture();
+	Pending.Reset();
+	Warmed.Reset();
+	UsedInGameplay.Reset();
+
+	Super::Deinitialize();
+}
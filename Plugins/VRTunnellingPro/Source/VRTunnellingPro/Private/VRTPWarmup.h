@@ -0,0 +1,90 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "UObject/SoftObjectPtr.h"
+#include "VRTPWarmup.generated.h"
+
+class UMaterial;
+class UMaterialInterface;
+class USceneCaptureComponent2D;
+class UTextureRenderTarget2D;
+class UVRTPMaterialPermutations;
+
+/// Everything a component may draw the vignette with during gameplay: the effect materials and permutation tables of its own
+/// settings, its defaults and the presets it may apply, and the native pass permutations of those that use the native pass.
+class FVRTPWarmupSet
+{
+public:
+	/// Add an effect material and its permutation table, drawn as a post process material
+	void AddMaterial(const TSoftObjectPtr<UMaterial>& Material, const TSoftObjectPtr<UVRTPMaterialPermutations>& Permutations);
+
+	/// Add every background and mask permutation of the native pass, drawn over a copy of the scene or blended in place
+	void AddNative(bool bBlend);
+
+	/// The assets to load before the materials can be gathered
+	void GetAssetPaths(TArray<FSoftObjectPath>& OutPaths) const;
+
+	/// The loaded effect materials and every instance in their permutation tables
+	void GetMaterials(TArray<UMaterialInterface*>& OutMaterials) const;
+
+	/// Native pass permutations, as a mask of GetVRTPNativePermutationBit
+	uint32 GetNativePermutations() const { return NativePermutations; }
+
+private:
+	TArray<TSoftObjectPtr<UMaterial>> Materials;
+	TArray<TSoftObjectPtr<UVRTPMaterialPermutations>> Tables;
+	uint32 NativePermutations = 0;
+};
+
+/// Draws tunnelling effect materials once each into a small offscreen target while components initialise, so their shaders are
+/// compiled and loaded before the vignette first switches to them. The offscreen capture does not share the view's render targets,
+/// and the engine does not precache post process materials, so the pipeline state of the first on-screen draw is still compiled
+/// then. Shared by every component in the world; one material is drawn per frame, and a material is only ever drawn once.
+UCLASS()
+class UVRTPWarmupSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/// Whether effect materials are warmed up at all (vr.Tunnelling.Warmup)
+	static bool IsEnabled();
+
+	/// Queue Materials to be drawn. With bImmediate they are all drawn now, instead of one per frame.
+	void Warm(const TArray<UMaterialInterface*>& Materials, bool bImmediate);
+
+	/// Whether every queued material has been drawn
+	bool IsIdle() const { return Pending.Num() == 0; }
+
+	/// Record that the vignette has switched to Material during gameplay. Its on-screen pipeline state compiles now, whether or
+	/// not it was warmed up, which is counted once per material in "stat VRTunnelling"; a material never warmed up is also logged.
+	void NoteGameplayUse(UMaterialInterface* Material);
+
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+	virtual void Deinitialize() override;
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+private:
+	void DrawNext();
+	void ReleaseCapture();
+
+	UPROPERTY()
+	TArray<UMaterialInterface*> Pending;
+
+	UPROPERTY()
+	TSet<UMaterialInterface*> Warmed;
+
+	/// Materials the vignette has switched to during gameplay
+	UPROPERTY()
+	TSet<UMaterialInterface*> UsedInGameplay;
+
+	UPROPERTY()
+	USceneCaptureComponent2D* Capture = nullptr;
+
+	UPROPERTY()
+	UTextureRenderTarget2D* Target = nullptr;
+};
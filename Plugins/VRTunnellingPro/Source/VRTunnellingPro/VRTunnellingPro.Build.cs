@@ -37,9 +37,17 @@ public class VRTunnellingPro : ModuleRules
                 "HeadMountedDisplay",
 				"InputCore", 
 				"RHI", 
-				"RenderCore"
+				"RenderCore",
+				"Renderer",
+				"VRTunnellingProShaders"
 			}
 			);
+
+		// Skybox baking commandlet
+		if (Target.bBuildEditor)
+		{
+			PrivateDependencyModuleNames.Add("AssetRegistry");
+		}
 		
 		
 		DynamicallyLoadedModuleNames.AddRange(
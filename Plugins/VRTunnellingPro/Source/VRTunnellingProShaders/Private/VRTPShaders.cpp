@@ -0,0 +1,6 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#include "VRTPShaders.h"
+
+IMPLEMENT_GLOBAL_SHADER(FVRTPBlurCS, "/Plugin/VRTunnellingPro/Private/VRTPBlur.usf", "MainCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FVRTPVignettePS, "/Plugin/VRTunnellingPro/Private/VRTPVignette.usf", "MainPS", SF_Pixel);
+IMPLEMENT_GLOBAL_SHADER(FVRTPAnnulusVS, "/Plugin/VRTunnellingPro/Private/VRTPVignette.usf", "AnnulusVS", SF_Vertex);
@@ -0,0 +1,22 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+
+#include "VRTunnellingProShaders.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/Paths.h"
+#include "ShaderCore.h"
+
+#define LOCTEXT_NAMESPACE "FVRTunnellingProShadersModule"
+
+void FVRTunnellingProShadersModule::StartupModule()
+{
+	const FString ShaderDirectory = FPaths::Combine(IPluginManager::Get().FindPlugin(TEXT("VRTunnellingPro"))->GetBaseDir(), TEXT("Shaders"));
+	AddShaderSourceDirectoryMapping(TEXT("/Plugin/VRTunnellingPro"), ShaderDirectory);
+}
+
+void FVRTunnellingProShadersModule::ShutdownModule()
+{
+}
+
+#undef LOCTEXT_NAMESPACE
+
+IMPLEMENT_MODULE(FVRTunnellingProShadersModule, VRTunnellingProShaders)
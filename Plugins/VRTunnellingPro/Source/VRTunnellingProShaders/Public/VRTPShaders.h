@@ -0,0 +1,112 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GlobalShader.h"
+#include "ShaderParameterStruct.h"
+#include "SceneView.h"
+#include "SceneRenderTargetParameters.h"
+#include "ScreenPass.h"
+
+BEGIN_SHADER_PARAMETER_STRUCT(FVRTPVignetteParameters, VRTUNNELLINGPROSHADERS_API)
+	SHADER_PARAMETER_STRUCT_REF(FViewUniformShaderParameters, View)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FSceneTextureShaderParameters, SceneTextures)
+	SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, Input)
+	SHADER_PARAMETER_STRUCT(FScreenPassTextureViewportParameters, Output)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
+	SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+	SHADER_PARAMETER_TEXTURE(TextureCube, Cubemap)
+	SHADER_PARAMETER_SAMPLER(SamplerState, CubemapSampler)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, BlurTexture)
+	SHADER_PARAMETER_SAMPLER(SamplerState, BlurSampler)
+	SHADER_PARAMETER(float, Radius)
+	SHADER_PARAMETER(float, OuterRadius)
+	SHADER_PARAMETER(uint32, NumSegments)
+	SHADER_PARAMETER(FVector2f, Shift)
+	SHADER_PARAMETER(float, Feather)
+	SHADER_PARAMETER(FVector3f, EffectColor)
+	SHADER_PARAMETER(float, ApplyEffectColor)
+	SHADER_PARAMETER(FVector3f, Forward)
+	SHADER_PARAMETER(FVector3f, Right)
+	SHADER_PARAMETER(FVector3f, Up)
+	SHADER_PARAMETER(uint32, StencilIndex)
+	SHADER_PARAMETER(uint32, StencilBits)
+	SHADER_PARAMETER_TEXTURE(Texture2D, MaskTexture)
+	SHADER_PARAMETER_SAMPLER(SamplerState, MaskSampler)
+	SHADER_PARAMETER(FMatrix44f, MaskTranslatedWorldToClip)
+	SHADER_PARAMETER(uint32, UseMaskTexture)
+	RENDER_TARGET_BINDING_SLOTS()
+END_SHADER_PARAMETER_STRUCT()
+
+/// The vignette, with a permutation per background mode, mask mode and whether it blends in place
+class VRTUNNELLINGPROSHADERS_API FVRTPVignettePS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FVRTPVignettePS);
+	SHADER_USE_PARAMETER_STRUCT(FVRTPVignettePS, FGlobalShader);
+	using FParameters = FVRTPVignetteParameters;
+
+	static constexpr int32 NumBackgroundModes = 3;
+	static constexpr int32 NumMaskModes = 4;
+
+	class FBackgroundDim : SHADER_PERMUTATION_INT("VRTP_BACKGROUND", NumBackgroundModes);
+	class FMaskModeDim : SHADER_PERMUTATION_INT("VRTP_MASK_MODE", NumMaskModes);
+	class FBlendDim : SHADER_PERMUTATION_BOOL("VRTP_BLEND");
+	using FPermutationDomain = TShaderPermutationDomain<FBackgroundDim, FMaskModeDim, FBlendDim>;
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+/// Procedural ring from the clear radius to beyond the screen corners, generated from the vertex index
+class VRTUNNELLINGPROSHADERS_API FVRTPAnnulusVS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FVRTPAnnulusVS);
+	SHADER_USE_PARAMETER_STRUCT(FVRTPAnnulusVS, FGlobalShader);
+	using FParameters = FVRTPVignetteParameters;
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+};
+
+/// One level of the blur pyramid
+class VRTUNNELLINGPROSHADERS_API FVRTPBlurCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FVRTPBlurCS);
+	SHADER_USE_PARAMETER_STRUCT(FVRTPBlurCS, FGlobalShader);
+
+	static constexpr int32 ThreadGroupSize = 8;
+
+	class FUpsampleDim : SHADER_PERMUTATION_BOOL("VRTP_BLUR_UP");
+	using FPermutationDomain = TShaderPermutationDomain<FUpsampleDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
+		SHADER_PARAMETER_SAMPLER(SamplerState, InputSampler)
+		SHADER_PARAMETER(FVector2f, InputUVMin)
+		SHADER_PARAMETER(FVector2f, InputUVSize)
+		SHADER_PARAMETER(FVector2f, InputTexelSize)
+		SHADER_PARAMETER(FVector2f, InputUVClampMin)
+		SHADER_PARAMETER(FVector2f, InputUVClampMax)
+		SHADER_PARAMETER(FIntPoint, OutputSize)
+		SHADER_PARAMETER(FVector2f, OutputTexelSize)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, OutputTexture)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
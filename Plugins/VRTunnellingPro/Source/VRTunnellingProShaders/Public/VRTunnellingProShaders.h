@@ -0,0 +1,15 @@
+// Copyright 2021 Darby Costello. All Rights Reserved.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Modules/ModuleManager.h"
+
+/// Maps the plugin's shader directory; loads at PostConfigInit so the mapping exists before global shaders compile
+class FVRTunnellingProShadersModule : public IModuleInterface
+{
+public:
+
+	/** IModuleInterface implementation */
+	virtual void StartupModule() override;
+	virtual void ShutdownModule() override;
+};